@@ -29,10 +29,34 @@
 #define _PM_HPP
 
 #include <pm/phase.hpp>
+#include <pm/aggregator.hpp>
+#include <pm/allocation_tag.hpp>
+#include <pm/calibration.hpp>
+#include <pm/comparison.hpp>
+#include <pm/cpu_time.hpp>
+#include <pm/io_counter.hpp>
+#include <pm/lap_histogram.hpp>
+#include <pm/leak_tracker.hpp>
 #include <pm/malloc_counter.hpp>
+#include <pm/malloc_histogram.hpp>
+#include <pm/malloc_sampler.hpp>
+#include <pm/measurement_switch.hpp>
+#include <pm/memory_timeline.hpp>
 #include <pm/noop_phase.hpp>
+#include <pm/perf_counters.hpp>
+#include <pm/process_memory.hpp>
+#include <pm/rapl_energy.hpp>
 #include <pm/result.hpp>
+#include <pm/result_writer.hpp>
+#include <pm/scoped_phase.hpp>
+#include <pm/sharded_malloc_counter.hpp>
 #include <pm/stopwatch.hpp>
+#include <pm/switchable_phase.hpp>
+#include <pm/tag_counter.hpp>
+#include <pm/trace_recorder.hpp>
+#include <pm/tsc_stopwatch.hpp>
+#include <pm/untracked_scope.hpp>
+#include <pm/worker_load.hpp>
 
 namespace pm {
 
@@ -55,6 +79,13 @@ using TimePhase = Phase<Stopwatch>;
  */
 using MemoryTimePhase = Phase<MallocCounter, Stopwatch>;
 
+/**
+ * \brief Predefined configuration for \ref Phase "phases" around parallel regions that measure the load of the worker threads
+ * 
+ * Workers record their share via \ref WorkerLoad::Scope "scopes" on the phase's first meter.
+ */
+using ParallelPhase = Phase<WorkerLoad>;
+
 }
 
 #endif
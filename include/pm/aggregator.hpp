@@ -0,0 +1,235 @@
+/**
+ * pm/aggregator.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_AGGREGATOR_HPP
+#define _PM_AGGREGATOR_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <pm/result.hpp>
+
+namespace pm {
+
+/**
+ * \brief Merges the results of many processes, such as the ranks of an MPI job, into a single summary
+ * 
+ * Results are added as \ref Result objects or as the data of phases, which are flattened into key paths like \ref Result::add_phase_data does,
+ * so phase hierarchies are matched by the names of their phases.
+ * Every added result counts as coming from one rank, which is the number of results added before unless given explicitly
+ * or unless the result contains an integral value for the key `rank` (or `data.rank` for phase data), which is then not summarized itself.
+ * 
+ * For every key with numeric values, the summary reports the number of values reported for the key, where a key repeated within a result counts every time,
+ * the minimum, maximum, mean and sum of the values, as well as the ranks with the minimum and maximum values.
+ * For time measurements, the latter is the slowest rank.
+ * For keys with other values, the summary reports the value if all ranks agree on it, or the distinct values otherwise.
+ * The distinct values are only collected once a key has seen a non-numeric value, so numeric keys take constant space.
+ * Of the numeric values that a key has seen before, only those of the minimum and maximum are kept as distinct values.
+ */
+class Aggregator {
+public:
+    /**
+     * \brief The keys that identify the rank of a result
+     */
+    static constexpr char const* RANK_KEYS[] = { "rank", "data.rank" };
+
+private:
+    struct Key {
+        size_t num = 0;
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double sum = 0.0;
+        size_t min_rank = 0;
+        size_t max_rank = 0;
+        std::string min_value; // the values of the minimum and maximum as given, in case the key turns non-numeric
+        std::string max_value;
+        std::vector<std::string> distinct; // for non-numeric keys only
+        bool numeric = true;
+    };
+
+    size_t num_ranks_;
+    std::map<std::string, Key> keys_;
+
+    inline static bool is_rank_key(std::string const& key) {
+        return std::find_if(std::begin(RANK_KEYS), std::end(RANK_KEYS), [&](char const* k){ return key == k; }) != std::end(RANK_KEYS);
+    }
+
+    inline static std::optional<size_t> find_rank(Result const& result) {
+        for(auto const& pair : result.pairs()) {
+            if(is_rank_key(pair.key)) {
+                size_t rank;
+                auto const end = pair.value.data() + pair.value.size();
+                auto const r = std::from_chars(pair.value.data(), end, rank);
+                if(r.ec == std::errc() && r.ptr == end) return rank;
+            }
+        }
+        return std::nullopt;
+    }
+
+    inline void add_pairs(Result const& result, std::optional<size_t> rank) {
+        if(!rank) rank = find_rank(result);
+        size_t const r = rank ? *rank : num_ranks_;
+        ++num_ranks_;
+
+        for(auto const& pair : result.pairs()) {
+            if(is_rank_key(pair.key)) continue;
+
+            auto& k = keys_[pair.key];
+            std::string const& value = pair.value;
+
+            if(k.numeric) {
+                if(auto const x = Result::parse_number(value)) {
+                    if(k.num == 0 || *x < k.min) {
+                        k.min = *x;
+                        k.min_rank = r;
+                        k.min_value = value;
+                    }
+                    if(k.num == 0 || *x > k.max) {
+                        k.max = *x;
+                        k.max_rank = r;
+                        k.max_value = value;
+                    }
+                    k.sum += *x;
+                    ++k.num;
+                    continue;
+                }
+
+                // the key turns non-numeric, keep the extremes seen so far as distinct values
+                k.numeric = false;
+                if(k.num > 0) {
+                    k.distinct.push_back(std::move(k.min_value));
+                    if(k.max_value != k.distinct.back()) k.distinct.push_back(std::move(k.max_value));
+                }
+            }
+
+            if(std::find(k.distinct.begin(), k.distinct.end(), value) == k.distinct.end()) k.distinct.push_back(value);
+            ++k.num;
+        }
+    }
+
+public:
+    inline Aggregator() : num_ranks_(0) {
+    }
+
+    /**
+     * \brief Adds a result
+     * 
+     * \param result the result
+     * \param rank the rank that produced the result, by default determined as described for the class
+     */
+    inline void add(Result const& result, std::optional<size_t> rank = std::nullopt) {
+        add_pairs(result, rank);
+    }
+
+    /**
+     * \brief Adds the data of a phase
+     * 
+     * \param data the data of a \ref Phase , as returned by \ref Phase::gather_data
+     * \param rank the rank that produced the data, by default determined as described for the class
+     */
+    inline void add_phase_data(nlohmann::json const& data, std::optional<size_t> rank = std::nullopt) {
+        Result r;
+        r.add_phase_data(data);
+        add(r, rank);
+    }
+
+    /**
+     * \brief The number of added results
+     * 
+     * \return the number of added results
+     */
+    size_t num_ranks() const { return num_ranks_; }
+
+    /**
+     * \brief Reports the summary as a JSON object
+     * 
+     * The object contains the number of `ranks` and the summary of every key in `keys`.
+     * 
+     * \return the summary
+     */
+    nlohmann::json summary() const {
+        auto keys = nlohmann::json::object();
+        for(auto const& [key, k] : keys_) {
+            nlohmann::json obj;
+            obj["num"] = k.num;
+            if(k.numeric) {
+                obj["min"] = k.min;
+                obj["max"] = k.max;
+                obj["mean"] = k.sum / (double)k.num;
+                obj["sum"] = k.sum;
+                obj["min_rank"] = k.min_rank;
+                obj["max_rank"] = k.max_rank;
+            } else if(k.distinct.size() == 1) {
+                obj["value"] = k.distinct.front();
+            } else {
+                obj["values"] = k.distinct;
+            }
+            keys[key] = std::move(obj);
+        }
+
+        nlohmann::json obj;
+        obj["ranks"] = num_ranks_;
+        obj["keys"] = std::move(keys);
+        return obj;
+    }
+
+    /**
+     * \brief Reports the summary as a single \ref Result
+     * 
+     * For every numeric key `k`, the keys `k.min`, `k.max`, `k.mean`, `k.sum` and `k.max_rank` are reported.
+     * Non-numeric keys are reported with their value if all ranks agree on it, and omitted otherwise.
+     * 
+     * \return the summary
+     */
+    Result result() const {
+        Result r;
+        r.add("ranks", num_ranks_);
+        for(auto const& [key, k] : keys_) {
+            if(k.numeric) {
+                r.add(key + ".min", k.min);
+                r.add(key + ".max", k.max);
+                r.add(key + ".mean", k.sum / (double)k.num);
+                r.add(key + ".sum", k.sum);
+                r.add(key + ".max_rank", k.max_rank);
+            } else if(k.distinct.size() == 1) {
+                r.add(std::string(key), k.distinct.front());
+            }
+        }
+        return r;
+    }
+};
+
+}
+
+#endif
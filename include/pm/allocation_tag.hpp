@@ -0,0 +1,186 @@
+/**
+ * pm/allocation_tag.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_ALLOCATION_TAG_HPP
+#define _PM_ALLOCATION_TAG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pm/malloc/hook.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief A named category of memory allocations, such as a data structure
+ * 
+ * Tags are registered by name in a process-wide registry and identified by a small ID, which is stored in the header of every block
+ * allocated within a \ref TagScope , so that the block's free can be credited back to the same tag.
+ * Tags with the same name share the same ID.
+ * The ID zero is reserved for untagged allocations.
+ * 
+ * Allocation tags require tudocomp's `malloc` overrides with block headers,
+ * i.e., all allocations are untagged if the overrides are disabled or if pm was built with `PM_MALLOC_USABLE_SIZE`.
+ */
+class AllocationTag {
+public:
+    /**
+     * \brief The maximum number of tags, including the untagged one
+     */
+    static constexpr size_t MAX_TAGS = 256;
+
+    /**
+     * \brief The name reported for untagged allocations
+     */
+    static constexpr char const* UNTAGGED_NAME = "untagged";
+
+private:
+    inline static std::mutex& mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    inline static std::vector<std::string>& names() {
+        static std::vector<std::string> names = [](){
+            UntrackedScope untracked;
+            std::vector<std::string> names;
+            names.reserve(MAX_TAGS);
+            names.emplace_back(UNTAGGED_NAME);
+            return names;
+        }();
+        return names;
+    }
+
+    uint8_t id_;
+
+public:
+    /**
+     * \brief Reports the name of the tag with the given ID
+     * 
+     * \param id the tag's ID
+     * \return the tag's name, or an empty string if no tag with the given ID has been registered
+     */
+    inline static std::string name(uint8_t id) {
+        std::lock_guard lock(mutex());
+        auto const& n = names();
+        return id < n.size() ? n[id] : std::string();
+    }
+
+    /**
+     * \brief Reports the number of registered tags, including the untagged one
+     * 
+     * \return the number of registered tags
+     */
+    inline static size_t num_tags() {
+        std::lock_guard lock(mutex());
+        return names().size();
+    }
+
+    /**
+     * \brief Refers to untagged allocations
+     */
+    inline AllocationTag() : id_(0) {
+    }
+
+    /**
+     * \brief Looks up the tag with the given name, registering it if it does not exist yet
+     * 
+     * If \ref MAX_TAGS tags are already registered, a `std::length_error` is thrown.
+     * 
+     * \param name the tag's name
+     */
+    inline AllocationTag(std::string const& name) {
+        UntrackedScope untracked;
+        std::lock_guard lock(mutex());
+
+        auto& n = names();
+        for(size_t i = 0; i < n.size(); i++) {
+            if(n[i] == name) {
+                id_ = i;
+                return;
+            }
+        }
+
+        if(n.size() >= MAX_TAGS) throw std::length_error("too many allocation tags");
+        id_ = n.size();
+        n.push_back(name);
+    }
+
+    /**
+     * \brief The tag's ID
+     * 
+     * \return the tag's ID
+     */
+    uint8_t id() const { return id_; }
+
+    /**
+     * \brief The tag's name
+     * 
+     * \return the tag's name
+     */
+    std::string name() const { return name(id_); }
+
+    bool operator==(AllocationTag const& other) const { return id_ == other.id_; }
+};
+
+/**
+ * \brief Tags the memory allocated by the current thread during its lifetime with an \ref AllocationTag
+ * 
+ * Scopes can be nested, in which case the innermost scope's tag applies.
+ * Allocations are reported with their tag, which meters such as the \ref TagCounter can use to attribute memory to categories.
+ */
+class TagScope {
+private:
+    #if defined(PM_MALLOC) && !defined(_WIN32)
+    uint8_t prev_;
+    #endif
+
+public:
+    #if defined(PM_MALLOC) && !defined(_WIN32)
+    inline TagScope(AllocationTag tag) : prev_(malloc_hook::set_tag(tag.id())) {
+    }
+
+    inline ~TagScope() {
+        malloc_hook::set_tag(prev_);
+    }
+    #else
+    inline TagScope(AllocationTag) {}
+    #endif
+
+    TagScope(TagScope const&) = delete;
+    TagScope(TagScope&&) = delete;
+    TagScope& operator=(TagScope const&) = delete;
+    TagScope& operator=(TagScope&&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * pm/benchmark.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_BENCHMARK_HPP
+#define _PM_BENCHMARK_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pm/concepts.hpp>
+#include <pm/json.hpp>
+#include <pm/phase.hpp>
+#include <pm/statistics.hpp>
+#include <pm/stopwatch.hpp>
+
+namespace pm {
+
+/**
+ * \brief Prevents the compiler from optimizing away the computation of the given value
+ * 
+ * The value is treated as if it were read by an opaque instruction.
+ * 
+ * \param value the value
+ */
+template<typename T>
+inline void do_not_optimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * \brief Prevents the compiler from optimizing away or reordering memory writes across this call
+ */
+inline void clobber_memory() {
+    asm volatile("" : : : "memory");
+}
+
+/**
+ * \brief Configures how often a benchmark is repeated
+ * 
+ * After the warmup runs, a benchmark is repeated at least \ref min_repetitions and at most \ref max_repetitions times.
+ * In between, repetitions stop as soon as the time budget is exhausted,
+ * or as soon as the 95% confidence interval of the mean running time is narrower than the target relative to the mean.
+ */
+struct BenchmarkConfig {
+    /**
+     * \brief The number of warmup runs, which are not measured
+     */
+    size_t warmup = 3;
+
+    /**
+     * \brief The minimum number of measured repetitions
+     */
+    size_t min_repetitions = 5;
+
+    /**
+     * \brief The maximum number of measured repetitions
+     */
+    size_t max_repetitions = 1000;
+
+    /**
+     * \brief The time budget for the measured repetitions in milliseconds
+     */
+    double budget_millis = 1000.0;
+
+    /**
+     * \brief The target half width of the confidence interval relative to the mean running time, or zero to always use up the time budget
+     */
+    double target_confidence = 0.01;
+};
+
+/**
+ * \brief Benchmarks the given function
+ * 
+ * For every run, a fresh phase is started, the function is called and then the phase is stopped.
+ * If the function accepts a reference to the phase, it is passed, so it can, e.g., pause the measurement or store data.
+ * The stopping rule only considers the running time of the function itself, excluding the construction of the phase and the gathering of its data.
+ * 
+ * The result has the same layout as \ref Phase::gather_data , but every numeric metric is replaced by its \ref Statistics "statistics" over all measured repetitions
+ * (see \ref aggregate ).
+ * The data object is that of the last repetition, plus the number of `warmup` runs and `repetitions`.
+ * 
+ * \tparam P the phase type to measure with
+ * \param name the name of the benchmark
+ * \param f the function to benchmark
+ * \param config the benchmark configuration
+ * \return the aggregated measurement data
+ */
+template<JSONMeasurementPhase P = Phase<Stopwatch>, typename F>
+nlohmann::json benchmark(std::string const& name, F&& f, BenchmarkConfig const& config = {}) {
+    using Clock = std::chrono::steady_clock;
+
+    // runs the function once, reports the data of the phase and the running time of the function in milliseconds
+    auto run = [&](nlohmann::json& data){
+        P phase{std::string(name)};
+        phase.start();
+        auto const t0 = Clock::now();
+        if constexpr(std::is_invocable_v<F&, P&>) {
+            f(phase);
+        } else {
+            f();
+        }
+        auto const t1 = Clock::now();
+        phase.stop();
+        data = phase.gather_data();
+        return std::chrono::duration<double, std::milli>(t1 - t0).count();
+    };
+
+    nlohmann::json last;
+    for(size_t i = 0; i < config.warmup; i++) run(last);
+
+    std::vector<nlohmann::json> metrics;
+    std::vector<double> times;
+
+    auto const budget = std::chrono::duration<double, std::milli>(config.budget_millis);
+    auto const start = Clock::now();
+    while(times.size() < config.max_repetitions) {
+        times.push_back(run(last));
+        if(last.contains(JSON_KEY_METRICS)) metrics.push_back(last[JSON_KEY_METRICS]);
+
+        if(times.size() >= config.min_repetitions) {
+            if(Clock::now() - start >= budget) break;
+            if(config.target_confidence > 0.0) {
+                auto const s = Statistics::of(times);
+                if(s.confidence_half_width() <= config.target_confidence * s.mean) break;
+            }
+        }
+    }
+
+    nlohmann::json result;
+    result[JSON_KEY_NAME] = name;
+    if(!metrics.empty()) result[JSON_KEY_METRICS] = aggregate(metrics);
+
+    nlohmann::json data = last.contains(JSON_KEY_DATA) ? last[JSON_KEY_DATA] : nlohmann::json::object();
+    data["warmup"] = config.warmup;
+    data["repetitions"] = times.size();
+    result[JSON_KEY_DATA] = std::move(data);
+    return result;
+}
+
+/**
+ * \brief Global registry of benchmarks
+ * 
+ * Benchmarks are usually registered using the \ref PM_BENCHMARK or \ref PM_BENCHMARK_PHASE macros
+ * and run using \ref benchmark_main .
+ */
+class BenchmarkRegistry {
+public:
+    /**
+     * \brief A registered benchmark
+     */
+    struct Entry {
+        /**
+         * \brief The name of the benchmark
+         */
+        std::string name;
+
+        /**
+         * \brief Runs the benchmark with the given configuration
+         */
+        std::function<nlohmann::json(BenchmarkConfig const&)> run;
+    };
+
+    /**
+     * \brief Provides access to the registered benchmarks in order of registration
+     * 
+     * \return the registered benchmarks
+     */
+    inline static std::vector<Entry>& entries() {
+        static std::vector<Entry> entries;
+        return entries;
+    }
+
+    /**
+     * \brief Registers a benchmark
+     * 
+     * \tparam P the phase type to measure with
+     * \param name the name of the benchmark
+     * \param f the function to benchmark, which must accept a reference to the phase
+     * \return true
+     */
+    template<JSONMeasurementPhase P>
+    inline static bool add(std::string name, void (*f)(P&)) {
+        entries().push_back({ name, [name, f](BenchmarkConfig const& config){ return benchmark<P>(name, f, config); } });
+        return true;
+    }
+
+    /**
+     * \brief Runs all registered benchmarks whose names match the given regular expression
+     * 
+     * \param filter the regular expression to search for in the benchmark names
+     * \param config the benchmark configuration
+     * \return a JSON array containing the results of the benchmarks that were run
+     * \throws std::regex_error if the filter is not a valid regular expression
+     */
+    inline static nlohmann::json run(std::string const& filter, BenchmarkConfig const& config) {
+        std::regex const re(filter);
+        auto results = nlohmann::json::array();
+        for(auto const& e : entries()) {
+            if(std::regex_search(e.name, re)) results.push_back(e.run(config));
+        }
+        return results;
+    }
+};
+
+/**
+ * \brief Runs the registered benchmarks as configured by the given command line arguments and prints the results to the standard output
+ * 
+ * The results are printed as a JSON array.
+ * The following arguments are supported:
+ * - `--filter REGEX` only runs benchmarks whose names match the regular expression
+ * - `--list` only prints the names of the matching benchmarks, one per line
+ * - `--warmup N` sets the number of warmup runs
+ * - `--min-repetitions N` and `--max-repetitions N` set the bounds for the number of measured repetitions
+ * - `--budget MILLIS` sets the time budget per benchmark
+ * - `--confidence FRACTION` sets the target relative confidence interval, or zero to always use the full time budget
+ * 
+ * Invalid arguments, such as malformed numbers or regular expressions, are reported to the standard error and result in a failure exit code.
+ * 
+ * \param argc the number of command line arguments
+ * \param argv the command line arguments
+ * \return the process exit code
+ */
+inline int benchmark_main(int argc, char** argv) {
+    std::string filter = ".*";
+    bool list = false;
+    BenchmarkConfig config;
+
+    // nb: strtoull accepts a minus sign, which is rejected here
+    auto parse_size = [](char const* s, size_t& out){
+        char* end;
+        errno = 0;
+        out = std::strtoull(s, &end, 10);
+        return *s && *s != '-' && *end == 0 && errno == 0;
+    };
+
+    auto parse_nonnegative = [](char const* s, double& out){
+        char* end;
+        errno = 0;
+        out = std::strtod(s, &end);
+        return *s && *end == 0 && errno == 0 && out >= 0.0;
+    };
+
+    for(int i = 1; i < argc; i++) {
+        std::string const arg = argv[i];
+        auto value = [&]() -> char const* {
+            if(i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << std::endl;
+                return nullptr;
+            }
+            return argv[++i];
+        };
+
+        char const* v = nullptr;
+        bool valid = true;
+        if(arg == "--list") {
+            list = true;
+        } else if(arg == "--filter") {
+            if((v = value())) filter = v;
+        } else if(arg == "--warmup") {
+            if((v = value())) valid = parse_size(v, config.warmup);
+        } else if(arg == "--min-repetitions") {
+            if((v = value())) valid = parse_size(v, config.min_repetitions);
+        } else if(arg == "--max-repetitions") {
+            if((v = value())) valid = parse_size(v, config.max_repetitions);
+        } else if(arg == "--budget") {
+            if((v = value())) valid = parse_nonnegative(v, config.budget_millis);
+        } else if(arg == "--confidence") {
+            if((v = value())) valid = parse_nonnegative(v, config.target_confidence);
+        } else {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if(arg != "--list" && !v) return EXIT_FAILURE;
+        if(!valid) {
+            std::cerr << "invalid value for " << arg << ": " << v << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(config.min_repetitions > config.max_repetitions) {
+        std::cerr << "the minimum number of repetitions exceeds the maximum" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if(list) {
+            std::regex const re(filter);
+            for(auto const& e : BenchmarkRegistry::entries()) {
+                if(std::regex_search(e.name, re)) std::cout << e.name << std::endl;
+            }
+        } else {
+            std::cout << BenchmarkRegistry::run(filter, config).dump(4) << std::endl;
+        }
+    } catch(std::regex_error const& e) {
+        std::cerr << "invalid filter: " << filter << " (" << e.what() << ")" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+}
+
+/**
+ * \brief Defines and registers a benchmark that is measured using the given phase type
+ * 
+ * The macro must be followed by the benchmark's function body, in which the running phase is accessible as `phase`.
+ * 
+ * \param id the name of the benchmark, which must be a valid identifier
+ * \param P the phase type to measure with
+ */
+#define PM_BENCHMARK_PHASE(id, P) \
+    static void pm_benchmark_##id(P& phase); \
+    [[maybe_unused]] static bool const pm_benchmark_registered_##id = ::pm::BenchmarkRegistry::add<P>(#id, &pm_benchmark_##id); \
+    static void pm_benchmark_##id([[maybe_unused]] P& phase)
+
+/**
+ * \brief Defines and registers a benchmark that measures running time
+ * 
+ * The macro must be followed by the benchmark's function body.
+ * 
+ * \param id the name of the benchmark, which must be a valid identifier
+ */
+#define PM_BENCHMARK(id) PM_BENCHMARK_PHASE(id, ::pm::Phase<::pm::Stopwatch>)
+
+/**
+ * \brief Defines a `main` function that calls \ref pm::benchmark_main
+ */
+#define PM_BENCHMARK_MAIN() int main(int argc, char** argv) { return ::pm::benchmark_main(argc, argv); }
+
+#endif
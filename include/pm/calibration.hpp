@@ -0,0 +1,244 @@
+/**
+ * pm/calibration.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_CALIBRATION_HPP
+#define _PM_CALIBRATION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <nlohmann/json.hpp>
+#include <pm/concepts.hpp>
+#include <pm/malloc_callback.hpp>
+#include <pm/overhead.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures time durations with the calibrated overhead of nested measurements subtracted
+ * 
+ * Like \ref Stopwatch , this measures the elapsed wall time.
+ * In addition, it subtracts the following costs, as determined by \ref calibrate , from every measured interval:
+ * - the calibrated start-stop cost of every \ref Phase stopped on the same thread during the interval,
+ * - for every allocation or free dispatched to the \ref MallocCallback "callbacks" on the same thread during the interval,
+ *   the calibrated dispatch costs of the types of all phases running on that thread at the time, including the enclosing phase,
+ * - and the time it measures for an empty interval itself.
+ * 
+ * Events that occur while no callback is registered are not dispatched and cost nothing.
+ * 
+ * Note that the cost of gathering the data of child phases, e.g., when they are attached to a parent, is not accounted for.
+ * The correction of an interval never results in a negative time.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class CalibratedStopwatch {
+private:
+    using Clock = std::chrono::high_resolution_clock;
+    using Time = Clock::time_point;
+
+    Time start_;
+    double overhead_start_;
+    double dispatched_start_;
+    double elapsed_;
+    double corrected_;
+
+public:
+    /**
+     * \brief Constructs a new stopwatch
+     * 
+     * Note that this does \em not start the stopwatch; \ref start must be called manually.
+     */
+    inline CalibratedStopwatch() : overhead_start_(0), dispatched_start_(0), elapsed_(0), corrected_(0) {}
+
+    CalibratedStopwatch(CalibratedStopwatch const& other) = delete;
+    CalibratedStopwatch(CalibratedStopwatch&& other) = default;
+    CalibratedStopwatch& operator=(CalibratedStopwatch const& other) = delete;
+    CalibratedStopwatch& operator=(CalibratedStopwatch&& other) = default;
+
+    /**
+     * \brief Starts the time measurement
+     * 
+     * This will reset the elapsed time to zero
+     */
+    inline void start() {
+        elapsed_ = 0;
+        corrected_ = 0;
+        resume();
+    }
+
+    /**
+     * \brief Pauses the time measurement
+     * 
+     */
+    inline void pause() {
+        auto const t = Clock::now();
+        double const raw = std::chrono::duration<double, std::nano>(t - start_).count();
+        double const overhead =
+            (Overhead::accumulated() - overhead_start_) +
+            (Overhead::dispatched() - dispatched_start_) +
+            Overhead::stopwatch();
+
+        elapsed_ += raw;
+        corrected_ += std::max(0.0, raw - overhead);
+    }
+
+    /**
+     * \brief Resumes the time measurement
+     * 
+     */
+    inline void resume() {
+        overhead_start_ = Overhead::accumulated();
+        dispatched_start_ = Overhead::dispatched();
+        start_ = Clock::now();
+    }
+
+    /**
+     * \brief Stops the time measurement
+     * 
+     * This is technically equivalent to pausing the stopwatch.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief Reports the measured elapsed time without any correction in milliseconds
+     * 
+     * \return the measured elapsed time in milliseconds
+     */
+    double elapsed_time_millis() const { return elapsed_ / 1'000'000.0; }
+
+    /**
+     * \brief Reports the measured elapsed time minus the calibrated overhead in milliseconds
+     * 
+     * \return the corrected elapsed time in milliseconds
+     */
+    double corrected_time_millis() const { return corrected_ / 1'000'000.0; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "calibrated_time"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * Both the `raw` and the `corrected` time are reported in milliseconds,
+     * so the correction can be judged without a separate \ref Stopwatch .
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["raw"] = elapsed_time_millis();
+        obj["corrected"] = corrected_time_millis();
+        return obj;
+    }
+};
+
+/**
+ * \brief Calibrates the overhead of phases of the given type
+ * 
+ * This measures the average time it takes to start and stop a phase of the given type,
+ * and the average time that a running phase of the given type adds to dispatching an allocation event to the registered \ref MallocCallback "callbacks".
+ * It also measures the time that a \ref CalibratedStopwatch reports for an empty interval.
+ * The results are stored in \ref Overhead per phase type and used by \ref CalibratedStopwatch ,
+ * so calibrating one phase type does not affect the corrections for others.
+ * 
+ * This should be called once per phase type at startup.
+ * Because the dispatch calibration reports fake allocation events to the registered callbacks, which would end up in
+ * any running measurement, no \ref MallocCallback may be registered when this is called.
+ * 
+ * \tparam P the phase type
+ * \param n the number of repetitions of each measurement
+ * \throws std::logic_error if any malloc callback is registered
+ */
+template<JSONMeasurementPhase P>
+void calibrate(size_t n = 1000) {
+    using Clock = std::chrono::high_resolution_clock;
+    auto nanos_since = [](Clock::time_point t0){ return std::chrono::duration<double, std::nano>(Clock::now() - t0).count(); };
+
+    if(MallocCallback::num_registered() > 0) {
+        throw std::logic_error("cannot calibrate while malloc callbacks are registered");
+    }
+
+    n = std::max(n, size_t(1));
+
+    // empty stopwatch intervals
+    {
+        Overhead::stopwatch() = 0.0;
+        CalibratedStopwatch s;
+        double sum = 0.0;
+        for(size_t i = 0; i < n; i++) {
+            s.start();
+            s.stop();
+            sum += s.elapsed_time_millis() * 1'000'000.0;
+        }
+        Overhead::stopwatch() = sum / (double)n;
+    }
+
+    P phase(std::string("calibration"));
+
+    // start and stop
+    {
+        Overhead::phase<P>() = 0.0;
+        auto const t0 = Clock::now();
+        for(size_t i = 0; i < n; i++) {
+            phase.start();
+            phase.stop();
+        }
+        Overhead::phase<P>() = nanos_since(t0) / (double)n;
+    }
+
+    // allocation event dispatch, relative to the cost of an event while no callback is registered
+    {
+        auto const dispatch_nanos = [&](){
+            auto const t0 = Clock::now();
+            for(size_t i = 0; i < n; i++) {
+                MallocCallback::notify_malloc(16);
+                MallocCallback::notify_free(16);
+            }
+            return nanos_since(t0) / (double)(2 * n);
+        };
+
+        Overhead::hook<P>() = 0.0;
+        auto const base = dispatch_nanos();
+        phase.start();
+        auto const hook = dispatch_nanos();
+        phase.stop();
+        Overhead::hook<P>() = std::max(0.0, hook - base);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,387 @@
+/**
+ * pm/comparison.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_COMPARISON_HPP
+#define _PM_COMPARISON_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <pm/result.hpp>
+#include <pm/statistics.hpp>
+
+namespace pm {
+
+/**
+ * \brief The comparison of a metric between a baseline and a candidate
+ */
+struct MetricComparison {
+    /**
+     * \brief The identity of the compared results, i.e., their identity key-value pairs separated by spaces
+     */
+    std::string group;
+
+    /**
+     * \brief The key of the metric
+     */
+    std::string key;
+
+    /**
+     * \brief Whether larger values of the metric are better
+     */
+    bool higher_is_better;
+
+    /**
+     * \brief The statistics of the metric over the baseline results
+     */
+    Statistics baseline;
+
+    /**
+     * \brief The statistics of the metric over the candidate results
+     */
+    Statistics candidate;
+
+    /**
+     * \brief The relative change of the mean from the baseline to the candidate
+     * 
+     * For example, a value of `0.1` means that the mean of the candidate is 10% larger than that of the baseline.
+     */
+    double change;
+
+    /**
+     * \brief The p-value of \ref welch_t_test "Welch's t-test" on the baseline and candidate, or NaN if there are not enough repetitions
+     */
+    double p_value;
+
+    /**
+     * \brief Whether the change is a regression
+     */
+    bool regression;
+
+    /**
+     * \brief Converts the comparison into a JSON object
+     * 
+     * \return the comparison as a JSON object
+     */
+    inline nlohmann::json to_json() const {
+        nlohmann::json obj;
+        obj["group"] = group;
+        obj["key"] = key;
+        obj["higher_is_better"] = higher_is_better;
+        obj["baseline"] = baseline.to_json();
+        obj["candidate"] = candidate.to_json();
+        obj["change"] = change;
+        obj["p_value"] = std::isnan(p_value) ? nlohmann::json() : nlohmann::json(p_value);
+        obj["regression"] = regression;
+        return obj;
+    }
+};
+
+/**
+ * \brief Compares two sets of results, such as the benchmark results of two nightly runs, for performance regressions
+ * 
+ * Both sets may contain any number of \ref Result objects or phase data, which is flattened into key paths like \ref Result::add_phase_data does,
+ * so phase hierarchies are matched by the names of their phases.
+ * 
+ * The key-value pairs of a result are split into its identity and its metrics.
+ * The identity consists of all pairs with non-numeric values, such as the name of an algorithm, all pairs within the `data` object
+ * of a phase, and all pairs whose keys have been declared identity keys via \ref group_by , such as an input size.
+ * All other numeric pairs are metrics. Results with the same identity are considered repetitions of the same measurement,
+ * and metrics are only compared between the baseline and candidate results with the same identity.
+ * The bookkeeping that \ref benchmark adds to the `data` object, i.e., the numbers of `warmup` runs and `repetitions`,
+ * depends on the time budget rather than the measurement and is therefore ignored.
+ * The identity does not depend on the order of the pairs within a result.
+ * Identities that only occur in one of the sets are reported by \ref unmatched_baseline and \ref unmatched_candidate ,
+ * and metrics that only occur in one of the sets for a matched identity by \ref unmatched_baseline_metrics and \ref unmatched_candidate_metrics .
+ * 
+ * Every metric with numeric values in both sets is compared by the relative change of its mean.
+ * A change is a regression if the mean grows by more than the threshold, assuming that smaller values are better, as for running times or memory,
+ * unless the metric has been declared to be \ref higher_is_better "better when higher", as for throughputs, in which case it must shrink by more than the threshold.
+ * If both sets contain at least two repetitions, the change must also be significant according to \ref welch_t_test "Welch's t-test",
+ * i.e., its p-value must not exceed the significance level.
+ * 
+ * Keys given to \ref group_by and \ref higher_is_better match a key if they are equal to it or to its last dot-separated components,
+ * e.g., `throughput` matches `sort.metrics.io.throughput`.
+ */
+class Comparison {
+private:
+    using Metrics = std::map<std::string, std::vector<double>>;
+
+    double threshold_;
+    double alpha_;
+    std::vector<std::string> identity_keys_;
+    std::vector<std::string> higher_is_better_keys_;
+    std::map<std::string, Metrics> baseline_;
+    std::map<std::string, Metrics> candidate_;
+
+    // the keys that pm::benchmark adds to the data of a phase
+    static constexpr char const* BOOKKEEPING_KEYS[] = { "repetitions", "warmup" };
+
+    inline static bool matches(std::string const& key, std::string const& k) {
+        return key.ends_with(k) && (key.size() == k.size() || key[key.size() - k.size() - 1] == '.');
+    }
+
+    inline static bool matches_any(std::string const& key, std::vector<std::string> const& keys) {
+        for(auto const& k : keys) {
+            if(matches(key, k)) return true;
+        }
+        return false;
+    }
+
+    inline static bool is_phase_data(std::string const& key) {
+        return key.starts_with(JSON_KEY_DATA + std::string(".")) || key.find(std::string(".") + JSON_KEY_DATA + ".") != std::string::npos;
+    }
+
+    inline static bool is_bookkeeping(std::string const& key) {
+        for(auto const* k : BOOKKEEPING_KEYS) {
+            if(matches(key, JSON_KEY_DATA + std::string(".") + k)) return true;
+        }
+        return false;
+    }
+
+    inline static std::vector<std::string> unmatched(std::map<std::string, Metrics> const& groups, std::map<std::string, Metrics> const& others) {
+        std::vector<std::string> v;
+        for(auto const& [group, metrics] : groups) {
+            if(!others.contains(group)) v.push_back(group);
+        }
+        return v;
+    }
+
+    inline static std::vector<std::pair<std::string, std::string>> unmatched_metrics(
+        std::map<std::string, Metrics> const& groups, std::map<std::string, Metrics> const& others) {
+
+        std::vector<std::pair<std::string, std::string>> v;
+        for(auto const& [group, metrics] : groups) {
+            auto const other = others.find(group);
+            if(other == others.end()) continue; // reported as an unmatched identity
+
+            for(auto const& [key, values] : metrics) {
+                if(!other->second.contains(key)) v.emplace_back(group, key);
+            }
+        }
+        return v;
+    }
+
+    inline void add(std::map<std::string, Metrics>& groups, Result const& result) const {
+        std::vector<std::string> identity;
+        std::vector<std::pair<std::string const*, double>> metrics;
+        for(auto const& pair : result.pairs()) {
+            if(is_bookkeeping(pair.key)) continue;
+
+            auto const x = Result::parse_number(pair.value);
+            if(x && !is_phase_data(pair.key) && !matches_any(pair.key, identity_keys_)) {
+                metrics.emplace_back(&pair.key, *x);
+            } else {
+                identity.push_back(pair.key + '=' + pair.value);
+            }
+        }
+
+        // results that report the same pairs in a different order have the same identity
+        std::sort(identity.begin(), identity.end());
+        std::string group;
+        for(auto const& p : identity) {
+            if(!group.empty()) group += ' ';
+            group += p;
+        }
+
+        auto& values = groups[group];
+        for(auto const& [key, x] : metrics) values[*key].push_back(x);
+    }
+
+    inline static Result flatten(nlohmann::json const& data) {
+        Result r;
+        r.add_phase_data(data);
+        return r;
+    }
+
+public:
+    /**
+     * \brief Default threshold for the relative change of a metric
+     */
+    static constexpr double DEFAULT_THRESHOLD = 0.05;
+
+    /**
+     * \brief Default significance level
+     */
+    static constexpr double DEFAULT_ALPHA = 0.05;
+
+    /**
+     * \brief Constructs an empty comparison
+     * 
+     * \param threshold the relative change of a metric above which it is considered a regression
+     * \param alpha the significance level
+     */
+    inline Comparison(double threshold = DEFAULT_THRESHOLD, double alpha = DEFAULT_ALPHA) : threshold_(threshold), alpha_(alpha) {
+    }
+
+    /**
+     * \brief Declares numeric values of the given key part of the identity of a result rather than a metric
+     * 
+     * This must be called before any results are added.
+     * 
+     * \param key the key
+     */
+    inline void group_by(std::string key) { identity_keys_.push_back(std::move(key)); }
+
+    /**
+     * \brief Declares that larger values of the metrics with the given key are better
+     * 
+     * \param key the key
+     */
+    inline void higher_is_better(std::string key) { higher_is_better_keys_.push_back(std::move(key)); }
+
+    /**
+     * \brief Adds a baseline result
+     * 
+     * \param result the result
+     */
+    inline void add_baseline(Result const& result) { add(baseline_, result); }
+
+    /**
+     * \brief Adds the data of a phase as a baseline result
+     * 
+     * \param data the data of a \ref Phase , as returned by \ref Phase::gather_data
+     */
+    inline void add_baseline_phase_data(nlohmann::json const& data) { add(baseline_, flatten(data)); }
+
+    /**
+     * \brief Adds a candidate result
+     * 
+     * \param result the result
+     */
+    inline void add_candidate(Result const& result) { add(candidate_, result); }
+
+    /**
+     * \brief Adds the data of a phase as a candidate result
+     * 
+     * \param data the data of a \ref Phase , as returned by \ref Phase::gather_data
+     */
+    inline void add_candidate_phase_data(nlohmann::json const& data) { add(candidate_, flatten(data)); }
+
+    /**
+     * \brief Compares all metrics that occur in both the baseline and the candidate with the same identity
+     * 
+     * \return the comparisons, ordered by identity and key
+     */
+    inline std::vector<MetricComparison> compare() const {
+        std::vector<MetricComparison> v;
+        for(auto const& [group, baseline] : baseline_) {
+            auto const candidate = candidate_.find(group);
+            if(candidate == candidate_.end()) continue;
+
+            for(auto const& [key, values] : baseline) {
+                auto const it = candidate->second.find(key);
+                if(it == candidate->second.end()) continue;
+
+                MetricComparison c;
+                c.group = group;
+                c.key = key;
+                c.higher_is_better = matches_any(key, higher_is_better_keys_);
+                c.baseline = Statistics::of(values);
+                c.candidate = Statistics::of(it->second);
+                if(c.baseline.mean != 0.0) {
+                    c.change = (c.candidate.mean - c.baseline.mean) / std::abs(c.baseline.mean);
+                } else {
+                    c.change = c.candidate.mean == 0.0 ? 0.0 : std::copysign(INFINITY, c.candidate.mean);
+                }
+                c.p_value = welch_t_test(c.baseline, c.candidate);
+
+                auto const worsening = c.higher_is_better ? -c.change : c.change;
+                c.regression = worsening > threshold_ && (std::isnan(c.p_value) || c.p_value <= alpha_);
+                v.push_back(std::move(c));
+            }
+        }
+        return v;
+    }
+
+    /**
+     * \brief Tests whether any metric regressed
+     * 
+     * \return true if any metric regressed, false otherwise
+     */
+    inline bool regressed() const {
+        for(auto const& c : compare()) {
+            if(c.regression) return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Reports the identities of baseline results for which there are no candidate results with the same identity
+     * 
+     * \return the unmatched identities, ordered
+     */
+    inline std::vector<std::string> unmatched_baseline() const { return unmatched(baseline_, candidate_); }
+
+    /**
+     * \brief Reports the identities of candidate results for which there are no baseline results with the same identity
+     * 
+     * \return the unmatched identities, ordered
+     */
+    inline std::vector<std::string> unmatched_candidate() const { return unmatched(candidate_, baseline_); }
+
+    /**
+     * \brief Reports the metrics of baseline results that the candidate results with the same identity do not have
+     * 
+     * Metrics of identities reported by \ref unmatched_baseline are not included.
+     * 
+     * \return the identities and keys of the unmatched metrics, ordered
+     */
+    inline std::vector<std::pair<std::string, std::string>> unmatched_baseline_metrics() const { return unmatched_metrics(baseline_, candidate_); }
+
+    /**
+     * \brief Reports the metrics of candidate results that the baseline results with the same identity do not have
+     * 
+     * Metrics of identities reported by \ref unmatched_candidate are not included.
+     * 
+     * \return the identities and keys of the unmatched metrics, ordered
+     */
+    inline std::vector<std::pair<std::string, std::string>> unmatched_candidate_metrics() const { return unmatched_metrics(candidate_, baseline_); }
+
+    /**
+     * \brief Reports the relative change above which a metric is considered a regression
+     * 
+     * \return the threshold
+     */
+    double threshold() const { return threshold_; }
+
+    /**
+     * \brief Reports the significance level
+     * 
+     * \return the significance level
+     */
+    double alpha() const { return alpha_; }
+};
+
+}
+
+#endif
@@ -0,0 +1,262 @@
+/**
+ * pm/cpu_time.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_CPU_TIME_HPP
+#define _PM_CPU_TIME_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include <nlohmann/json.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures CPU time using a POSIX CPU-time clock
+ * 
+ * Unlike \ref Stopwatch , which measures wall time, this measures the time that the CPU actually spent executing.
+ * Comparing both reveals how much time was lost to waiting (e.g., for I/O or because of being descheduled),
+ * or, for the process clock, how well a parallel phase scales.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ * 
+ * \tparam clock_id the POSIX clock to query, either `CLOCK_THREAD_CPUTIME_ID` or `CLOCK_PROCESS_CPUTIME_ID`
+ */
+template<clockid_t clock_id>
+class BasicCpuTime {
+private:
+    inline static uintmax_t now() {
+        timespec ts;
+        clock_gettime(clock_id, &ts);
+        return uintmax_t(ts.tv_sec) * 1'000'000'000ULL + uintmax_t(ts.tv_nsec);
+    }
+
+    uintmax_t start_;
+    uintmax_t elapsed_;
+
+public:
+    /**
+     * \brief Constructs a new CPU time meter
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     */
+    inline BasicCpuTime() : start_(0), elapsed_(0) {}
+
+    BasicCpuTime(BasicCpuTime const& other) = delete;
+    BasicCpuTime(BasicCpuTime&& other) = default;
+    BasicCpuTime& operator=(BasicCpuTime const& other) = delete;
+    BasicCpuTime& operator=(BasicCpuTime&& other) = default;
+
+    /**
+     * \brief Starts the time measurement
+     * 
+     * This will reset the elapsed time to zero
+     */
+    inline void start() {
+        elapsed_ = 0;
+        resume();
+    }
+
+    /**
+     * \brief Pauses the time measurement
+     * 
+     */
+    inline void pause() {
+        elapsed_ += now() - start_;
+    }
+
+    /**
+     * \brief Resumes the time measurement
+     * 
+     */
+    inline void resume() {
+        start_ = now();
+    }
+
+    /**
+     * \brief Stops the time measurement
+     * 
+     * This is technically equivalent to pausing the measurement.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief Reports the measured CPU time in nanosecond precision
+     * 
+     * \return the measured CPU time in nanosecond precision
+     */
+    uintmax_t elapsed_time_nanos() const { return elapsed_; }
+
+    /**
+     * \brief Reports the measured CPU time in milliseconds
+     * 
+     * \return the measured CPU time in milliseconds
+     */
+    double elapsed_time_millis() const { return (double)elapsed_ / 1'000'000.0; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return clock_id == CLOCK_THREAD_CPUTIME_ID ? "thread_cpu_time" : "process_cpu_time"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const { return elapsed_time_millis(); }
+};
+
+/**
+ * \brief Measures the CPU time spent by the calling thread
+ */
+using ThreadCpuTime = BasicCpuTime<CLOCK_THREAD_CPUTIME_ID>;
+
+/**
+ * \brief Measures the CPU time spent by all threads of the process
+ */
+using ProcessCpuTime = BasicCpuTime<CLOCK_PROCESS_CPUTIME_ID>;
+
+/**
+ * \brief Counts the voluntary and involuntary context switches of the process
+ * 
+ * The counts are queried using `getrusage`.
+ * Voluntary context switches happen when a thread blocks, e.g., waiting for I/O or a lock,
+ * whereas involuntary context switches happen when the scheduler preempts a thread, e.g., on oversubscribed nodes.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class ContextSwitches {
+private:
+    struct Counts {
+        uintmax_t voluntary;
+        uintmax_t involuntary;
+
+        inline static Counts now() {
+            rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+            return { uintmax_t(ru.ru_nvcsw), uintmax_t(ru.ru_nivcsw) };
+        }
+    };
+
+    Counts start_;
+    Counts elapsed_;
+
+public:
+    /**
+     * \brief Constructs a new context switch meter
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     */
+    inline ContextSwitches() : start_({0, 0}), elapsed_({0, 0}) {}
+
+    ContextSwitches(ContextSwitches const& other) = delete;
+    ContextSwitches(ContextSwitches&& other) = default;
+    ContextSwitches& operator=(ContextSwitches const& other) = delete;
+    ContextSwitches& operator=(ContextSwitches&& other) = default;
+
+    /**
+     * \brief Starts counting
+     * 
+     * This will reset the counts to zero
+     */
+    inline void start() {
+        elapsed_ = {0, 0};
+        resume();
+    }
+
+    /**
+     * \brief Pauses counting
+     * 
+     */
+    inline void pause() {
+        auto const now = Counts::now();
+        elapsed_.voluntary += now.voluntary - start_.voluntary;
+        elapsed_.involuntary += now.involuntary - start_.involuntary;
+    }
+
+    /**
+     * \brief Resumes counting
+     * 
+     */
+    inline void resume() {
+        start_ = Counts::now();
+    }
+
+    /**
+     * \brief Stops counting
+     * 
+     * This is technically equivalent to pausing.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The number of voluntary context switches
+     * 
+     * \return the number of voluntary context switches
+     */
+    uintmax_t voluntary() const { return elapsed_.voluntary; }
+
+    /**
+     * \brief The number of involuntary context switches
+     * 
+     * \return the number of involuntary context switches
+     */
+    uintmax_t involuntary() const { return elapsed_.involuntary; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "context_switches"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["voluntary"] = voluntary();
+        obj["involuntary"] = involuntary();
+        return obj;
+    }
+};
+
+}
+
+#endif
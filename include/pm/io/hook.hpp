@@ -0,0 +1,72 @@
+/**
+ * pm/io/hook.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_IO_HOOK_HPP
+#define _PM_IO_HOOK_HPP
+
+#include <cstdint>
+
+namespace pm::io_hook {
+
+/**
+ * \brief Per-thread totals of the I/O performed through the `read` and `write` overrides
+ */
+struct Totals {
+    /**
+     * \brief The number of `read` and `pread` calls
+     */
+    uintmax_t read_num;
+
+    /**
+     * \brief The total number of bytes returned by `read` and `pread` calls
+     */
+    uintmax_t read_bytes;
+
+    /**
+     * \brief The number of `write` and `pwrite` calls
+     */
+    uintmax_t write_num;
+
+    /**
+     * \brief The total number of bytes accepted by `write` and `pwrite` calls
+     */
+    uintmax_t write_bytes;
+};
+
+#ifdef PM_IO
+/**
+ * \brief Reports the totals of the I/O performed by the current thread since it started
+ * 
+ * \return the current thread's totals
+ */
+Totals thread_totals();
+#else
+inline Totals thread_totals() { return { 0, 0, 0, 0 }; }
+#endif
+
+}
+
+#endif
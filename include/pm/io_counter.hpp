@@ -0,0 +1,342 @@
+/**
+ * pm/io_counter.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_IO_COUNTER_HPP
+#define _PM_IO_COUNTER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sys/resource.h>
+
+#include <nlohmann/json.hpp>
+#include <pm/io/hook.hpp>
+#include <pm/process_memory.hpp>
+
+namespace pm {
+
+/**
+ * \brief I/O statistics of the process as reported by `/proc/self/io`
+ */
+struct ProcessIo {
+    /**
+     * \brief The number of bytes read via system calls, including those served from the page cache (`rchar`)
+     */
+    uintmax_t read_bytes;
+
+    /**
+     * \brief The number of bytes written via system calls, including those not yet written to storage (`wchar`)
+     */
+    uintmax_t write_bytes;
+
+    /**
+     * \brief The number of read system calls (`syscr`)
+     */
+    uintmax_t read_syscalls;
+
+    /**
+     * \brief The number of write system calls (`syscw`)
+     */
+    uintmax_t write_syscalls;
+
+    /**
+     * \brief The number of bytes fetched from the storage layer (`read_bytes`)
+     */
+    uintmax_t storage_read_bytes;
+
+    /**
+     * \brief The number of bytes sent to the storage layer (`write_bytes`)
+     */
+    uintmax_t storage_write_bytes;
+
+    /**
+     * \brief The number of bytes whose writing to storage has been cancelled, e.g., by truncating a file (`cancelled_write_bytes`)
+     */
+    uintmax_t cancelled_write_bytes;
+
+    /**
+     * \brief Reads the current I/O statistics of the process without allocating memory
+     * 
+     * \return the current I/O statistics of the process, or all zeros if `/proc/self/io` is not available
+     */
+    inline static ProcessIo now() {
+        uintmax_t read;
+        return now(read);
+    }
+
+    /**
+     * \brief Reads the current I/O statistics of the process without allocating memory
+     * 
+     * Reading `/proc/self/io` is itself a read system call, which is not contained in the returned statistics,
+     * but in all statistics read afterwards.
+     * 
+     * \param read receives the number of bytes read from `/proc/self/io`, or zero if it is not available
+     * \return the current I/O statistics of the process, or all zeros if `/proc/self/io` is not available
+     */
+    inline static ProcessIo now(uintmax_t& read) {
+        ProcessIo io = { 0, 0, 0, 0, 0, 0, 0 };
+        read = 0;
+
+        #ifdef __linux__
+        char buf[512];
+        read = proc::read_file("/proc/self/io", buf);
+        if(!read) return io;
+
+        auto const field = [&](char const* name){
+            char const* p = std::strstr(buf, name);
+            if(!p) return uintmax_t(0);
+            p += std::strlen(name);
+            return proc::parse_uint(p);
+        };
+
+        io.read_bytes = field("rchar:");
+        io.write_bytes = field("wchar:");
+        io.read_syscalls = field("syscr:");
+        io.write_syscalls = field("syscw:");
+        io.storage_read_bytes = field("\nread_bytes:");
+        io.storage_write_bytes = field("\nwrite_bytes:");
+        io.cancelled_write_bytes = field("cancelled_write_bytes:");
+        #endif
+
+        return io;
+    }
+};
+
+/**
+ * \brief Measures the I/O performed during a phase
+ * 
+ * The process's I/O statistics are read from `/proc/self/io` (see \ref ProcessIo ), and the numbers of blocks read from and written to
+ * the file system are read via `getrusage`.
+ * All of these figures are process-wide, i.e., they include the activity of other threads.
+ * The meter's own read of `/proc/self/io` is subtracted from the numbers of bytes read and read system calls,
+ * but reads of procfs by other meters during the measurement, e.g., by \ref ProcessMemory , are included.
+ * Alongside, the throughput of reads and writes is reported in bytes per second of wall time during which the measurement was running.
+ * 
+ * If the `read` and `write` overrides are enabled (by linking `pm-io`), the numbers of calls and bytes read and written by the measuring thread
+ * via `read`, `pread`, `write` and `pwrite` are reported in addition.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class IoCounter {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot {
+        ProcessIo io;
+        uintmax_t io_read; // the number of bytes read from /proc/self/io to take this snapshot
+        uintmax_t block_in;
+        uintmax_t block_out;
+        io_hook::Totals thread;
+        Clock::time_point time;
+
+        inline static Snapshot now() {
+            Snapshot s;
+            s.io = ProcessIo::now(s.io_read);
+
+            rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+            s.block_in = uintmax_t(ru.ru_inblock);
+            s.block_out = uintmax_t(ru.ru_oublock);
+            s.thread = io_hook::thread_totals();
+            s.time = Clock::now();
+            return s;
+        }
+    };
+
+    Snapshot start_;
+    ProcessIo io_;
+    uintmax_t block_in_;
+    uintmax_t block_out_;
+    io_hook::Totals thread_;
+    Clock::duration elapsed_;
+
+    inline double per_second(uintmax_t bytes) const {
+        double const secs = std::chrono::duration<double>(elapsed_).count();
+        return secs > 0.0 ? (double)bytes / secs : 0.0;
+    }
+
+public:
+    /**
+     * \brief Constructs a new I/O counter
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     */
+    inline IoCounter()
+        : start_({}),
+          io_({ 0, 0, 0, 0, 0, 0, 0 }),
+          block_in_(0),
+          block_out_(0),
+          thread_({ 0, 0, 0, 0 }),
+          elapsed_(0) {
+    }
+
+    IoCounter(IoCounter const& other) = delete;
+    IoCounter(IoCounter&& other) = default;
+    IoCounter& operator=(IoCounter const& other) = delete;
+    IoCounter& operator=(IoCounter&& other) = default;
+
+    /**
+     * \brief Starts the measurement
+     * 
+     * This will reset all figures to zero.
+     */
+    inline void start() {
+        io_ = { 0, 0, 0, 0, 0, 0, 0 };
+        block_in_ = 0;
+        block_out_ = 0;
+        thread_ = { 0, 0, 0, 0 };
+        elapsed_ = Clock::duration(0);
+        resume();
+    }
+
+    /**
+     * \brief Pauses the measurement
+     */
+    inline void pause() {
+        auto const now = Snapshot::now();
+
+        // the read of the starting snapshot is contained in the current statistics, but not in the starting ones
+        auto const minus = [](uintmax_t delta, uintmax_t x){ return delta >= x ? delta - x : 0; };
+        io_.read_bytes += minus(now.io.read_bytes - start_.io.read_bytes, start_.io_read);
+        io_.write_bytes += now.io.write_bytes - start_.io.write_bytes;
+        io_.read_syscalls += minus(now.io.read_syscalls - start_.io.read_syscalls, start_.io_read ? 1 : 0);
+        io_.write_syscalls += now.io.write_syscalls - start_.io.write_syscalls;
+        io_.storage_read_bytes += now.io.storage_read_bytes - start_.io.storage_read_bytes;
+        io_.storage_write_bytes += now.io.storage_write_bytes - start_.io.storage_write_bytes;
+        io_.cancelled_write_bytes += now.io.cancelled_write_bytes - start_.io.cancelled_write_bytes;
+        block_in_ += now.block_in - start_.block_in;
+        block_out_ += now.block_out - start_.block_out;
+        thread_.read_num += now.thread.read_num - start_.thread.read_num;
+        thread_.read_bytes += now.thread.read_bytes - start_.thread.read_bytes;
+        thread_.write_num += now.thread.write_num - start_.thread.write_num;
+        thread_.write_bytes += now.thread.write_bytes - start_.thread.write_bytes;
+        elapsed_ += now.time - start_.time;
+    }
+
+    /**
+     * \brief Resumes the measurement
+     */
+    inline void resume() {
+        start_ = Snapshot::now();
+    }
+
+    /**
+     * \brief Stops the measurement
+     * 
+     * This is technically equivalent to pausing.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The process's I/O during the measurement
+     * 
+     * \return the process's I/O during the measurement
+     */
+    ProcessIo const& io() const { return io_; }
+
+    /**
+     * \brief The number of blocks read from the file system during the measurement
+     * 
+     * \return the number of blocks read from the file system
+     */
+    uintmax_t block_in() const { return block_in_; }
+
+    /**
+     * \brief The number of blocks written to the file system during the measurement
+     * 
+     * \return the number of blocks written to the file system
+     */
+    uintmax_t block_out() const { return block_out_; }
+
+    /**
+     * \brief The measuring thread's I/O during the measurement
+     * 
+     * These are zero unless the `read` and `write` overrides are enabled.
+     * 
+     * \return the measuring thread's I/O during the measurement
+     */
+    io_hook::Totals const& thread() const { return thread_; }
+
+    /**
+     * \brief The number of bytes read per second during the measurement
+     * 
+     * \return the number of bytes read per second
+     */
+    double read_throughput() const { return per_second(io_.read_bytes); }
+
+    /**
+     * \brief The number of bytes written per second during the measurement
+     * 
+     * \return the number of bytes written per second
+     */
+    double write_throughput() const { return per_second(io_.write_bytes); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "io"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The `thread` figures are only reported if the `read` and `write` overrides are enabled.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["read_bytes"] = io_.read_bytes;
+        obj["write_bytes"] = io_.write_bytes;
+        obj["read_syscalls"] = io_.read_syscalls;
+        obj["write_syscalls"] = io_.write_syscalls;
+        obj["storage_read_bytes"] = io_.storage_read_bytes;
+        obj["storage_write_bytes"] = io_.storage_write_bytes;
+        obj["cancelled_write_bytes"] = io_.cancelled_write_bytes;
+        obj["block_in"] = block_in_;
+        obj["block_out"] = block_out_;
+        obj["read_throughput"] = read_throughput();
+        obj["write_throughput"] = write_throughput();
+        #ifdef PM_IO
+        nlohmann::json thread;
+        thread["read_num"] = thread_.read_num;
+        thread["read_bytes"] = thread_.read_bytes;
+        thread["write_num"] = thread_.write_num;
+        thread["write_bytes"] = thread_.write_bytes;
+        obj["thread"] = std::move(thread);
+        #endif
+        return obj;
+    }
+};
+
+}
+
+#endif
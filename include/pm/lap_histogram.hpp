@@ -0,0 +1,263 @@
+/**
+ * pm/lap_histogram.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_LAP_HISTOGRAM_HPP
+#define _PM_LAP_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <pm/log_buckets.hpp>
+#include <pm/tsc_clock.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures the latency distribution of many short laps
+ * 
+ * Every interval from \ref start to \ref stop is a lap, whose duration is recorded in a histogram of logarithmic \ref LogBuckets "buckets"
+ * with \ref SUB_BITS sub-bucket bits, which bounds the relative error of reported percentiles by \f$2^{-\mathit{SUB\_BITS}}\f$.
+ * Paused time does not count towards the current lap.
+ * The histogram has a fixed size and is allocated once on construction, so recording a lap never allocates memory.
+ * A moved-from lap histogram has no histogram left and records nothing.
+ * Laps are timed using \ref TscClock .
+ * 
+ * Note that unlike for other meters, \ref start does \em not reset previous measurements, because every start begins a new lap.
+ * Use \ref reset to clear the histogram.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class LapHistogram {
+public:
+    /**
+     * \brief The number of sub-bucket bits
+     */
+    static constexpr unsigned SUB_BITS = 5;
+
+    /**
+     * \brief The bucket mapping
+     */
+    using Buckets = LogBuckets<SUB_BITS>;
+
+private:
+    using Histogram = std::array<uint64_t, Buckets::NUM_BUCKETS>;
+
+    std::unique_ptr<Histogram> buckets_;
+    std::vector<double> percentiles_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+    uint64_t start_;
+    uint64_t elapsed_;
+
+    inline static std::string percentile_name(double p) {
+        // e.g., 99 becomes p99 and 99.9 becomes p99_9
+        if(p == std::floor(p)) return "p" + std::to_string((uint64_t)p);
+
+        std::string s = nlohmann::json(p).dump();
+        std::replace(s.begin(), s.end(), '.', '_');
+        return "p" + s;
+    }
+
+public:
+    /**
+     * \brief Constructs an empty lap histogram
+     * 
+     * \param percentiles the percentiles to report, each in the range \f$[0, 100]\f$
+     */
+    inline LapHistogram(std::vector<double> percentiles = { 50.0, 90.0, 99.0, 99.9 })
+        : buckets_(std::make_unique<Histogram>()),
+          percentiles_(std::move(percentiles)),
+          start_(0),
+          elapsed_(0) {
+        reset();
+    }
+
+    LapHistogram(LapHistogram const& other) = delete;
+    LapHistogram& operator=(LapHistogram const& other) = delete;
+
+    inline LapHistogram(LapHistogram&& other) : start_(0), elapsed_(0) {
+        *this = std::move(other);
+    }
+
+    inline LapHistogram& operator=(LapHistogram&& other) {
+        buckets_ = std::move(other.buckets_);
+        percentiles_ = std::move(other.percentiles_);
+        count_ = other.count_;
+        sum_ = other.sum_;
+        min_ = other.min_;
+        max_ = other.max_;
+        start_ = other.start_;
+        elapsed_ = other.elapsed_;
+
+        // the moved-from histogram has no buckets left, so it must not count any laps
+        other.reset();
+        return *this;
+    }
+
+    /**
+     * \brief Clears the histogram
+     */
+    inline void reset() {
+        if(buckets_) buckets_->fill(0);
+        count_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    /**
+     * \brief Begins a new lap
+     */
+    inline void start() {
+        elapsed_ = 0;
+        resume();
+    }
+
+    /**
+     * \brief Pauses the current lap
+     */
+    inline void pause() {
+        elapsed_ += TscClock::stop_ticks() - start_;
+    }
+
+    /**
+     * \brief Resumes the current lap
+     */
+    inline void resume() {
+        start_ = TscClock::start_ticks();
+    }
+
+    /**
+     * \brief Ends the current lap and records its duration
+     */
+    inline void stop() {
+        pause();
+        record(elapsed_);
+    }
+
+    /**
+     * \brief Records a lap of the given duration
+     * 
+     * \param ticks the duration of the lap in \ref TscClock ticks
+     */
+    inline void record(uint64_t ticks) {
+        if(!buckets_) return;
+
+        ++(*buckets_)[Buckets::index(ticks)];
+        ++count_;
+        sum_ += ticks;
+        min_ = std::min(min_, ticks);
+        max_ = std::max(max_, ticks);
+    }
+
+    /**
+     * \brief The number of recorded laps
+     * 
+     * \return the number of recorded laps
+     */
+    uint64_t count() const { return count_; }
+
+    /**
+     * \brief The duration of the shortest lap in nanoseconds
+     * 
+     * \return the duration of the shortest lap in nanoseconds
+     */
+    double min_nanos() const { return count_ ? TscClock::to_nanos(min_) : 0.0; }
+
+    /**
+     * \brief The duration of the longest lap in nanoseconds
+     * 
+     * \return the duration of the longest lap in nanoseconds
+     */
+    double max_nanos() const { return TscClock::to_nanos(max_); }
+
+    /**
+     * \brief The mean lap duration in nanoseconds
+     * 
+     * \return the mean lap duration in nanoseconds
+     */
+    double mean_nanos() const { return count_ ? TscClock::to_nanos(sum_) / (double)count_ : 0.0; }
+
+    /**
+     * \brief Computes the given percentile of lap durations in nanoseconds
+     * 
+     * The result is the largest duration within the bucket that contains the percentile, but no larger than the longest lap.
+     * 
+     * \param p the percentile in the range \f$[0, 100]\f$
+     * \return the duration in nanoseconds
+     */
+    double percentile_nanos(double p) const {
+        if(count_ == 0) return 0.0;
+
+        auto const rank = std::max(uint64_t(1), (uint64_t)std::ceil(p / 100.0 * (double)count_));
+        uint64_t cumulative = 0;
+        for(size_t i = 0; i < Buckets::NUM_BUCKETS; i++) {
+            cumulative += (*buckets_)[i];
+            if(cumulative >= rank) return TscClock::to_nanos(std::clamp(Buckets::upper(i), min_, max_));
+        }
+        return max_nanos();
+    }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "laps"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * Besides the `count`, all durations are reported in nanoseconds.
+     * Percentiles are named by their value with an underscore as the decimal separator, e.g., `p99_9` for the 99.9th percentile.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["count"] = count_;
+        obj["min"] = min_nanos();
+        obj["max"] = max_nanos();
+        obj["mean"] = mean_nanos();
+        for(auto const p : percentiles_) {
+            obj[percentile_name(p)] = percentile_nanos(p);
+        }
+        return obj;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,418 @@
+/**
+ * pm/leak_tracker.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_LEAK_TRACKER_HPP
+#define _PM_LEAK_TRACKER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define PM_HAS_BACKTRACE
+#endif
+
+#include <nlohmann/json.hpp>
+#include <pm/malloc_callback.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief Tracks the individual blocks allocated during a measurement and reports those that survive it
+ * 
+ * The address and size of every allocated block are recorded in a fixed-size, lock-free open-addressing table,
+ * from which they are removed again when the block is freed.
+ * When the measurement is stopped, the blocks remaining in the table are the ones that were allocated, but not freed during the measurement.
+ * They are reported grouped by size, so intended caches can be told apart from leaks.
+ * Frees of blocks that were allocated before the measurement are ignored.
+ * 
+ * Optionally, the call stacks of a sample of the blocks are recorded and the surviving ones are aggregated per call site.
+ * Blocks are sampled based on their address, so no state is shared between allocating threads for that purpose.
+ * The call stacks are captured using `backtrace` and reported as strings obtained from `backtrace_symbols`.
+ * 
+ * The table is allocated on construction, so no allocations are necessary during the measurement,
+ * and the tracker can be used with multiple allocating threads.
+ * If the table is full, or the probe sequence of a block is too long, the block is not tracked and counted as dropped.
+ * While the tracker is paused, frees are not seen, so blocks freed during a pause are reported as surviving.
+ * 
+ * As an implementation of \ref MallocCallback , it receives memory allocation and free callbacks if tudocomp's `malloc` overrides are enabled.
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class LeakTracker : public MallocCallback {
+public:
+    /**
+     * \brief The default maximum number of simultaneously tracked blocks
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    /**
+     * \brief The default number of block sizes and call stacks reported by \ref gather_metrics
+     */
+    static constexpr size_t DEFAULT_TOP = 10;
+
+    /**
+     * \brief The maximum number of table slots probed for a block
+     */
+    static constexpr size_t MAX_PROBES = 64;
+
+    /**
+     * \brief The maximum number of recorded stack frames per sampled block
+     */
+    static constexpr size_t MAX_FRAMES = 16;
+
+    /**
+     * \brief The maximum number of call stacks recorded during a measurement
+     */
+    static constexpr size_t MAX_STACKS = 1024;
+
+private:
+    static constexpr uintptr_t EMPTY = 0;
+    static constexpr uintptr_t TOMBSTONE = 1;
+
+    struct Entry {
+        std::atomic<uintptr_t> block;
+        size_t size;
+        uint32_t stack; // one plus the index of the recorded stack, zero if none
+    };
+
+    struct Stack {
+        size_t depth;
+        void* frames[MAX_FRAMES];
+    };
+
+    bool active_;
+    size_t capacity_;
+    size_t top_;
+    size_t sample_interval_;
+    unsigned shift_;
+
+    std::unique_ptr<Entry[]> table_;
+    std::unique_ptr<Stack[]> stacks_;
+    std::atomic<uint32_t> num_stacks_;
+    std::atomic<uintmax_t> dropped_;
+
+    inline uint64_t hash(uintptr_t block) const {
+        return ((uint64_t)block >> 4) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    __attribute__((noinline)) uint32_t record_stack() {
+        #ifdef PM_HAS_BACKTRACE
+        // nb: the count must not grow past the number of stacks, so it is only incremented while there is room
+        auto i = num_stacks_.load(std::memory_order_relaxed);
+        do {
+            if(i >= MAX_STACKS) return 0;
+        } while(!num_stacks_.compare_exchange_weak(i, i + 1, std::memory_order_relaxed));
+
+        // nb: the first frame is this function, which is skipped
+        void* buffer[MAX_FRAMES + 1];
+        auto& stack = stacks_[i];
+        stack.depth = std::max(backtrace(buffer, MAX_FRAMES + 1) - 1, 0);
+        std::copy(buffer + 1, buffer + 1 + stack.depth, stack.frames);
+        return i + 1;
+        #else
+        return 0;
+        #endif
+    }
+
+    inline void reset() {
+        for(size_t i = 0; i < capacity_; i++) table_[i].block.store(EMPTY, std::memory_order_relaxed);
+        num_stacks_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        auto const block = (uintptr_t)event_block();
+        if(!block) return;
+
+        auto const h = hash(block);
+        size_t const mask = capacity_ - 1;
+        size_t const probes = std::min(capacity_, MAX_PROBES);
+        for(size_t i = 0; i < probes; i++) {
+            auto& e = table_[((h >> shift_) + i) & mask];
+            auto expected = e.block.load(std::memory_order_relaxed);
+            if((expected == EMPTY || expected == TOMBSTONE) && e.block.compare_exchange_strong(expected, block, std::memory_order_relaxed)) {
+                // nb: the block cannot be freed before this returns, so nobody reads the entry concurrently
+                e.size = bytes;
+                e.stack = (sample_interval_ && ((h >> 16) % sample_interval_) == 0) ? record_stack() : 0;
+                return;
+            }
+        }
+
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void on_free(size_t) override {
+        auto const block = (uintptr_t)event_block();
+        if(!block) return;
+
+        auto const h = hash(block);
+        size_t const mask = capacity_ - 1;
+        size_t const probes = std::min(capacity_, MAX_PROBES);
+        for(size_t i = 0; i < probes; i++) {
+            auto& e = table_[((h >> shift_) + i) & mask];
+            auto expected = e.block.load(std::memory_order_relaxed);
+            if(expected == EMPTY) return; // not allocated during the measurement
+            if(expected == block && e.block.compare_exchange_strong(expected, TOMBSTONE, std::memory_order_relaxed)) return;
+        }
+    }
+
+public:
+    /**
+     * \brief Constructs a leak tracker
+     * 
+     * The table of blocks is allocated here, so no allocations are necessary during the measurement.
+     * 
+     * \param capacity the maximum number of simultaneously tracked blocks (will be rounded up to a power of two)
+     * \param top the number of block sizes and call stacks reported by \ref gather_metrics
+     * \param sample_interval if non-zero, the call stacks of approximately every `sample_interval`-th block are recorded
+     */
+    inline LeakTracker(size_t capacity = DEFAULT_CAPACITY, size_t top = DEFAULT_TOP, size_t sample_interval = 0)
+        : MallocCallback(),
+          active_(false),
+          capacity_(std::bit_ceil(std::max(capacity, size_t(2)))),
+          top_(top),
+          sample_interval_(sample_interval),
+          shift_(64 - std::countr_zero(capacity_)) {
+
+        UntrackedScope untracked;
+        table_ = std::make_unique<Entry[]>(capacity_);
+        if(sample_interval_) {
+            stacks_ = std::make_unique<Stack[]>(MAX_STACKS);
+
+            #ifdef PM_HAS_BACKTRACE
+            // the first call to backtrace may allocate memory, so make sure it happens outside of the measurement
+            void* frames[1];
+            backtrace(frames, 1);
+            #endif
+        }
+
+        reset();
+    }
+
+    inline ~LeakTracker() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    LeakTracker(LeakTracker const& other) = delete;
+    LeakTracker& operator=(LeakTracker const& other) = delete;
+
+    inline LeakTracker(LeakTracker&& other) : LeakTracker(0, 0, 0) {
+        *this = std::move(other);
+    }
+
+    inline LeakTracker& operator=(LeakTracker&& other) {
+        bool const active = other.active_;
+        other.pause();
+
+        capacity_ = other.capacity_;
+        top_ = other.top_;
+        sample_interval_ = other.sample_interval_;
+        shift_ = other.shift_;
+        table_ = std::move(other.table_);
+        stacks_ = std::move(other.stacks_);
+        num_stacks_.store(other.num_stacks_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dropped_.store(other.dropped_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        // the moved-from tracker has no table left, so it must not probe one
+        other.capacity_ = 0;
+        other.top_ = 0;
+        other.sample_interval_ = 0;
+        other.shift_ = 0;
+        other.num_stacks_.store(0, std::memory_order_relaxed);
+        other.dropped_.store(0, std::memory_order_relaxed);
+
+        if(active) resume();
+        return *this;
+    }
+
+    /**
+     * \brief Starts tracking blocks
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses tracking blocks
+     */
+    inline void pause() {
+        if(active_) {
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes tracking blocks
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+        }
+    }
+
+    /**
+     * \brief Ends tracking blocks
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The number of tracked blocks that have not been freed
+     * 
+     * This should only be called while the tracker is not active.
+     * 
+     * \return the number of surviving blocks
+     */
+    size_t num_blocks() const {
+        size_t num = 0;
+        for(size_t i = 0; i < capacity_; i++) {
+            if(table_[i].block.load(std::memory_order_relaxed) > TOMBSTONE) ++num;
+        }
+        return num;
+    }
+
+    /**
+     * \brief The total size of the tracked blocks that have not been freed
+     * 
+     * This should only be called while the tracker is not active.
+     * 
+     * \return the number of bytes in surviving blocks
+     */
+    uintmax_t num_bytes() const {
+        uintmax_t bytes = 0;
+        for(size_t i = 0; i < capacity_; i++) {
+            if(table_[i].block.load(std::memory_order_relaxed) > TOMBSTONE) bytes += table_[i].size;
+        }
+        return bytes;
+    }
+
+    /**
+     * \brief The number of blocks that could not be tracked because the table was full
+     * 
+     * \return the number of dropped blocks
+     */
+    uintmax_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "leaks"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The surviving blocks are grouped by size, and the sizes with the most surviving bytes are reported in descending order.
+     * If call stacks are recorded, the same is done for the call stacks of the sampled surviving blocks.
+     * This should only be called while the tracker is not active.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        struct Group {
+            uintmax_t count = 0;
+            uintmax_t bytes = 0;
+        };
+
+        std::unordered_map<size_t, Group> sizes;
+        std::map<std::vector<void*>, Group> stacks;
+        Group total;
+        for(size_t i = 0; i < capacity_; i++) {
+            auto const& e = table_[i];
+            if(e.block.load(std::memory_order_relaxed) > TOMBSTONE) {
+                auto& g = sizes[e.size];
+                ++g.count;
+                g.bytes += e.size;
+                ++total.count;
+                total.bytes += e.size;
+
+                if(e.stack) {
+                    auto const& stack = stacks_[e.stack - 1];
+                    auto& s = stacks[std::vector<void*>(stack.frames, stack.frames + stack.depth)];
+                    ++s.count;
+                    s.bytes += e.size;
+                }
+            }
+        }
+
+        // reports the groups with the most bytes in descending order
+        auto top = [&](auto const& groups, auto&& to_json){
+            std::vector<std::pair<typename std::decay_t<decltype(groups)>::key_type, Group>> sorted(groups.begin(), groups.end());
+            size_t const num = std::min(top_, sorted.size());
+            std::partial_sort(sorted.begin(), sorted.begin() + num, sorted.end(), [](auto const& a, auto const& b){ return a.second.bytes > b.second.bytes; });
+
+            auto arr = nlohmann::json::array();
+            for(size_t i = 0; i < num; i++) {
+                nlohmann::json obj;
+                to_json(obj, sorted[i].first);
+                obj["count"] = sorted[i].second.count;
+                obj["bytes"] = sorted[i].second.bytes;
+                arr.push_back(std::move(obj));
+            }
+            return arr;
+        };
+
+        nlohmann::json obj;
+        obj["blocks"] = total.count;
+        obj["bytes"] = total.bytes;
+        obj["dropped"] = dropped();
+        obj["sizes"] = top(sizes, [](nlohmann::json& obj, size_t size){ obj["size"] = size; });
+
+        if(sample_interval_) {
+            obj["stacks"] = top(stacks, [](nlohmann::json& obj, std::vector<void*> const& stack){
+                auto frames = nlohmann::json::array();
+                #ifdef PM_HAS_BACKTRACE
+                if(char** symbols = backtrace_symbols(stack.data(), (int)stack.size())) {
+                    for(size_t j = 0; j < stack.size(); j++) frames.push_back(symbols[j]);
+                    free(symbols);
+                }
+                #endif
+                obj["stack"] = std::move(frames);
+            });
+        }
+
+        return obj;
+    }
+};
+
+}
+
+#endif
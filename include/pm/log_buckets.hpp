@@ -0,0 +1,100 @@
+/**
+ * pm/log_buckets.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_LOG_BUCKETS_HPP
+#define _PM_LOG_BUCKETS_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace pm {
+
+/**
+ * \brief Maps unsigned 64-bit integers to logarithmic histogram buckets with linear sub-buckets
+ * 
+ * Every range \f$[2^k, 2^{k+1})\f$ is divided into \f$2^b\f$ sub-buckets of equal width, where \f$b\f$ is the number of sub-bucket bits.
+ * Values smaller than \f$2^b\f$ have a bucket of their own.
+ * Thus, the relative width of any bucket is at most \f$2^{-b}\f$.
+ * With zero sub-bucket bits, the buckets are simply the powers of two.
+ * 
+ * \tparam sub_bits the number of sub-bucket bits
+ */
+template<unsigned sub_bits>
+struct LogBuckets {
+    static_assert(sub_bits < 64);
+
+    /**
+     * \brief The number of sub-buckets per power of two
+     */
+    static constexpr size_t SUB_BUCKETS = size_t(1) << sub_bits;
+
+    /**
+     * \brief The total number of buckets needed to cover all 64-bit integers
+     */
+    static constexpr size_t NUM_BUCKETS = (65 - sub_bits) * SUB_BUCKETS;
+
+    /**
+     * \brief Computes the bucket of the given value
+     * 
+     * \param value the value
+     * \return the index of the value's bucket
+     */
+    static constexpr size_t index(uint64_t value) {
+        if(value < SUB_BUCKETS) return value;
+
+        unsigned const shift = std::bit_width(value) - 1 - sub_bits;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    /**
+     * \brief Computes the smallest value contained in the given bucket
+     * 
+     * \param i the index of the bucket
+     * \return the smallest value contained in the bucket
+     */
+    static constexpr uint64_t lower(size_t i) {
+        if(i < SUB_BUCKETS) return i;
+
+        size_t const shift = i / SUB_BUCKETS - 1;
+        return uint64_t(SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+    }
+
+    /**
+     * \brief Computes the largest value contained in the given bucket
+     * 
+     * \param i the index of the bucket
+     * \return the largest value contained in the bucket
+     */
+    static constexpr uint64_t upper(size_t i) {
+        return (i + 1 < NUM_BUCKETS) ? lower(i + 1) - 1 : UINT64_MAX;
+    }
+};
+
+}
+
+#endif
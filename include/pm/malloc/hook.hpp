@@ -29,22 +29,49 @@
 #define _PM_MALLOC_HOOK_HPP
 
 #include <cstddef>
+#include <cstdint>
 
 namespace pm::malloc_hook {
 
 /**
  * \brief Called by the `malloc` overrides when memory is allocated
  * 
+ * \param ptr the allocated block, as returned to the application
  * \param bytes the number of allocated bytes
+ * \param tag the allocation tag of the block
  */
-void on_malloc(size_t bytes);
+void on_malloc(void const* ptr, size_t bytes, uint8_t tag);
 
 /**
  * \brief Called by `malloc` overrides when memory is freed
  * 
+ * \param ptr the freed block, as passed by the application
  * \param bytes the number of freed bytes
+ * \param tag the allocation tag of the block
  */
-void on_free(size_t bytes);
+void on_free(void const* ptr, size_t bytes, uint8_t tag);
+
+/**
+ * \brief Sets whether blocks allocated by the current thread are untracked
+ * 
+ * Neither the allocation nor the eventual free of an untracked block are reported, regardless of which thread frees it.
+ * This requires the block header, i.e., it has no effect if pm was built with `PM_MALLOC_USABLE_SIZE`.
+ * 
+ * \param untracked whether blocks allocated by the current thread from now on are untracked
+ * \return whether blocks allocated by the current thread were untracked before the call
+ */
+bool set_untracked(bool untracked);
+
+/**
+ * \brief Sets the allocation tag of blocks allocated by the current thread
+ * 
+ * The tag is stored in the block header and reported again when the block is freed, regardless of which thread frees it.
+ * This requires the block header, i.e., all blocks are untagged if pm was built with `PM_MALLOC_USABLE_SIZE`.
+ * 
+ * \param tag the allocation tag of blocks allocated by the current thread from now on, zero meaning untagged
+ * \return the previous allocation tag of the current thread
+ */
+uint8_t set_tag(uint8_t tag);
 
 }
 
@@ -0,0 +1,73 @@
+/**
+ * pm/malloc/mmap_hook.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_MALLOC_MMAP_HOOK_HPP
+#define _PM_MALLOC_MMAP_HOOK_HPP
+
+#include <cstdint>
+
+namespace pm::mmap_hook {
+
+/**
+ * \brief Process-wide totals of memory mapped and unmapped through the `mmap` overrides
+ */
+struct Totals {
+    /**
+     * \brief The number of `mmap` calls (and growing `mremap` calls)
+     */
+    uintmax_t map_num;
+
+    /**
+     * \brief The total number of mapped bytes
+     */
+    uintmax_t map_bytes;
+
+    /**
+     * \brief The number of `munmap` calls (and shrinking `mremap` calls)
+     */
+    uintmax_t unmap_num;
+
+    /**
+     * \brief The total number of unmapped bytes
+     */
+    uintmax_t unmap_bytes;
+};
+
+#ifdef PM_MALLOC_MMAP
+/**
+ * \brief Reports the totals of memory mapped and unmapped since the program started
+ * 
+ * \return the current totals
+ */
+Totals totals();
+#else
+inline Totals totals() { return { 0, 0, 0, 0 }; }
+#endif
+
+}
+
+#endif
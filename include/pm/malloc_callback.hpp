@@ -28,8 +28,8 @@
 #ifndef _PM_MALLOC_CALLBACK_HPP
 #define _PM_MALLOC_CALLBACK_HPP
 
-#include <algorithm>
-#include <vector>
+#include <cstddef>
+#include <cstdint>
 
 namespace pm {
 
@@ -39,44 +39,54 @@ namespace pm {
  * Instances will receive callbacks for memory allocations (via \ref on_alloc ) and frees (via \ref on_free ) as long as they are registered.
  * Registration is done by calling \ref register_callback from the implementing class and has to be done manually.
  * Upon destruction, \ref unregister_callback is called automatically.
- * The registration process is \em not thread-safe.
+ * Because that happens only after the implementing class has been destroyed, implementing classes whose instances may be
+ * destroyed while other threads allocate memory should call \ref unregister_callback in their own destructor.
+ * 
+ * Registration is thread-safe and never causes any allocation events to be lost.
+ * The registry is an immutable snapshot that is atomically replaced whenever a callback is registered or unregistered,
+ * so the notifiers only need to load the current snapshot and loop over it, and return right away while no callback is registered.
+ * Unregistering waits until no thread is still dispatching to the previous snapshot, so a callback will not be called
+ * anymore once \ref unregister_callback returns. Dispatches that begin after the replacement do not prolong that wait.
+ * Allocations made from within a callback are not reported to avoid infinite recursion,
+ * and neither are allocations made while the \ref MeasurementSwitch "measurement switch" is disabled for the current thread.
  * 
  * The static notifiers, \ref notify_malloc and \ref notify_free , are hooked into tudocomp's `malloc` overrides.
  * Therefore, automatic memory allocation tracking only functions if said overrides are enabled.
  */
 class MallocCallback {
+public:
+    /**
+     * \brief The maximum number of simultaneously registered callbacks
+     */
+    static constexpr size_t MAX_CALLBACKS = 4096;
+
 private:
     #ifdef PM_MALLOC
     static void* install_;
-    static std::vector<MallocCallback*> registry_;
-    static bool critical_;
     #endif
 
     bool registered_;
 
 protected:
-    inline void register_callback() {
-        #ifdef PM_MALLOC
-        if(!registered_) {
-            critical_ = true;
-            registry_.push_back(this);
-            registered_ = true;
-            critical_ = false;
-        }
-        #endif
-    }
+    #ifdef PM_MALLOC
+    /**
+     * \brief Registers this callback so it receives allocation and free events
+     * 
+     * This has no effect if the callback is already registered.
+     * If \ref MAX_CALLBACKS callbacks are already registered, a `std::length_error` is thrown.
+     */
+    void register_callback();
 
-    inline void unregister_callback() {
-        #ifdef PM_MALLOC
-        critical_ = true;
-        auto it = std::find(registry_.begin(), registry_.end(), this);
-        if(it != registry_.end()) {
-            registry_.erase(it);
-        }
-        registered_ = false;
-        critical_ = false;
-        #endif
-    }
+    /**
+     * \brief Unregisters this callback so it no longer receives allocation and free events
+     * 
+     * This has no effect if the callback is not registered.
+     */
+    void unregister_callback();
+    #else
+    inline void register_callback() {}
+    inline void unregister_callback() {}
+    #endif
 
     /**
      * \brief Called when a memory allocation is tracked
@@ -92,30 +102,70 @@ protected:
      */
     virtual void on_free(size_t bytes) = 0;
 
+    #ifdef PM_MALLOC
+    /**
+     * \brief The \ref AllocationTag "allocation tag" of the block whose allocation or free is currently being reported
+     * 
+     * This is only meaningful from within \ref on_alloc and \ref on_free .
+     * 
+     * \return the allocation tag's ID, zero meaning untagged
+     */
+    static uint8_t event_tag();
+
+    /**
+     * \brief The block whose allocation or free is currently being reported
+     * 
+     * This is only meaningful from within \ref on_alloc and \ref on_free .
+     * 
+     * \return the pointer to the block as seen by the application, or `nullptr` if the event was not reported by the `malloc` overrides
+     */
+    static void const* event_block();
+    #else
+    inline static uint8_t event_tag() { return 0; }
+    inline static void const* event_block() { return nullptr; }
+    #endif
+
 public:
+    #ifdef PM_MALLOC
     /**
      * \brief Tracks a memory allocation
      * 
      * \param bytes the number of allocated bytes
+     * \param tag the allocation tag's ID of the allocated block
+     * \param block the allocated block, if known
      */
-    inline static void notify_malloc(size_t bytes) {
-        #ifdef PM_MALLOC
-        if(critical_) return;
-        for(auto cb : registry_) cb->on_alloc(bytes);
-        #endif
-    }
+    static void notify_malloc(size_t bytes, uint8_t tag = 0, void const* block = nullptr);
 
     /**
      * \brief Tracks a memory release
      * 
      * \param bytes the number of release bytes
+     * \param tag the allocation tag's ID of the released block
+     * \param block the released block, if known
      */
-    inline static void notify_free(size_t bytes) {
-        #ifdef PM_MALLOC
-        if(critical_) return;
-        for(auto cb : registry_) cb->on_free(bytes);
-        #endif
-    }
+    static void notify_free(size_t bytes, uint8_t tag = 0, void const* block = nullptr);
+
+    /**
+     * \brief Reports the number of allocation and free events that have been dispatched to callbacks on the current thread
+     * 
+     * Events that occur while no callback is registered are not counted.
+     * 
+     * \return the number of dispatched events on the current thread
+     */
+    static uintmax_t num_notifications();
+
+    /**
+     * \brief Reports the number of currently registered callbacks
+     * 
+     * \return the number of currently registered callbacks
+     */
+    static size_t num_registered();
+    #else
+    inline static void notify_malloc(size_t, uint8_t = 0, void const* = nullptr) {}
+    inline static void notify_free(size_t, uint8_t = 0, void const* = nullptr) {}
+    inline static uintmax_t num_notifications() { return 0; }
+    inline static size_t num_registered() { return 0; }
+    #endif
 
     inline MallocCallback() : registered_(false) {
     }
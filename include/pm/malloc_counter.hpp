@@ -30,6 +30,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <string>
 #include <nlohmann/json.hpp>
 #include <pm/malloc_callback.hpp>
 
@@ -43,6 +44,42 @@ namespace pm {
  * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
  */
 class MallocCounter : public MallocCallback {
+public:
+    /**
+     * \brief The values of a completed measurement, which is all a parent phase needs to retain of it
+     */
+    struct Snapshot {
+        intmax_t current;
+        uintmax_t peak;
+        uintmax_t alloc_num;
+        uintmax_t alloc_bytes;
+        uintmax_t free_num;
+        uintmax_t free_bytes;
+
+        /**
+         * \brief The key for identifying this measurement in a data storage
+         * 
+         * \return the key for identifying this measurement in a data storage
+         */
+        std::string key() const { return "memory"; }
+
+        /**
+         * \brief Gathers data in a JSON data storage
+         * 
+         * \param data the JSON data storage
+         */
+        nlohmann::json gather_metrics() const {
+            nlohmann::json obj;
+            obj["peak"] = peak;
+            obj["closing"] = current;
+            obj["alloc_num"] = alloc_num;
+            obj["alloc_bytes"] = alloc_bytes;
+            obj["free_num"] = free_num;
+            obj["free_bytes"] = free_bytes;
+            return obj;
+        }
+    };
+
 private:
     bool active_;
 
@@ -84,6 +121,11 @@ public:
         reset();
     }
 
+    inline ~MallocCounter() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
     MallocCounter(MallocCounter const& other) = delete;
     MallocCounter& operator=(MallocCounter const& other) = delete;
 
@@ -196,21 +238,19 @@ public:
      */
     std::string key() const { return "memory"; }
 
+    /**
+     * \brief Takes a snapshot of the measured values
+     * 
+     * \return the snapshot
+     */
+    Snapshot snapshot() const { return { current_, peak_, alloc_num_, alloc_bytes_, free_num_, free_bytes_ }; }
+
     /**
      * \brief Gathers data in a JSON data storage
      * 
      * \param data the JSON data storage
      */
-    nlohmann::json gather_metrics() const {
-        nlohmann::json obj;
-        obj["peak"] = peak_;
-        obj["closing"] = current_;
-        obj["alloc_num"] = alloc_num_;
-        obj["alloc_bytes"] = alloc_bytes_;
-        obj["free_num"] = free_num_;
-        obj["free_bytes"] = free_bytes_;
-        return obj;
-    }
+    nlohmann::json gather_metrics() const { return snapshot().gather_metrics(); }
 };
 
 }
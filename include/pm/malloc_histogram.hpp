@@ -0,0 +1,210 @@
+/**
+ * pm/malloc_histogram.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_MALLOC_HISTOGRAM_HPP
+#define _PM_MALLOC_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <pm/log_buckets.hpp>
+#include <pm/malloc_callback.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures the size distribution of memory allocations and frees
+ * 
+ * As an implementation of \ref MallocCallback , it receives memory allocation and free callbacks if tudocomp's `malloc` overrides are enabled.
+ * The sizes of allocated and released blocks are counted in logarithmic \ref LogBuckets "buckets" with \ref SUB_BITS sub-bucket bits,
+ * i.e., every power-of-two range of sizes is divided into \f$2^{\mathit{SUB\_BITS}}\f$ buckets.
+ * The buckets are fixed-size arrays of atomic counters, so nothing is allocated during the measurement,
+ * and the histogram can be used with multiple allocating threads.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class MallocHistogram : public MallocCallback {
+public:
+    /**
+     * \brief The number of sub-bucket bits
+     */
+    static constexpr unsigned SUB_BITS = 2;
+
+    /**
+     * \brief The bucket mapping
+     */
+    using Buckets = LogBuckets<SUB_BITS>;
+
+private:
+    using Histogram = std::array<std::atomic<uintmax_t>, Buckets::NUM_BUCKETS>;
+
+    bool active_;
+    Histogram alloc_;
+    Histogram free_;
+
+    inline static void copy(Histogram& to, Histogram const& from) {
+        for(size_t i = 0; i < Buckets::NUM_BUCKETS; i++) to[i].store(from[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    inline static nlohmann::json gather(Histogram const& h) {
+        auto buckets = nlohmann::json::array();
+        for(size_t i = 0; i < Buckets::NUM_BUCKETS; i++) {
+            auto const count = h[i].load(std::memory_order_relaxed);
+            if(count) {
+                nlohmann::json bucket;
+                bucket["min"] = Buckets::lower(i);
+                bucket["max"] = Buckets::upper(i);
+                bucket["count"] = count;
+                buckets.push_back(std::move(bucket));
+            }
+        }
+        return buckets;
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        alloc_[Buckets::index(bytes)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void on_free(size_t bytes) override {
+        free_[Buckets::index(bytes)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void reset() {
+        for(auto& c : alloc_) c.store(0, std::memory_order_relaxed);
+        for(auto& c : free_) c.store(0, std::memory_order_relaxed);
+    }
+
+public:
+    inline MallocHistogram() : MallocCallback(), active_(false) {
+        reset();
+    }
+
+    inline ~MallocHistogram() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    MallocHistogram(MallocHistogram const& other) = delete;
+    MallocHistogram& operator=(MallocHistogram const& other) = delete;
+
+    inline MallocHistogram(MallocHistogram&& other) {
+        *this = std::move(other);
+    }
+
+    inline MallocHistogram& operator=(MallocHistogram&& other) {
+        copy(alloc_, other.alloc_);
+        copy(free_, other.free_);
+        active_ = other.active_;
+
+        if(active_) {
+            // nobody should be moving an active malloc histogram, but who knows...
+            other.unregister_callback();
+            other.active_ = false;
+            register_callback();
+        }
+
+        return *this;
+    }
+
+    /**
+     * \brief Starts allocation tracking.
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses allocation tracking.
+     */
+    inline void pause() {
+        if(active_) {
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes allocation tracking.
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+        }
+    }
+
+    /**
+     * \brief Ends allocation tracking.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The number of tracked allocations of the given size's bucket
+     * 
+     * \param bytes the allocation size
+     * \return the number of tracked allocations whose sizes fall into the same bucket
+     */
+    uintmax_t alloc_count(size_t bytes) const { return alloc_[Buckets::index(bytes)].load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The number of tracked frees of the given size's bucket
+     * 
+     * \param bytes the block size
+     * \return the number of tracked frees whose block sizes fall into the same bucket
+     */
+    uintmax_t free_count(size_t bytes) const { return free_[Buckets::index(bytes)].load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "size_histogram"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * For both allocations and frees, the non-empty buckets are reported in ascending order of sizes.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["alloc"] = gather(alloc_);
+        obj["free"] = gather(free_);
+        return obj;
+    }
+};
+
+}
+
+#endif
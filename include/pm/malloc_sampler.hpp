@@ -0,0 +1,402 @@
+/**
+ * pm/malloc_sampler.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_MALLOC_SAMPLER_HPP
+#define _PM_MALLOC_SAMPLER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define PM_HAS_BACKTRACE
+#endif
+
+#include <nlohmann/json.hpp>
+#include <pm/malloc_callback.hpp>
+#include <pm/thread_index.hpp>
+
+namespace pm {
+
+/**
+ * \brief Samples memory allocations and records the call stacks they originate from
+ * 
+ * Allocations are sampled based on the number of allocated bytes, similar to tcmalloc's heap profiler:
+ * the distances between sampled bytes are drawn from an exponential distribution with the configured mean,
+ * so every allocated byte has the same probability of being sampled (Poisson sampling).
+ * Only for the sampled allocations, the call stack is captured and aggregated per call site.
+ * Each sample is weighted such that the number of bytes and allocations per call site can be estimated without bias.
+ * Memory releases are not tracked.
+ * 
+ * Like the \ref ShardedMallocCounter , the sampler can safely be used with multiple allocating threads.
+ * The countdown to the next sample is kept per thread, so the unsampled hot path only reads and writes
+ * a thread's own cache line.
+ * 
+ * The call stacks are captured using `backtrace` and reported as strings obtained from `backtrace_symbols`.
+ * In order to obtain function names for the application's own code, it should be linked with `-rdynamic`.
+ * The innermost frames of every stack belong to pm's `malloc` overrides.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class MallocSampler : public MallocCallback {
+public:
+    /**
+     * \brief The maximum number of recorded stack frames per sample
+     */
+    static constexpr size_t MAX_FRAMES = 32;
+
+    /**
+     * \brief The number of per-thread countdown shards
+     */
+    static constexpr size_t NUM_SHARDS = 128;
+
+    /**
+     * \brief The default mean number of bytes between two samples
+     */
+    static constexpr size_t DEFAULT_INTERVAL = 512 * 1024;
+
+    /**
+     * \brief The default number of call sites reported by \ref gather_metrics
+     */
+    static constexpr size_t DEFAULT_TOP = 10;
+
+    /**
+     * \brief The default maximum number of distinct call sites that can be recorded
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic<intmax_t> countdown;
+        std::atomic<uint64_t> rng;
+    };
+
+    struct Site {
+        uint64_t hash;
+        size_t depth;
+        void* frames[MAX_FRAMES];
+        uintmax_t samples;
+        double bytes;
+        double count;
+    };
+
+    bool active_;
+    double interval_;
+    size_t top_;
+    size_t capacity_;
+
+    std::array<Shard, NUM_SHARDS> shards_;
+
+    std::mutex mutex_;
+    std::unique_ptr<Site[]> sites_;
+    size_t num_sites_;
+    uintmax_t samples_;
+    uintmax_t dropped_;
+
+    // draws the number of bytes until the next sample from an exponential distribution
+    inline intmax_t next_interval(Shard& s) {
+        // xorshift64*
+        uint64_t x = s.rng.load(std::memory_order_relaxed);
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        s.rng.store(x, std::memory_order_relaxed);
+
+        double const u = (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+        return (intmax_t)(-std::log(1.0 - u) * interval_) + 1;
+    }
+
+    inline static uint64_t hash_frames(void* const* frames, size_t depth) {
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for(size_t i = 0; i < depth; i++) {
+            h = (h ^ (uint64_t)(uintptr_t)frames[i]) * 0x100000001B3ULL;
+            h ^= h >> 29;
+        }
+        return h ? h : 1; // nb: zero marks an empty site
+    }
+
+    __attribute__((noinline)) void sample(size_t bytes) {
+        // nb: the first frame is this function, which is skipped
+        void* buffer[MAX_FRAMES + 1];
+        void** const frames = buffer + 1;
+        size_t depth = 0;
+        #ifdef PM_HAS_BACKTRACE
+        depth = std::max(backtrace(buffer, MAX_FRAMES + 1) - 1, 0);
+        #endif
+
+        // estimate how many bytes and allocations this sample represents
+        double const p = 1.0 - std::exp(-(double)bytes / interval_);
+        double const count = 1.0 / p;
+        uint64_t const hash = hash_frames(frames, depth);
+
+        std::lock_guard lock(mutex_);
+        ++samples_;
+
+        size_t const mask = capacity_ - 1;
+        for(size_t i = 0; i < capacity_; i++) {
+            auto& site = sites_[(hash + i) & mask];
+            if(site.hash == 0) {
+                if(num_sites_ * 4 >= capacity_ * 3) break; // keep the table sparse enough for probing
+
+                site.hash = hash;
+                site.depth = depth;
+                std::copy(frames, frames + depth, site.frames);
+                ++num_sites_;
+            }
+
+            if(site.hash == hash) {
+                ++site.samples;
+                site.bytes += count * bytes;
+                site.count += count;
+                return;
+            }
+        }
+
+        ++dropped_; // table is full
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        auto& s = shards_[thread_index() % NUM_SHARDS];
+        auto const countdown = s.countdown.load(std::memory_order_relaxed) - (intmax_t)bytes;
+        if(countdown > 0) {
+            s.countdown.store(countdown, std::memory_order_relaxed);
+        } else {
+            s.countdown.store(next_interval(s), std::memory_order_relaxed);
+            sample(bytes);
+        }
+    }
+
+    inline void on_free(size_t) override {
+    }
+
+    inline void reset() {
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            auto& s = shards_[i];
+            s.rng.store(0x9E3779B97F4A7C15ULL * (i + 1), std::memory_order_relaxed);
+            s.countdown.store(next_interval(s), std::memory_order_relaxed);
+        }
+
+        std::lock_guard lock(mutex_);
+        for(size_t i = 0; i < capacity_; i++) sites_[i].hash = 0;
+        num_sites_ = 0;
+        samples_ = 0;
+        dropped_ = 0;
+    }
+
+public:
+    /**
+     * \brief Constructs a sampler
+     * 
+     * The table of call sites is allocated here, so no allocations are necessary during the measurement.
+     * 
+     * \param interval the mean number of bytes between two samples
+     * \param top the number of call sites reported by \ref gather_metrics
+     * \param capacity the maximum number of distinct call sites (will be rounded up to a power of two)
+     */
+    inline MallocSampler(size_t interval = DEFAULT_INTERVAL, size_t top = DEFAULT_TOP, size_t capacity = DEFAULT_CAPACITY)
+        : MallocCallback(),
+          active_(false),
+          interval_((double)std::max(interval, size_t(1))),
+          top_(top),
+          capacity_(std::bit_ceil(std::max(capacity, size_t(2)))),
+          sites_(std::make_unique<Site[]>(capacity_)) {
+
+        #ifdef PM_HAS_BACKTRACE
+        // the first call to backtrace may allocate memory, so make sure it happens outside of the measurement
+        void* frames[1];
+        backtrace(frames, 1);
+        #endif
+
+        reset();
+    }
+
+    inline ~MallocSampler() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    MallocSampler(MallocSampler const& other) = delete;
+    MallocSampler& operator=(MallocSampler const& other) = delete;
+
+    inline MallocSampler(MallocSampler&& other) : MallocSampler(0, 0, 0) {
+        *this = std::move(other);
+    }
+
+    inline MallocSampler& operator=(MallocSampler&& other) {
+        bool const active = other.active_;
+        other.pause();
+
+        interval_ = other.interval_;
+        top_ = other.top_;
+        capacity_ = other.capacity_;
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            shards_[i].countdown.store(other.shards_[i].countdown.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            shards_[i].rng.store(other.shards_[i].rng.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        sites_ = std::move(other.sites_);
+        num_sites_ = other.num_sites_;
+        samples_ = other.samples_;
+        dropped_ = other.dropped_;
+
+        // the moved-from sampler has no site table left, so it must not probe one
+        other.capacity_ = 0;
+        other.num_sites_ = 0;
+        other.samples_ = 0;
+        other.dropped_ = 0;
+
+        if(active) resume();
+        return *this;
+    }
+
+    /**
+     * \brief Starts sampling
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses sampling
+     */
+    inline void pause() {
+        if(active_) {
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes sampling
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+        }
+    }
+
+    /**
+     * \brief Ends sampling
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The number of samples taken
+     * 
+     * \return the number of samples taken
+     */
+    uintmax_t samples() const { return samples_; }
+
+    /**
+     * \brief The number of samples that were dropped because the table of call sites was full
+     * 
+     * \return the number of dropped samples
+     */
+    uintmax_t dropped() const { return dropped_; }
+
+    /**
+     * \brief The number of distinct call sites recorded
+     * 
+     * \return the number of distinct call sites recorded
+     */
+    size_t num_sites() const { return num_sites_; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "allocation_sites"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The call sites with the most estimated allocated bytes are reported in descending order.
+     * This should only be called while the sampler is not active.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        std::vector<Site const*> sites;
+        sites.reserve(num_sites_);
+        double total_bytes = 0;
+        for(size_t i = 0; i < capacity_; i++) {
+            if(sites_[i].hash) {
+                sites.push_back(&sites_[i]);
+                total_bytes += sites_[i].bytes;
+            }
+        }
+
+        size_t const num = std::min(top_, sites.size());
+        std::partial_sort(sites.begin(), sites.begin() + num, sites.end(), [](auto a, auto b){ return a->bytes > b->bytes; });
+
+        auto top = nlohmann::json::array();
+        for(size_t i = 0; i < num; i++) {
+            auto const& site = *sites[i];
+
+            auto stack = nlohmann::json::array();
+            #ifdef PM_HAS_BACKTRACE
+            if(char** symbols = backtrace_symbols(site.frames, (int)site.depth)) {
+                for(size_t j = 0; j < site.depth; j++) stack.push_back(symbols[j]);
+                free(symbols);
+            }
+            #endif
+
+            nlohmann::json obj;
+            obj["bytes"] = (uintmax_t)std::llround(site.bytes);
+            obj["count"] = (uintmax_t)std::llround(site.count);
+            obj["samples"] = site.samples;
+            obj["stack"] = std::move(stack);
+            top.push_back(std::move(obj));
+        }
+
+        nlohmann::json obj;
+        obj["interval"] = (uintmax_t)interval_;
+        obj["samples"] = samples_;
+        obj["dropped"] = dropped_;
+        obj["bytes"] = (uintmax_t)std::llround(total_bytes);
+        obj["sites"] = std::move(top);
+        return obj;
+    }
+};
+
+}
+
+#endif
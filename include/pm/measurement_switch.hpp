@@ -0,0 +1,125 @@
+/**
+ * pm/measurement_switch.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_MEASUREMENT_SWITCH_HPP
+#define _PM_MEASUREMENT_SWITCH_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace pm {
+
+/**
+ * \brief Turns measurement on or off at runtime
+ * 
+ * Measurement is enabled globally unless the environment variable `PM_MEASURE` is set to `0`, `off` or `false`,
+ * or until it is turned off using \ref disable .
+ * Independently of that, a \ref MeasurementSwitch::Scope "scope" forces measurement on for the current thread, e.g., for a single request.
+ * 
+ * The switch is respected by \ref SwitchablePhase "switchable phases" and by the dispatch of memory allocation events to \ref MallocCallback "malloc callbacks",
+ * so neither meters nor allocation callbacks do any work while measurement is disabled.
+ * Testing the switch costs a single branch on two cached flags.
+ * 
+ * Since allocations and frees that happen while measurement is disabled are not reported,
+ * the switch should only be turned while no allocation meters are running.
+ */
+class MeasurementSwitch {
+private:
+    inline static bool read_env() {
+        auto const* v = std::getenv(ENV_MEASURE);
+        return !(v && (std::strcmp(v, "0") == 0 || std::strcmp(v, "off") == 0 || std::strcmp(v, "false") == 0));
+    }
+
+    // nb: constant-initialized to true, so measurement is enabled before the environment has been read
+    inline static std::atomic<bool> enabled_ = true;
+    inline static thread_local bool forced_ = false;
+    static bool const env_read_;
+
+public:
+    /**
+     * \brief The environment variable that determines whether measurement is enabled globally at program start
+     */
+    static constexpr char const* ENV_MEASURE = "PM_MEASURE";
+
+    /**
+     * \brief Forces measurement on for the current thread until the scope is left
+     * 
+     * Scopes can be nested.
+     */
+    class Scope {
+    private:
+        bool prev_;
+
+    public:
+        inline Scope() : prev_(forced_) {
+            forced_ = true;
+        }
+
+        inline ~Scope() {
+            forced_ = prev_;
+        }
+
+        Scope(Scope const&) = delete;
+        Scope(Scope&&) = delete;
+        Scope& operator=(Scope const&) = delete;
+        Scope& operator=(Scope&&) = delete;
+    };
+
+    /**
+     * \brief Tests whether measurement is enabled for the current thread
+     * 
+     * \return true if measurement is enabled globally or forced on for the current thread, false otherwise
+     */
+    inline static bool enabled() {
+        return enabled_.load(std::memory_order_relaxed) | forced_; // nb: bitwise or to avoid a second branch
+    }
+
+    /**
+     * \brief Enables measurement globally
+     */
+    inline static void enable() { enabled_.store(true, std::memory_order_relaxed); }
+
+    /**
+     * \brief Disables measurement globally
+     * 
+     * Threads within a \ref MeasurementSwitch::Scope "scope" keep measuring.
+     */
+    inline static void disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+    /**
+     * \brief Tests whether measurement is enabled globally
+     * 
+     * \return true if measurement is enabled globally, false otherwise
+     */
+    inline static bool enabled_globally() { return enabled_.load(std::memory_order_relaxed); }
+};
+
+inline bool const MeasurementSwitch::env_read_ = (MeasurementSwitch::enabled_.store(MeasurementSwitch::read_env(), std::memory_order_relaxed), true);
+
+}
+
+#endif
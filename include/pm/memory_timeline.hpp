@@ -0,0 +1,319 @@
+/**
+ * pm/memory_timeline.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_MEMORY_TIMELINE_HPP
+#define _PM_MEMORY_TIMELINE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+#include <pm/process_memory.hpp>
+#include <pm/sharded_malloc_counter.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief Records the curve of tracked memory over the lifetime of a measurement
+ * 
+ * While the measurement is running, a background thread periodically samples the currently allocated bytes,
+ * as tracked by a \ref ShardedMallocCounter , and optionally the process's \ref resident_set_size "resident set size" (RSS).
+ * The series is stored in a buffer of fixed capacity, allocated on construction.
+ * Once the buffer is full, every two adjacent samples are merged into one by taking their maximum and the sampling interval is doubled.
+ * Thus, the series covers the entire measurement at a resolution that adapts to its duration, and peaks are never lost to downsampling.
+ * Samples are also taken when the measurement is started and stopped, so even a measurement shorter than the sampling interval
+ * has a series, and its last sample reflects the state at the end of the measurement. Paused time is skipped.
+ * 
+ * A moved-from timeline has no buffer left; it records nothing and reports an empty series.
+ * 
+ * Allocation tracking requires that tudocomp's `malloc` overrides are enabled. The RSS is only available on Linux.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class MemoryTimeline {
+public:
+    /**
+     * \brief The default sampling interval
+     */
+    static constexpr std::chrono::microseconds DEFAULT_INTERVAL = std::chrono::milliseconds(10);
+
+    /**
+     * \brief The default number of samples that are kept
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+private:
+    // the state shared with the sampler thread, which must not move while the thread is running
+    struct State {
+        ShardedMallocCounter counter;
+        std::unique_ptr<intmax_t[]> bytes;
+        std::unique_ptr<uintmax_t[]> rss;
+        size_t capacity;
+        size_t num;
+        size_t ticks_per_sample;
+        size_t ticks;
+
+        std::atomic_bool active;
+        bool quit;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread thread;
+
+        inline State(size_t capacity)
+            : bytes(std::make_unique<intmax_t[]>(capacity)),
+              rss(std::make_unique<uintmax_t[]>(capacity)),
+              capacity(capacity),
+              num(0),
+              ticks_per_sample(1),
+              ticks(0),
+              active(false),
+              quit(false) {
+        }
+    };
+
+    std::unique_ptr<State> state_;
+    std::chrono::microseconds interval_;
+    bool sample_rss_;
+
+    // completes the sample that is currently being merged, downsampling if the buffer becomes full
+    inline static void commit(State& s) {
+        s.ticks = 0;
+        if(++s.num == s.capacity) {
+            // downsample by merging adjacent samples
+            for(size_t i = 0; i < s.capacity / 2; i++) {
+                s.bytes[i] = std::max(s.bytes[2 * i], s.bytes[2 * i + 1]);
+                s.rss[i] = std::max(s.rss[2 * i], s.rss[2 * i + 1]);
+            }
+            s.num = s.capacity / 2;
+            s.ticks_per_sample *= 2;
+        }
+    }
+
+    inline static void record(State& s, intmax_t bytes, uintmax_t rss) {
+        if(s.ticks == 0) {
+            s.bytes[s.num] = bytes;
+            s.rss[s.num] = rss;
+        } else {
+            s.bytes[s.num] = std::max(s.bytes[s.num], bytes);
+            s.rss[s.num] = std::max(s.rss[s.num], rss);
+        }
+
+        if(++s.ticks == s.ticks_per_sample) commit(s);
+    }
+
+    inline void sample(State& s) {
+        record(s, s.counter.count(), sample_rss_ ? resident_set_size() : 0);
+    }
+
+    inline static void run(State& s, std::chrono::microseconds interval, bool sample_rss) {
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock lock(s.mutex);
+        while(true) {
+            next += interval;
+            if(s.cv.wait_until(lock, next, [&](){ return s.quit; })) break;
+            if(s.active.load(std::memory_order_relaxed)) {
+                record(s, s.counter.count(), sample_rss ? resident_set_size() : 0);
+            }
+        }
+    }
+
+    inline void join() {
+        if(state_ && state_->thread.joinable()) {
+            {
+                std::lock_guard lock(state_->mutex);
+                state_->quit = true;
+            }
+            state_->cv.notify_one();
+            state_->thread.join();
+        }
+    }
+
+public:
+    /**
+     * \brief Constructs a new memory timeline
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     * 
+     * \param interval the initial sampling interval
+     * \param sample_rss whether or not to also sample the resident set size
+     * \param capacity the maximum number of samples, which should be even
+     */
+    inline MemoryTimeline(std::chrono::microseconds interval = DEFAULT_INTERVAL, bool sample_rss = false, size_t capacity = DEFAULT_CAPACITY)
+        : state_(std::make_unique<State>(std::max(capacity, size_t(2)))),
+          interval_(std::max(interval, std::chrono::microseconds(1))),
+          sample_rss_(sample_rss) {
+    }
+
+    inline ~MemoryTimeline() {
+        join();
+    }
+
+    MemoryTimeline(MemoryTimeline const& other) = delete;
+    MemoryTimeline(MemoryTimeline&& other) = default;
+    MemoryTimeline& operator=(MemoryTimeline const& other) = delete;
+
+    inline MemoryTimeline& operator=(MemoryTimeline&& other) {
+        join();
+        state_ = std::move(other.state_);
+        interval_ = other.interval_;
+        sample_rss_ = other.sample_rss_;
+        return *this;
+    }
+
+    /**
+     * \brief Starts the sampler thread and allocation tracking
+     * 
+     * This will clear the previously recorded series.
+     */
+    inline void start() {
+        join();
+        if(!state_) return;
+
+        auto& s = *state_;
+        s.num = 0;
+        s.ticks = 0;
+        s.ticks_per_sample = 1;
+        s.quit = false;
+        {
+            // the sampler thread is our own bookkeeping, so it is launched untracked and before the counter is started
+            UntrackedScope untracked;
+            s.thread = std::thread(run, std::ref(s), interval_, sample_rss_);
+        }
+
+        std::lock_guard lock(s.mutex);
+        s.counter.start();
+        sample(s);
+        s.active.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Pauses sampling and allocation tracking
+     */
+    inline void pause() {
+        if(!state_) return;
+        state_->active.store(false, std::memory_order_relaxed);
+        state_->counter.pause();
+    }
+
+    /**
+     * \brief Resumes sampling and allocation tracking
+     */
+    inline void resume() {
+        if(!state_) return;
+        state_->counter.resume();
+        state_->active.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Stops sampling and allocation tracking and joins the sampler thread
+     * 
+     * Unless the measurement is paused, a final sample is taken. The sample that is currently being merged is kept even if incomplete.
+     */
+    inline void stop() {
+        if(!state_) return;
+        {
+            auto& s = *state_;
+            std::lock_guard lock(s.mutex);
+            if(s.active.load(std::memory_order_relaxed)) sample(s);
+            if(s.ticks > 0) commit(s);
+        }
+        pause();
+        state_->counter.stop();
+        join();
+    }
+
+    /**
+     * \brief The number of recorded samples
+     * 
+     * \return the number of recorded samples
+     */
+    size_t num_samples() const { return state_ ? state_->num : 0; }
+
+    /**
+     * \brief The current sampling interval, which doubles every time the series is downsampled
+     * 
+     * \return the current sampling interval
+     */
+    std::chrono::microseconds interval() const { return state_ ? std::chrono::microseconds(interval_ * state_->ticks_per_sample) : interval_; }
+
+    /**
+     * \brief The maximum number of allocated bytes within the given sample's interval
+     * 
+     * \param i the index of the sample
+     * \return the maximum number of allocated bytes
+     */
+    intmax_t bytes(size_t i) const { return state_->bytes[i]; }
+
+    /**
+     * \brief The maximum resident set size within the given sample's interval
+     * 
+     * \param i the index of the sample
+     * \return the maximum resident set size, or zero if the RSS is not sampled
+     */
+    uintmax_t rss(size_t i) const { return state_->rss[i]; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "memory_timeline"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The sampling `interval` is reported in milliseconds, followed by the series of allocated `bytes` and, if enabled, of the `rss`.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["interval"] = std::chrono::duration<double, std::milli>(interval()).count();
+
+        auto bytes_series = nlohmann::json::array();
+        for(size_t i = 0; i < num_samples(); i++) bytes_series.push_back(bytes(i));
+        obj["bytes"] = std::move(bytes_series);
+
+        if(sample_rss_) {
+            auto rss_series = nlohmann::json::array();
+            for(size_t i = 0; i < num_samples(); i++) rss_series.push_back(rss(i));
+            obj["rss"] = std::move(rss_series);
+        }
+        return obj;
+    }
+};
+
+}
+
+#endif
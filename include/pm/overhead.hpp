@@ -0,0 +1,156 @@
+/**
+ * pm/overhead.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_OVERHEAD_HPP
+#define _PM_OVERHEAD_HPP
+
+#include <cstdint>
+
+#include <pm/malloc_callback.hpp>
+
+namespace pm {
+
+/**
+ * \brief Bookkeeping of the calibrated overhead that measurements add to enclosing measurements
+ * 
+ * The costs are determined per phase type by \ref calibrate and are zero until then.
+ * Whenever a \ref Phase is stopped, its calibrated start-stop cost is added to a thread-local accumulator,
+ * which \ref CalibratedStopwatch "calibrated stopwatches" of enclosing phases subtract from their measurements.
+ * While a phase is running, every allocation or free that is dispatched to the \ref MallocCallback "callbacks" on the current thread
+ * additionally costs the calibrated dispatch cost of the phase's type, which is accounted in a second thread-local accumulator.
+ */
+class Overhead {
+private:
+    template<typename P>
+    static inline double phase_nanos_ = 0.0;
+
+    template<typename P>
+    static inline double hook_nanos_ = 0.0;
+
+    static inline double stopwatch_nanos_ = 0.0;
+
+    // the dispatch cost per event of the phases running on the current thread, accounted lazily whenever it changes
+    struct Dispatch {
+        double cost;
+        uintmax_t since;
+        double accumulated;
+    };
+
+    inline static Dispatch& dispatch() {
+        thread_local Dispatch dispatch = { 0.0, 0, 0.0 };
+        return dispatch;
+    }
+
+    inline static void settle(Dispatch& d) {
+        auto const n = MallocCallback::num_notifications();
+        d.accumulated += (double)(n - d.since) * d.cost;
+        d.since = n;
+    }
+
+public:
+    /**
+     * \brief The overhead accumulated on the current thread so far in nanoseconds
+     * 
+     * \return the accumulated overhead in nanoseconds
+     */
+    inline static double& accumulated() {
+        thread_local double accumulated = 0.0;
+        return accumulated;
+    }
+
+    /**
+     * \brief Adds to the overhead accumulated on the current thread
+     * 
+     * \param nanos the overhead in nanoseconds
+     */
+    inline static void add(double nanos) {
+        accumulated() += nanos;
+    }
+
+    /**
+     * \brief The dispatch overhead accumulated on the current thread so far in nanoseconds
+     * 
+     * \return the accumulated dispatch overhead in nanoseconds
+     */
+    inline static double dispatched() {
+        auto d = dispatch();
+        settle(d);
+        return d.accumulated;
+    }
+
+    /**
+     * \brief Begins charging the given cost for every event dispatched on the current thread
+     * 
+     * \param nanos the cost per event in nanoseconds
+     */
+    inline static void begin_dispatch(double nanos) {
+        auto& d = dispatch();
+        settle(d);
+        d.cost += nanos;
+    }
+
+    /**
+     * \brief Ends charging the given cost for every event dispatched on the current thread
+     * 
+     * \param nanos the cost per event in nanoseconds, as previously passed to \ref begin_dispatch
+     */
+    inline static void end_dispatch(double nanos) {
+        auto& d = dispatch();
+        settle(d);
+        d.cost -= nanos;
+    }
+
+    /**
+     * \brief The calibrated cost of starting and stopping a phase of the given type in nanoseconds
+     * 
+     * \tparam P the phase type
+     * \return the calibrated cost in nanoseconds
+     */
+    template<typename P>
+    inline static double& phase() { return phase_nanos_<P>; }
+
+    /**
+     * \brief The calibrated cost that a running phase of the given type adds to dispatching one allocation or free event
+     * to the registered \ref MallocCallback "callbacks" in nanoseconds
+     * 
+     * \tparam P the phase type
+     * \return the calibrated cost in nanoseconds
+     */
+    template<typename P>
+    inline static double& hook() { return hook_nanos_<P>; }
+
+    /**
+     * \brief The calibrated time measured by a \ref CalibratedStopwatch for an empty interval in nanoseconds
+     * 
+     * \return the calibrated time in nanoseconds
+     */
+    inline static double& stopwatch() { return stopwatch_nanos_; }
+};
+
+}
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ * pm/perf_counters.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_PERF_COUNTERS_HPP
+#define _PM_PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define PM_HAS_PERF_EVENTS
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pm {
+
+/**
+ * \brief Describes a performance event to be counted by \ref PerfCounters
+ * 
+ * The type and config correspond to the fields of the same name in Linux's `perf_event_attr`.
+ * For the most common events, predefined descriptions are available via the static factory functions.
+ */
+struct PerfEvent {
+    /**
+     * \brief The name under which the event's count is reported
+     */
+    std::string name;
+
+    /**
+     * \brief The event type (e.g., `PERF_TYPE_HARDWARE`)
+     */
+    uint32_t type;
+
+    /**
+     * \brief The event type specific configuration (e.g., `PERF_COUNT_HW_CPU_CYCLES`)
+     */
+    uint64_t config;
+
+    #ifdef PM_HAS_PERF_EVENTS
+    /// \brief Computes the config for read misses of the given `PERF_TYPE_HW_CACHE` cache
+    static constexpr uint64_t cache_read_miss(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    /// \brief CPU cycles
+    static PerfEvent cycles() { return { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES }; }
+
+    /// \brief Retired instructions
+    static PerfEvent instructions() { return { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS }; }
+
+    /// \brief Level 1 data cache read misses
+    static PerfEvent l1d_misses() { return { "l1d_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_L1D) }; }
+
+    /// \brief Last level cache misses
+    static PerfEvent llc_misses() { return { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }; }
+
+    /// \brief Mispredicted branches
+    static PerfEvent branch_misses() { return { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }; }
+
+    /// \brief Data TLB read misses
+    static PerfEvent dtlb_misses() { return { "dtlb_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_DTLB) }; }
+
+    /// \brief Page faults (software event)
+    static PerfEvent page_faults() { return { "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }; }
+
+    /// \brief Context switches (software event)
+    static PerfEvent context_switches() { return { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }; }
+    #else
+    static PerfEvent cycles() { return { "cycles", 0, 0 }; }
+    static PerfEvent instructions() { return { "instructions", 0, 0 }; }
+    static PerfEvent l1d_misses() { return { "l1d_misses", 0, 0 }; }
+    static PerfEvent llc_misses() { return { "llc_misses", 0, 0 }; }
+    static PerfEvent branch_misses() { return { "branch_misses", 0, 0 }; }
+    static PerfEvent dtlb_misses() { return { "dtlb_misses", 0, 0 }; }
+    static PerfEvent page_faults() { return { "page_faults", 0, 0 }; }
+    static PerfEvent context_switches() { return { "context_switches", 0, 0 }; }
+    #endif
+};
+
+/**
+ * \brief Measures hardware performance counters using Linux's `perf_event_open`
+ * 
+ * The configured events are opened as a single event group when the measurement is started, so they are always scheduled together.
+ * By default, cycles, instructions, L1D and LLC misses, branch misses and data TLB misses are counted.
+ * Only user space events of the calling thread are counted.
+ * 
+ * Events that cannot be opened, e.g., because the hardware does not support them or the system's `perf_event_paranoid` setting forbids it,
+ * are reported as unavailable, and the remaining events are counted nonetheless.
+ * If the kernel had to multiplex the event group with other groups, the counts are scaled up accordingly.
+ * On systems other than Linux, all events are unavailable.
+ * 
+ * The file descriptors are closed when the measurement is stopped, so that many phases can be measured without running out of descriptors.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class PerfCounters {
+private:
+    std::vector<PerfEvent> events_;
+    std::vector<int> fds_;
+    std::vector<uint64_t> counts_;
+    std::vector<bool> available_;
+    uint64_t time_enabled_;
+    uint64_t time_running_;
+    int leader_;
+
+    #ifdef PM_HAS_PERF_EVENTS
+    inline static int open_event(PerfEvent const& e, int group) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = e.type;
+        attr.config = e.config;
+        attr.disabled = (group == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+    #endif
+
+    inline void open() {
+        fds_.assign(events_.size(), -1);
+        #ifdef PM_HAS_PERF_EVENTS
+        for(size_t i = 0; i < events_.size(); i++) {
+            fds_[i] = open_event(events_[i], leader_);
+            if(leader_ == -1) leader_ = fds_[i];
+        }
+        #endif
+
+        for(size_t i = 0; i < events_.size(); i++) available_[i] = (fds_[i] != -1);
+    }
+
+    inline void close() {
+        #ifdef PM_HAS_PERF_EVENTS
+        for(auto fd : fds_) {
+            if(fd != -1) ::close(fd);
+        }
+        #endif
+        fds_.clear();
+        leader_ = -1;
+    }
+
+    inline void read_counts() {
+        #ifdef PM_HAS_PERF_EVENTS
+        if(leader_ == -1) return;
+
+        // read format: nr, time_enabled, time_running, values[nr]
+        std::vector<uint64_t> buf(3 + events_.size(), 0);
+        auto const r = ::read(leader_, buf.data(), buf.size() * sizeof(uint64_t));
+        if(r < ssize_t(3 * sizeof(uint64_t))) return;
+
+        time_enabled_ = buf[1];
+        time_running_ = buf[2];
+
+        // the group members' values appear in the order in which they were opened
+        size_t j = 3;
+        for(size_t i = 0; i < events_.size(); i++) {
+            if(fds_[i] == -1) continue;
+
+            uint64_t const value = buf[j++];
+            if(time_running_ == 0) {
+                counts_[i] = 0;
+            } else if(time_running_ < time_enabled_) {
+                counts_[i] = uint64_t((double)value * ((double)time_enabled_ / (double)time_running_));
+            } else {
+                counts_[i] = value;
+            }
+        }
+        #endif
+    }
+
+    inline void ioctl_group([[maybe_unused]] unsigned long request) {
+        #ifdef PM_HAS_PERF_EVENTS
+        if(leader_ != -1) ioctl(leader_, request, PERF_IOC_FLAG_GROUP);
+        #endif
+    }
+
+    inline size_t find(std::string const& name) const {
+        for(size_t i = 0; i < events_.size(); i++) {
+            if(events_[i].name == name) return i;
+        }
+        return events_.size();
+    }
+
+public:
+    /**
+     * \brief Constructs performance counters for the default set of events
+     * 
+     * Note that this does \em not open or start the counters; \ref start must be called manually.
+     */
+    inline PerfCounters() : PerfCounters({
+        PerfEvent::cycles(),
+        PerfEvent::instructions(),
+        PerfEvent::l1d_misses(),
+        PerfEvent::llc_misses(),
+        PerfEvent::branch_misses(),
+        PerfEvent::dtlb_misses()
+    }) {
+    }
+
+    /**
+     * \brief Constructs performance counters for the given events
+     * 
+     * Note that this does \em not open or start the counters; \ref start must be called manually.
+     * 
+     * \param events the events to count
+     */
+    inline PerfCounters(std::vector<PerfEvent> events)
+        : events_(std::move(events)),
+          counts_(events_.size(), 0),
+          available_(events_.size(), false),
+          time_enabled_(0),
+          time_running_(0),
+          leader_(-1) {
+    }
+
+    inline ~PerfCounters() {
+        close();
+    }
+
+    PerfCounters(PerfCounters const& other) = delete;
+    PerfCounters& operator=(PerfCounters const& other) = delete;
+
+    inline PerfCounters(PerfCounters&& other) : leader_(-1) {
+        *this = std::move(other);
+    }
+
+    inline PerfCounters& operator=(PerfCounters&& other) {
+        close();
+        events_ = std::move(other.events_);
+        fds_ = std::move(other.fds_);
+        counts_ = std::move(other.counts_);
+        available_ = std::move(other.available_);
+        time_enabled_ = other.time_enabled_;
+        time_running_ = other.time_running_;
+        leader_ = other.leader_;
+
+        other.fds_.clear();
+        other.leader_ = -1;
+        return *this;
+    }
+
+    /**
+     * \brief Opens the event group and starts counting
+     * 
+     * This will reset all counts to zero.
+     */
+    inline void start() {
+        close();
+        counts_.assign(events_.size(), 0);
+        available_.assign(events_.size(), false);
+        time_enabled_ = 0;
+        time_running_ = 0;
+
+        open();
+        #ifdef PM_HAS_PERF_EVENTS
+        ioctl_group(PERF_EVENT_IOC_RESET);
+        ioctl_group(PERF_EVENT_IOC_ENABLE);
+        #endif
+    }
+
+    /**
+     * \brief Pauses counting
+     */
+    inline void pause() {
+        #ifdef PM_HAS_PERF_EVENTS
+        ioctl_group(PERF_EVENT_IOC_DISABLE);
+        #endif
+        read_counts();
+    }
+
+    /**
+     * \brief Resumes counting
+     */
+    inline void resume() {
+        #ifdef PM_HAS_PERF_EVENTS
+        ioctl_group(PERF_EVENT_IOC_ENABLE);
+        #endif
+    }
+
+    /**
+     * \brief Stops counting and closes the event group
+     */
+    inline void stop() {
+        pause();
+        close();
+    }
+
+    /**
+     * \brief The number of configured events
+     * 
+     * \return the number of configured events
+     */
+    size_t num_events() const { return events_.size(); }
+
+    /**
+     * \brief Reports whether the given event could be opened when the measurement was last started
+     * 
+     * \param i the index of the event
+     * \return true if the event has been counted, false otherwise
+     */
+    bool available(size_t i) const { return available_[i]; }
+
+    /**
+     * \brief The count of the given event as of the last pause or stop
+     * 
+     * \param i the index of the event
+     * \return the count of the event
+     */
+    uint64_t count(size_t i) const { return counts_[i]; }
+
+    /**
+     * \brief The count of the event with the given name as of the last pause or stop
+     * 
+     * \param name the name of the event
+     * \return the count of the event, or zero if no such event is configured
+     */
+    uint64_t count(std::string const& name) const {
+        auto const i = find(name);
+        return i < events_.size() ? counts_[i] : 0;
+    }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "perf"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The counts are reported under the events' names, and the names of events that could not be opened are listed as `unavailable`.
+     * If both cycles and instructions are counted, the instructions per cycle are reported as `ipc`.
+     * For every event whose name ends with `_misses`, the misses per thousand instructions are reported with the suffix `_mpki` instead.
+     * The ratio of the time the group was actually counting to the time it was enabled is reported as `running`;
+     * if it is less than one, the counts have been scaled up.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        auto unavailable = nlohmann::json::array();
+        for(size_t i = 0; i < events_.size(); i++) {
+            if(available_[i]) {
+                obj[events_[i].name] = counts_[i];
+            } else {
+                unavailable.push_back(events_[i].name);
+            }
+        }
+
+        auto const cycles = count("cycles");
+        auto const instructions = count("instructions");
+        if(cycles > 0 && instructions > 0) {
+            obj["ipc"] = (double)instructions / (double)cycles;
+        }
+
+        if(instructions > 0) {
+            std::string const suffix = "_misses";
+            for(size_t i = 0; i < events_.size(); i++) {
+                if(!available_[i]) continue; // listed as unavailable, so no rate can be derived
+
+                auto const& name = events_[i].name;
+                if(name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                    obj[name.substr(0, name.size() - suffix.size()) + "_mpki"] = 1000.0 * (double)counts_[i] / (double)instructions;
+                }
+            }
+        }
+
+        if(!unavailable.empty()) obj["unavailable"] = std::move(unavailable);
+        obj["running"] = time_enabled_ > 0 ? (double)time_running_ / (double)time_enabled_ : 0.0;
+        return obj;
+    }
+};
+
+}
+
+#endif
@@ -28,11 +28,20 @@
 #ifndef _PM_PHASE_HPP
 #define _PM_PHASE_HPP
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include <pm/concepts.hpp>
 #include <pm/json.hpp>
+#include <pm/overhead.hpp>
+#include <pm/phase_child.hpp>
+#include <pm/trace_recorder.hpp>
+#include <pm/untracked_scope.hpp>
 
 namespace pm {
 
@@ -44,6 +53,10 @@ namespace pm {
  * 
  * The format of the JSON document provided by \ref gather_data is described in the manual.
  * 
+ * The phase's own bookkeeping, i.e., starting and stopping meters, appending children and gathering data,
+ * allocates memory \ref UntrackedScope "untracked", so it does not show up in the measurements of enclosing phases.
+ * The JSON data storage is written by the application and is therefore tracked.
+ * 
  * \tparam M the declared meters
  */
 template<Meter<nlohmann::json>... M>
@@ -51,8 +64,12 @@ class Phase  {
 private:
     std::tuple<M...> meters_;
     std::string name_;
+    bool paused_ = false;
+    double dispatch_cost_ = 0.0; // the calibrated dispatch cost currently charged for this phase
     nlohmann::json data_;
-    std::vector<nlohmann::json> children_;
+    // children whose data has already been gathered are stored inline
+    using Children = std::vector<std::variant<nlohmann::json, std::unique_ptr<PhaseChild>>>;
+    Children children_;
 
 public:
     /**
@@ -113,6 +130,20 @@ private:
         }
     }
 
+    void begin_dispatch() {
+        if(dispatch_cost_ == 0.0) {
+            dispatch_cost_ = Overhead::hook<Phase>();
+            if(dispatch_cost_ != 0.0) Overhead::begin_dispatch(dispatch_cost_);
+        }
+    }
+
+    void end_dispatch() {
+        if(dispatch_cost_ != 0.0) {
+            Overhead::end_dispatch(dispatch_cost_);
+            dispatch_cost_ = 0.0;
+        }
+    }
+
     template<size_t I = 0>
     void gather_metrics(nlohmann::json& metrics) const {
         if constexpr(I < num_meters()) {
@@ -122,7 +153,95 @@ private:
         }
     }
 
+    static void gather_children(Children const& children, nlohmann::json& json) {
+        if(!children.empty()) {
+            auto array = nlohmann::json::array();
+            array.get_ref<nlohmann::json::array_t&>().reserve(children.size());
+            for(auto const& c : children) {
+                auto const* data = std::get_if<nlohmann::json>(&c);
+                array.push_back(data ? *data : std::get<std::unique_ptr<PhaseChild>>(c)->gather());
+            }
+            json[JSON_KEY_CHILDREN] = std::move(array);
+        }
+    }
+
+    static void consume_children(Children& children, nlohmann::json& json) {
+        if(!children.empty()) {
+            auto array = nlohmann::json::array();
+            array.get_ref<nlohmann::json::array_t&>().reserve(children.size());
+            for(auto& c : children) {
+                auto* data = std::get_if<nlohmann::json>(&c);
+                array.push_back(data ? std::move(*data) : std::get<std::unique_ptr<PhaseChild>>(c)->consume());
+            }
+            json[JSON_KEY_CHILDREN] = std::move(array);
+            children.clear();
+        }
+    }
+
 public:
+    /**
+     * \brief A completed phase as retained by its parent
+     * 
+     * When a phase is moved into its parent, only its name, data, children and the values of its meters are retained,
+     * each meter in the form of a \ref RetainedMeter "retained meter".
+     * For instance, a \ref ShardedMallocCounter, which is several kilobytes in size, is retained as a \ref MallocCounter::Snapshot "snapshot" of a few words,
+     * and meters holding tables or histograms are retained as their JSON metrics.
+     */
+    class Completed : public PhaseChild {
+    private:
+        std::string name_;
+        std::tuple<RetainedMeter<M>...> meters_;
+        nlohmann::json data_;
+        Children children_;
+
+    public:
+        /**
+         * \brief Whether retaining the meters of a completed phase requires no allocations
+         */
+        static constexpr bool compact = (RetainedMeter<M>::compact && ...);
+
+        inline Completed() {}
+        inline Completed(Phase&& phase) { assign(std::move(phase)); }
+
+        /**
+         * \brief Takes over the name, data and children of the given completed phase and retains the values of its meters
+         * 
+         * \param phase the phase
+         */
+        void assign(Phase&& phase) {
+            meters_ = std::apply([](auto&... m){ return std::tuple<RetainedMeter<M>...>(std::move(m)...); }, phase.meters_);
+            name_ = std::move(phase.name_);
+            data_ = std::move(phase.data_);
+            children_ = std::move(phase.children_);
+        }
+
+        nlohmann::json gather() const override {
+            nlohmann::json json;
+            json[JSON_KEY_NAME] = name_;
+            gather_children(children_, json);
+            if constexpr(has_meters()) {
+                nlohmann::json metrics;
+                std::apply([&](auto const&... m){ (m.gather(metrics), ...); }, meters_);
+                json[JSON_KEY_METRICS] = std::move(metrics);
+            }
+            if(!data_.empty()) json[JSON_KEY_DATA] = data_;
+            return json;
+        }
+
+        nlohmann::json consume() override {
+            nlohmann::json json;
+            json[JSON_KEY_NAME] = std::move(name_);
+            consume_children(children_, json);
+            if constexpr(has_meters()) {
+                nlohmann::json metrics;
+                std::apply([&](auto&... m){ (m.consume(metrics), ...); }, meters_);
+                json[JSON_KEY_METRICS] = std::move(metrics);
+            }
+            if(!data_.empty()) json[JSON_KEY_DATA] = std::move(data_);
+            return json;
+        }
+    };
+
     /**
      * \brief Constructs a phase with the given name
      * 
@@ -139,42 +258,125 @@ public:
 
     /**
      * \brief Pauses the phase's meters in order of their declaration
+     * 
+     * If a \ref TraceRecorder is active, a begin event is recorded beforehand.
      */
     void start() {
+        UntrackedScope untracked;
+        TraceRecorder::record(TraceEventType::begin, name_);
+        paused_ = false;
+        begin_dispatch();
         start_meters();
     }
 
     /**
      * \brief Pauses the phase's meters in reverse order of their declaration
+     * 
+     * If a \ref TraceRecorder is active, a pause event is recorded afterwards.
      */
     void pause() {
         pause_meters();
+        end_dispatch();
+        paused_ = true;
+        TraceRecorder::record(TraceEventType::pause, name_);
     }
 
     /**
      * \brief Pauses the phase's meters in order of their declaration
+     * 
+     * If a \ref TraceRecorder is active, a resume event is recorded beforehand.
      */
     void resume() {
+        TraceRecorder::record(TraceEventType::resume, name_);
+        paused_ = false;
+        begin_dispatch();
         resume_meters();
     }
 
     /**
      * \brief Pauses the phase's meters in reverse order of their declaration
+     * 
+     * Afterwards, the calibrated start-stop overhead of this phase, if any, is \ref Overhead::add "accounted" for enclosing measurements,
+     * and if a \ref TraceRecorder is active, an end event is recorded unless the phase is paused, in which case the pause already ended it.
      */
     void stop() {
+        UntrackedScope untracked;
         stop_meters();
+        end_dispatch();
+        if(auto const cost = Overhead::phase<Phase>(); cost != 0.0) Overhead::add(cost);
+        if(!paused_) TraceRecorder::record(TraceEventType::end, name_);
+        paused_ = false;
     }
 
     /**
      * \brief Appends the given phase as a child of this phase
      * 
-     * The child's data is gathered into this phase's JSON data storage.
+     * The child's data is gathered into this phase's JSON data storage immediately.
+     * If the child is no longer needed, consider moving it instead.
      * 
      * \param child the child phase to append
      */
     template<JSONMeasurementPhase T>
     void append_child(T const& child) {
-        children_.emplace_back(child.gather_data());
+        UntrackedScope untracked;
+        children_.emplace_back(std::in_place_index<0>, child.gather_data());
+    }
+
+    /**
+     * \brief Moves the given phase into this phase as a child
+     * 
+     * The child's data is not gathered until this phase's data is gathered, so no JSON is built (or copied) before that time.
+     * 
+     * The child is retained as its \ref phase_child_t "completed form": if it is a `Phase`, this is a \ref Completed phase,
+     * which keeps the child's name, data and children, but only compact snapshots of its meters (or their JSON metrics).
+     * Other phase types are retained entirely, along with all of their meters' state.
+     * 
+     * \param child the child phase to append
+     */
+    template<JSONMeasurementPhase T> requires (!std::is_reference_v<T>)
+    void append_child(T&& child) {
+        UntrackedScope untracked;
+        children_.emplace_back(std::in_place_index<1>, std::make_unique<phase_child_t<T>>(std::move(child)));
+    }
+
+    /**
+     * \brief Appends the given completed child phase
+     * 
+     * The child's data is not gathered until this phase's data is gathered.
+     * 
+     * \param child the child phase
+     */
+    void append_child(std::unique_ptr<PhaseChild>&& child) {
+        UntrackedScope untracked;
+        children_.emplace_back(std::in_place_index<1>, std::move(child));
+    }
+
+    /**
+     * \brief Appends the given JSON data as that of a child of this phase
+     * 
+     * This is meant for children whose data has already been gathered.
+     * 
+     * \param child the child phase's data, as returned by its `gather_data`
+     */
+    void append_child_data(nlohmann::json&& child) {
+        UntrackedScope untracked;
+        children_.emplace_back(std::in_place_index<0>, std::move(child));
+    }
+
+    /**
+     * \brief Makes sure that the given number of children can be appended without allocating memory
+     * 
+     * The storage grows geometrically, so reserving before every append does not make appending quadratic.
+     * Note that this only concerns the storage of the children themselves: appending a child by reference still gathers its data,
+     * and moving a child into this phase still allocates the node holding it.
+     * 
+     * \param n the number of children
+     */
+    void reserve_children(size_t n) {
+        if(children_.capacity() - children_.size() < n) {
+            UntrackedScope untracked;
+            children_.reserve(std::max(children_.size() + n, 2 * children_.capacity()));
+        }
     }
 
     /**
@@ -186,6 +388,17 @@ public:
     template<size_t I>
     auto const& meter() const { return std::get<I>(meters_); }
 
+    /**
+     * \brief Provides write access to the `I`-th meter as declared
+     * 
+     * This can be used to configure a meter before the phase is started.
+     * 
+     * \tparam I the number of the meter as declared
+     * \return the `I`-th meter
+     */
+    template<size_t I>
+    auto& meter() { return std::get<I>(meters_); }
+
     /**
      * \brief Provides write access to the JSON data storage
      * 
@@ -202,15 +415,12 @@ public:
      * 
      * \return the JSON data
      */
-    nlohmann::json gather_data() const {
+    nlohmann::json gather_data() const& {
+        UntrackedScope untracked;
         nlohmann::json json;
         json[JSON_KEY_NAME] = name_;
 
-        if(!children_.empty()) {
-            auto children = nlohmann::json::array();
-            for(auto& c : children_) children.push_back(c);
-            json[JSON_KEY_CHILDREN] = std::move(children);
-        }
+        gather_children(children_, json);
 
         if constexpr(has_meters()) {
             nlohmann::json metrics;
@@ -225,6 +435,36 @@ public:
         return json;
     }
 
+    /**
+     * \brief Gathers the phase's data in a JSON object, consuming the phase
+     * 
+     * Instead of copying, the name, the data and the children's data are moved into the result.
+     * The format of the object is the same as that of the copying overload.
+     * Afterwards, the phase has neither a name, nor data or children.
+     * 
+     * \return the JSON data
+     */
+    nlohmann::json gather_data() && {
+        UntrackedScope untracked;
+        nlohmann::json json;
+        json[JSON_KEY_NAME] = std::move(name_);
+
+        consume_children(children_, json);
+
+        if constexpr(has_meters()) {
+            nlohmann::json metrics;
+            gather_metrics(metrics);
+            json[JSON_KEY_METRICS] = std::move(metrics);
+        }
+
+        if(!data_.empty()) {
+            json[JSON_KEY_DATA] = std::move(data_);
+            data_ = nlohmann::json();
+        }
+
+        return json;
+    }
+
     /**
      * \brief The name of the phase
      * 
@@ -0,0 +1,184 @@
+/**
+ * pm/phase_child.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_PHASE_CHILD_HPP
+#define _PM_PHASE_CHILD_HPP
+
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <pm/concepts.hpp>
+#include <pm/json.hpp>
+
+namespace pm {
+
+/**
+ * \brief A completed phase that has been moved into its parent, whose data is gathered only when the parent's data is gathered
+ * 
+ * This type-erases the child's phase type, so children can be handed to parents whose types are not known, e.g., by \ref ScopedPhase "scoped phases".
+ */
+struct PhaseChild {
+    virtual ~PhaseChild() {}
+
+    /**
+     * \brief Gathers the child's data
+     * 
+     * \return the child's data, as returned by its `gather_data`
+     */
+    virtual nlohmann::json gather() const = 0;
+
+    /**
+     * \brief Gathers the child's data, consuming the child
+     * 
+     * \return the child's data, as returned by its `gather_data`
+     */
+    virtual nlohmann::json consume() = 0;
+};
+
+/**
+ * \brief A \ref PhaseChild holding a phase of a concrete type
+ * 
+ * This is used for phase types that do not provide a compact `Completed` form (see \ref phase_child_t ), so the entire phase is retained.
+ * 
+ * \tparam T the phase type
+ */
+template<JSONMeasurementPhase T>
+struct OwnedPhaseChild : public PhaseChild {
+    std::optional<T> phase;
+
+    inline OwnedPhaseChild() {}
+    inline OwnedPhaseChild(T&& phase) : phase(std::move(phase)) {}
+
+    /**
+     * \brief Takes over the given completed phase
+     * 
+     * \param p the phase
+     */
+    inline void assign(T&& p) { phase.emplace(std::move(p)); }
+
+    nlohmann::json gather() const override { return phase->gather_data(); }
+    nlohmann::json consume() override { return std::move(*phase).gather_data(); }
+};
+
+/**
+ * \brief The upper bound for the size of trivially copyable meters that are retained as they are by the parent of their phase
+ */
+constexpr size_t MAX_RETAINED_METER_SIZE = 256;
+
+/**
+ * \brief The form in which the values of a completed meter are retained until the data of the parent of its phase is gathered
+ * 
+ * Meters that provide a `snapshot` function, which returns a compact object with the meter's `key` and `gather_metrics` functions,
+ * are retained as that snapshot. Small trivially copyable meters, which consist of nothing but their values, are moved into the retained form as they are.
+ * All other meters, e.g., those holding histograms or tables, are gathered right away, so only their JSON data is retained.
+ * 
+ * \tparam M the meter type
+ */
+template<Meter<nlohmann::json> M>
+class RetainedMeter {
+private:
+    std::string key_;
+    nlohmann::json metrics_;
+
+public:
+    /**
+     * \brief Whether retaining a meter requires no allocations
+     */
+    static constexpr bool compact = false;
+
+    inline RetainedMeter() {}
+    inline RetainedMeter(M const& m) : key_(m.key()), metrics_(m.gather_metrics()) {}
+
+    /**
+     * \brief Gathers the retained values into the given metrics object
+     * 
+     * \param metrics the metrics object
+     */
+    void gather(nlohmann::json& metrics) const { metrics[key_] = metrics_; }
+
+    /**
+     * \brief Gathers the retained values into the given metrics object, consuming them
+     * 
+     * \param metrics the metrics object
+     */
+    void consume(nlohmann::json& metrics) { metrics[std::move(key_)] = std::move(metrics_); }
+};
+
+template<Meter<nlohmann::json> M> requires requires(M const m) { m.snapshot(); }
+class RetainedMeter<M> {
+private:
+    decltype(std::declval<M const&>().snapshot()) snapshot_;
+
+public:
+    static constexpr bool compact = true;
+
+    inline RetainedMeter() : snapshot_() {}
+    inline RetainedMeter(M const& m) : snapshot_(m.snapshot()) {}
+    void gather(nlohmann::json& metrics) const { metrics[snapshot_.key()] = snapshot_.gather_metrics(); }
+    void consume(nlohmann::json& metrics) { gather(metrics); }
+};
+
+template<Meter<nlohmann::json> M> requires (!requires(M const m) { m.snapshot(); } && std::is_trivially_copyable_v<M> && sizeof(M) <= MAX_RETAINED_METER_SIZE)
+class RetainedMeter<M> {
+private:
+    M meter_;
+
+public:
+    static constexpr bool compact = true;
+
+    inline RetainedMeter() : meter_() {}
+    inline RetainedMeter(M&& m) : meter_(std::move(m)) {}
+    void gather(nlohmann::json& metrics) const { metrics[meter_.key()] = meter_.gather_metrics(); }
+    void consume(nlohmann::json& metrics) { gather(metrics); }
+};
+
+/**
+ * \brief The \ref PhaseChild type that a completed phase of the given type is moved into when appended to its parent
+ * 
+ * This is the phase type's `Completed` type if it has one, which retains only what is needed to gather the phase's data later,
+ * or an \ref OwnedPhaseChild retaining the entire phase otherwise.
+ * Either type can be default-constructed ahead of time, e.g., when a \ref ScopedPhase "scoped phase" is entered, and `assign`ed the completed phase.
+ * 
+ * \tparam T the phase type
+ */
+template<JSONMeasurementPhase T>
+struct PhaseChildType {
+    using type = OwnedPhaseChild<T>;
+};
+
+template<JSONMeasurementPhase T> requires requires { typename T::Completed; }
+struct PhaseChildType<T> {
+    using type = typename T::Completed;
+};
+
+template<JSONMeasurementPhase T>
+using phase_child_t = typename PhaseChildType<T>::type;
+
+}
+
+#endif
@@ -0,0 +1,320 @@
+/**
+ * pm/process_memory.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_PROCESS_MEMORY_HPP
+#define _PM_PROCESS_MEMORY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sys/resource.h>
+
+#include <nlohmann/json.hpp>
+#include <pm/malloc/mmap_hook.hpp>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pm {
+
+namespace proc {
+
+// reads a file from procfs into the given buffer without allocating memory and returns the number of bytes read, or zero on failure
+// nb: this issues exactly one read system call, which the kernel accounts in the process's I/O statistics
+template<size_t N>
+inline size_t read_file(char const* path, char (&buf)[N]) {
+    #ifdef __linux__
+    int const fd = ::open(path, O_RDONLY);
+    if(fd < 0) return 0;
+
+    auto const n = ::syscall(SYS_read, fd, buf, N - 1); // nb: bypass the read override of pm-io, so reading procfs is not counted as I/O of the measuring thread
+    ::close(fd);
+    if(n <= 0) return 0;
+    buf[n] = 0;
+    return size_t(n);
+    #else
+    (void)path;
+    (void)buf;
+    return 0;
+    #endif
+}
+
+inline uintmax_t parse_uint(char const*& p) {
+    while(*p == ' ' || *p == '\t') ++p;
+    uintmax_t x = 0;
+    while(*p >= '0' && *p <= '9') x = 10 * x + uintmax_t(*p++ - '0');
+    return x;
+}
+
+}
+
+/**
+ * \brief Reports the current resident set size (RSS) of the process
+ * 
+ * The RSS is read from `/proc/self/statm` without allocating memory.
+ * 
+ * \return the current resident set size in bytes, or zero if it is not available
+ */
+inline uintmax_t resident_set_size() {
+    #ifdef __linux__
+    char buf[128];
+    if(!proc::read_file("/proc/self/statm", buf)) return 0;
+
+    // the second field is the number of resident pages
+    char const* p = buf;
+    proc::parse_uint(p);
+    return proc::parse_uint(p) * (uintmax_t)sysconf(_SC_PAGESIZE);
+    #else
+    return 0;
+    #endif
+}
+
+/**
+ * \brief Reports the peak resident set size of the process
+ * 
+ * The peak is read from `/proc/self/status` (`VmHWM`) without allocating memory.
+ * It refers to the lifetime of the process, unless it has been reset using \ref reset_peak_resident_set_size .
+ * 
+ * \return the peak resident set size in bytes, or zero if it is not available
+ */
+inline uintmax_t peak_resident_set_size() {
+    #ifdef __linux__
+    char buf[4096];
+    if(!proc::read_file("/proc/self/status", buf)) return 0;
+
+    char const* p = std::strstr(buf, "VmHWM:");
+    if(!p) return 0;
+    p += 6;
+    return proc::parse_uint(p) * 1024; // nb: reported in kB
+    #else
+    return 0;
+    #endif
+}
+
+/**
+ * \brief Resets the peak resident set size of the process to the current resident set size
+ * 
+ * This writes to `/proc/self/clear_refs`, which requires Linux 4.0 or later.
+ * Note that this affects the entire process.
+ * 
+ * \return true if the peak has been reset, false otherwise
+ */
+inline bool reset_peak_resident_set_size() {
+    #ifdef __linux__
+    int const fd = ::open("/proc/self/clear_refs", O_WRONLY);
+    if(fd < 0) return false;
+
+    bool const ok = (::write(fd, "5", 1) == 1);
+    ::close(fd);
+    return ok;
+    #else
+    return false;
+    #endif
+}
+
+/**
+ * \brief Measures memory used by the process as seen by the operating system
+ * 
+ * Unlike \ref MallocCounter , this also sees memory that is not allocated via `malloc`, e.g., mapped files or huge pages.
+ * It reports the change of the process's resident set size (RSS) and its peak,
+ * the numbers of minor and major page faults that occurred (via `getrusage`),
+ * and, if the `mmap` overrides are enabled (`PM_MALLOC_MMAP`), the numbers of bytes mapped and unmapped using `mmap` and `munmap`.
+ * All of these figures are process-wide, i.e., they include the activity of other threads.
+ * 
+ * The peak RSS refers to the lifetime of the process by default.
+ * Optionally, it can be reset when starting the measurement using \ref reset_peak_resident_set_size ,
+ * which should not be done if other measurements of the peak are running at the same time, e.g., in enclosing phases.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class ProcessMemory {
+private:
+    struct Snapshot {
+        uintmax_t rss;
+        uintmax_t minor_faults;
+        uintmax_t major_faults;
+        mmap_hook::Totals mmap;
+
+        inline static Snapshot now() {
+            rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+            return { resident_set_size(), uintmax_t(ru.ru_minflt), uintmax_t(ru.ru_majflt), mmap_hook::totals() };
+        }
+    };
+
+    bool reset_peak_;
+    Snapshot start_;
+    intmax_t rss_;
+    uintmax_t peak_;
+    uintmax_t minor_faults_;
+    uintmax_t major_faults_;
+    mmap_hook::Totals mmap_;
+
+public:
+    /**
+     * \brief Constructs a new process memory meter
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     * 
+     * \param reset_peak whether or not to reset the process's peak RSS when the measurement is started
+     */
+    inline ProcessMemory(bool reset_peak = false)
+        : reset_peak_(reset_peak),
+          start_({}),
+          rss_(0),
+          peak_(0),
+          minor_faults_(0),
+          major_faults_(0),
+          mmap_({ 0, 0, 0, 0 }) {
+    }
+
+    ProcessMemory(ProcessMemory const& other) = delete;
+    ProcessMemory(ProcessMemory&& other) = default;
+    ProcessMemory& operator=(ProcessMemory const& other) = delete;
+    ProcessMemory& operator=(ProcessMemory&& other) = default;
+
+    /**
+     * \brief Starts the measurement
+     * 
+     * This will reset all figures to zero.
+     */
+    inline void start() {
+        rss_ = 0;
+        peak_ = 0;
+        minor_faults_ = 0;
+        major_faults_ = 0;
+        mmap_ = { 0, 0, 0, 0 };
+        if(reset_peak_) reset_peak_resident_set_size();
+        resume();
+    }
+
+    /**
+     * \brief Pauses the measurement
+     */
+    inline void pause() {
+        auto const now = Snapshot::now();
+        rss_ += (intmax_t)now.rss - (intmax_t)start_.rss;
+        peak_ = std::max(peak_, peak_resident_set_size());
+        minor_faults_ += now.minor_faults - start_.minor_faults;
+        major_faults_ += now.major_faults - start_.major_faults;
+        mmap_.map_num += now.mmap.map_num - start_.mmap.map_num;
+        mmap_.map_bytes += now.mmap.map_bytes - start_.mmap.map_bytes;
+        mmap_.unmap_num += now.mmap.unmap_num - start_.mmap.unmap_num;
+        mmap_.unmap_bytes += now.mmap.unmap_bytes - start_.mmap.unmap_bytes;
+    }
+
+    /**
+     * \brief Resumes the measurement
+     */
+    inline void resume() {
+        start_ = Snapshot::now();
+    }
+
+    /**
+     * \brief Stops the measurement
+     * 
+     * This is technically equivalent to pausing.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The change of the resident set size in bytes
+     * 
+     * \return the change of the resident set size in bytes
+     */
+    intmax_t rss() const { return rss_; }
+
+    /**
+     * \brief The peak resident set size in bytes
+     * 
+     * \return the peak resident set size in bytes
+     */
+    uintmax_t peak() const { return peak_; }
+
+    /**
+     * \brief The number of minor page faults, which did not require I/O
+     * 
+     * \return the number of minor page faults
+     */
+    uintmax_t minor_faults() const { return minor_faults_; }
+
+    /**
+     * \brief The number of major page faults, which required I/O
+     * 
+     * \return the number of major page faults
+     */
+    uintmax_t major_faults() const { return major_faults_; }
+
+    /**
+     * \brief The numbers of mapped and unmapped bytes
+     * 
+     * These are zero unless the `mmap` overrides are enabled.
+     * 
+     * \return the numbers of mapped and unmapped bytes
+     */
+    mmap_hook::Totals const& mmap() const { return mmap_; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "process_memory"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The `mmap` figures are only reported if the `mmap` overrides are enabled.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["rss"] = rss_;
+        obj["rss_peak"] = peak_;
+        obj["minor_faults"] = minor_faults_;
+        obj["major_faults"] = major_faults_;
+        #ifdef PM_MALLOC_MMAP
+        obj["mmap_num"] = mmap_.map_num;
+        obj["mmap_bytes"] = mmap_.map_bytes;
+        obj["munmap_num"] = mmap_.unmap_num;
+        obj["munmap_bytes"] = mmap_.unmap_bytes;
+        #endif
+        return obj;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,295 @@
+/**
+ * pm/rapl_energy.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_RAPL_ENERGY_HPP
+#define _PM_RAPL_ENERGY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <pm/process_memory.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures the energy consumed by the processor packages and their domains using RAPL counters
+ * 
+ * The counters of Intel's (and AMD's) Running Average Power Limit (RAPL) interface are read from Linux's powercap file system.
+ * Upon construction, every top-level zone (`intel-rapl:N`, e.g., `package-0` or `psys`) and every sub-zone (`intel-rapl:N:M`, e.g., `core`, `uncore` or `dram`)
+ * whose `energy_uj` counter can be read is discovered as a domain, named like `package-0`, `package-0.dram` or `psys`.
+ * Domains that cannot be read, e.g., because the counters are only readable by root, are reported as unavailable.
+ * On systems without RAPL, no domains are discovered and all figures are zero.
+ * 
+ * The counters wrap around at `max_energy_range_uj`. A single wraparound between two reads of a counter is accounted for,
+ * so a measurement should be paused or stopped at least once per wraparound period, which is in the order of minutes under full load.
+ * All figures are system-wide, i.e., they include the energy consumed by all other processes.
+ * 
+ * Alongside the consumed energy in joules, the average power in watts is reported based on the wall time during which the measurement was running.
+ * The total energy covers the package zones (named `package-N`) only, as the sub-zones are usually contained in their package's figure; DRAM, however, may not be.
+ * The platform zone `psys`, found on client processors, already contains the packages' energy, so it is reported as a separate domain only.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class RaplEnergy {
+public:
+    /**
+     * \brief The default root of the powercap file system
+     */
+    static constexpr char const* POWERCAP_ROOT = "/sys/class/powercap";
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Domain {
+        std::string name;
+        std::string path; // of the energy_uj file
+        uint64_t max_range;
+        bool package;
+        uint64_t start;
+        uint64_t energy; // in microjoules
+    };
+
+    std::vector<Domain> domains_;
+    std::vector<std::string> unavailable_;
+    Clock::time_point start_;
+    Clock::duration elapsed_;
+
+    inline static bool read_counter(std::string const& path, uint64_t& value) {
+        char buf[32];
+        if(!proc::read_file(path.c_str(), buf)) return false;
+
+        char const* p = buf;
+        value = proc::parse_uint(p);
+        return true;
+    }
+
+    inline static std::string read_name(std::filesystem::path const& zone) {
+        char buf[64];
+        if(!proc::read_file((zone / "name").c_str(), buf)) return zone.filename().string();
+
+        std::string name(buf);
+        while(!name.empty() && (name.back() == '\n' || name.back() == ' ')) name.pop_back();
+        return name;
+    }
+
+    inline static bool is_zone(std::filesystem::path const& path, size_t depth) {
+        // zones are named like intel-rapl:0 and sub-zones like intel-rapl:0:1; nb: intel-rapl-mmio duplicates the package zones
+        auto const name = path.filename().string();
+        return name.starts_with("intel-rapl:") && (size_t)std::count(name.begin(), name.end(), ':') == depth;
+    }
+
+    inline void add_domain(std::filesystem::path const& zone, std::string&& name, bool package) {
+        auto path = (zone / "energy_uj").string();
+        uint64_t value, max_range;
+        if(read_counter(path, value) && read_counter((zone / "max_energy_range_uj").string(), max_range)) {
+            domains_.push_back({ std::move(name), std::move(path), max_range, package, value, 0 });
+        } else {
+            unavailable_.push_back(std::move(name));
+        }
+    }
+
+    // lists the zones of the given depth in the given directory, ordered, and stops at the first error rather than throwing
+    inline static std::vector<std::filesystem::path> list_zones(std::filesystem::path const& dir, size_t depth) {
+        std::vector<std::filesystem::path> zones;
+        std::error_code ec;
+        for(std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if(is_zone(it->path(), depth)) zones.push_back(it->path());
+        }
+        std::sort(zones.begin(), zones.end());
+        return zones;
+    }
+
+    inline void discover(std::filesystem::path const& root) {
+        for(auto const& zone : list_zones(root, 1)) {
+            // nb: besides packages, there may be top-level zones like psys, which covers the entire platform including the packages
+            auto const name = read_name(zone);
+            add_domain(zone, std::string(name), name.starts_with("package-"));
+
+            for(auto const& sub : list_zones(zone, 2)) add_domain(sub, name + "." + read_name(sub), false);
+        }
+    }
+
+    inline uint64_t package_energy() const {
+        uint64_t total = 0;
+        for(auto const& d : domains_) {
+            if(d.package) total += d.energy;
+        }
+        return total;
+    }
+
+    inline double power(uint64_t energy) const {
+        double const secs = std::chrono::duration<double>(elapsed_).count();
+        return secs > 0.0 ? 1e-6 * (double)energy / secs : 0.0;
+    }
+
+public:
+    /**
+     * \brief Constructs a new energy meter, discovering the available RAPL domains
+     * 
+     * Note that this does \em not start the measurement; \ref start must be called manually.
+     * 
+     * \param root the root of the powercap file system
+     */
+    inline RaplEnergy(std::string const& root = POWERCAP_ROOT) : elapsed_(0) {
+        discover(root);
+    }
+
+    RaplEnergy(RaplEnergy const& other) = delete;
+    RaplEnergy(RaplEnergy&& other) = default;
+    RaplEnergy& operator=(RaplEnergy const& other) = delete;
+    RaplEnergy& operator=(RaplEnergy&& other) = default;
+
+    /**
+     * \brief Starts the measurement
+     * 
+     * This will reset all figures to zero.
+     */
+    inline void start() {
+        for(auto& d : domains_) d.energy = 0;
+        elapsed_ = Clock::duration(0);
+        resume();
+    }
+
+    /**
+     * \brief Pauses the measurement
+     */
+    inline void pause() {
+        for(auto& d : domains_) {
+            uint64_t now;
+            if(!read_counter(d.path, now)) continue;
+            // nb: the counter ranges over [0, max_range], so a wraparound from max_range to zero is one more step
+            d.energy += (now >= d.start) ? (now - d.start) : (d.max_range - d.start + now + 1);
+        }
+        elapsed_ += Clock::now() - start_;
+    }
+
+    /**
+     * \brief Resumes the measurement
+     */
+    inline void resume() {
+        for(auto& d : domains_) read_counter(d.path, d.start);
+        start_ = Clock::now();
+    }
+
+    /**
+     * \brief Stops the measurement
+     * 
+     * This is technically equivalent to pausing.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The number of discovered domains
+     * 
+     * \return the number of discovered domains
+     */
+    size_t num_domains() const { return domains_.size(); }
+
+    /**
+     * \brief The name of the given domain
+     * 
+     * \param i the index of the domain
+     * \return the name of the domain
+     */
+    std::string const& name(size_t i) const { return domains_[i].name; }
+
+    /**
+     * \brief The energy consumed in the given domain
+     * 
+     * \param i the index of the domain
+     * \return the energy consumed in joules
+     */
+    double joules(size_t i) const { return 1e-6 * (double)domains_[i].energy; }
+
+    /**
+     * \brief The average power drawn in the given domain
+     * 
+     * \param i the index of the domain
+     * \return the average power in watts
+     */
+    double watts(size_t i) const { return power(domains_[i].energy); }
+
+    /**
+     * \brief The energy consumed by all packages
+     * 
+     * \return the energy consumed in joules
+     */
+    double joules() const { return 1e-6 * (double)package_energy(); }
+
+    /**
+     * \brief The average power drawn by all packages
+     * 
+     * \return the average power in watts
+     */
+    double watts() const { return power(package_energy()); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "energy"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The total energy and power of all packages are reported as `joules` and `watts`,
+     * and those of every domain in an object under the domain's name in `domains`.
+     * The names of domains that could not be read are listed as `unavailable`.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        nlohmann::json obj;
+        obj["joules"] = joules();
+        obj["watts"] = watts();
+
+        auto domains = nlohmann::json::object();
+        for(size_t i = 0; i < domains_.size(); i++) {
+            nlohmann::json d;
+            d["joules"] = joules(i);
+            d["watts"] = watts(i);
+            domains[domains_[i].name] = std::move(d);
+        }
+        obj["domains"] = std::move(domains);
+
+        if(!unavailable_.empty()) obj["unavailable"] = unavailable_;
+        return obj;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,415 @@
+/**
+ * pm/record_log.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_RECORD_LOG_HPP
+#define _PM_RECORD_LOG_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pm/concepts.hpp>
+#include <pm/json.hpp>
+#include <pm/result.hpp>
+#include <pm/scoped_phase.hpp>
+
+namespace pm {
+
+/**
+ * \brief The magic bytes at the beginning of every record log file
+ */
+constexpr char RECORD_LOG_MAGIC[8] = { 'P', 'M', 'L', 'O', 'G', 0, 0, 1 };
+
+/**
+ * \brief The types of records in a record log
+ */
+enum class RecordType : uint8_t {
+    /**
+     * \brief The data of a phase, as returned by \ref Phase::gather_data
+     */
+    phase = 'P',
+
+    /**
+     * \brief The key-value pairs of a \ref Result , as returned by \ref Result::to_json_pairs
+     */
+    result = 'R'
+};
+
+/**
+ * \brief Appends measurement records to a binary log file as they complete
+ * 
+ * Every record is encoded in <a href="https://cbor.io/">CBOR</a>, which is considerably more compact and faster to produce than JSON text.
+ * Each record is preceded by a one-byte \ref RecordType "type" and its length as a 32-bit little-endian integer, so a reader that encounters a truncated record,
+ * e.g., because the writing process was killed, can simply stop there.
+ * The file begins with \ref RECORD_LOG_MAGIC .
+ * Records are written through a `FILE` buffer, so \ref flush must be called to make sure they have reached the file before it is closed.
+ * 
+ * Writing records is thread-safe.
+ * The log can be converted back into JSON or `RESULT` lines using \ref RecordReader or the `pm-convert` tool.
+ */
+class RecordWriter {
+private:
+    std::FILE* file_;
+    std::vector<uint8_t> buffer_;
+    std::mutex mutex_;
+    bool failed_ = false; // sticky, so failures in destructors of scoped phases are reported by flush
+
+    inline void write_record(RecordType type, nlohmann::json const& record) {
+        std::lock_guard lock(mutex_);
+
+        buffer_.resize(5);
+        nlohmann::json::to_cbor(record, buffer_); // nb: appends
+
+        uint32_t const len = uint32_t(buffer_.size() - 5);
+        buffer_[0] = uint8_t(type);
+        for(size_t i = 0; i < 4; i++) buffer_[1 + i] = uint8_t(len >> (8 * i));
+
+        if(std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+            failed_ = true;
+            throw std::runtime_error("failed to write record");
+        }
+    }
+
+public:
+    /**
+     * \brief Opens the given file for appending records
+     * 
+     * If the file does not exist or is empty, it is initialized with \ref RECORD_LOG_MAGIC .
+     * 
+     * \param path the path to the log file
+     * \throws std::runtime_error if the file cannot be opened or initialized
+     */
+    inline RecordWriter(std::string const& path) {
+        file_ = std::fopen(path.c_str(), "ab");
+        if(!file_) throw std::runtime_error("failed to open record log for writing: " + path);
+
+        std::fseek(file_, 0, SEEK_END);
+        if(std::ftell(file_) == 0 && std::fwrite(RECORD_LOG_MAGIC, 1, sizeof(RECORD_LOG_MAGIC), file_) != sizeof(RECORD_LOG_MAGIC)) {
+            std::fclose(file_);
+            throw std::runtime_error("failed to initialize record log: " + path);
+        }
+    }
+
+    inline ~RecordWriter() {
+        std::fclose(file_);
+    }
+
+    RecordWriter(RecordWriter const&) = delete;
+    RecordWriter(RecordWriter&&) = delete;
+    RecordWriter& operator=(RecordWriter const&) = delete;
+    RecordWriter& operator=(RecordWriter&&) = delete;
+
+    /**
+     * \brief Appends the data of a phase
+     * 
+     * \param data the phase data, as returned by \ref Phase::gather_data
+     * \throws std::runtime_error if the record cannot be written
+     */
+    inline void write_phase_data(nlohmann::json const& data) {
+        write_record(RecordType::phase, data);
+    }
+
+    /**
+     * \brief Appends the data of a phase
+     * 
+     * If the phase is passed as an rvalue, its data is gathered by consuming it.
+     * 
+     * \tparam T the phase type; supports any \ref pm::JSONMeasurementPhase "JSON measurement phase"
+     * \param phase the phase
+     * \throws std::runtime_error if the record cannot be written
+     */
+    template<typename T> requires JSONMeasurementPhase<std::remove_cvref_t<T>>
+    void write(T&& phase) {
+        write_phase_data(std::forward<T>(phase).gather_data());
+    }
+
+    /**
+     * \brief Appends the key-value pairs of a result
+     * 
+     * \param result the result
+     * \throws std::runtime_error if the record cannot be written
+     */
+    inline void write(Result const& result) {
+        write_record(RecordType::result, result.to_json_pairs());
+    }
+
+    /**
+     * \brief Flushes all written records to the file
+     * 
+     * \throws std::runtime_error if the records cannot be written, or if writing any record has failed before
+     */
+    inline void flush() {
+        std::lock_guard lock(mutex_);
+        if(std::fflush(file_) != 0) failed_ = true;
+        if(failed_) throw std::runtime_error("failed to write records");
+    }
+};
+
+/**
+ * \brief Writes the data of every scoped phase that ends within the scope of this guard as a record
+ * 
+ * This is the root of a \ref ScopedPhase hierarchy on the current thread.
+ * Instead of collecting the data of completed top-level scoped phases, each is appended to a \ref RecordWriter as one record right away,
+ * so the sequence of top-level phases, e.g., one per request, never has to be held in memory.
+ * 
+ * Note that only top-level phases are streamed: every record is the complete subtree of a top-level phase,
+ * which is held in memory by that phase until it ends. Hence, memory is bounded by the largest subtree, not by the length of the log.
+ * To stream at a finer granularity, open the record scope deeper in the call tree.
+ */
+class RecordScope : public ScopedPhaseNode {
+private:
+    RecordWriter* writer_;
+
+public:
+    /**
+     * \brief Starts writing completed top-level scoped phases to the given writer
+     * 
+     * \param writer the writer
+     */
+    inline RecordScope(RecordWriter& writer) : ScopedPhaseNode(), writer_(&writer) {
+    }
+
+    void append_child_data(nlohmann::json&& child) override {
+        writer_->write_phase_data(child);
+    }
+
+    void append_child(std::unique_ptr<PhaseChild>&& child) override {
+        writer_->write_phase_data(child->consume());
+    }
+
+    void reserve_child() override {
+        // children are written right away rather than stored
+    }
+};
+
+/**
+ * \brief Reads records from a binary log file written by \ref RecordWriter
+ */
+class RecordReader {
+private:
+    std::FILE* file_;
+    std::vector<uint8_t> buffer_;
+
+public:
+    /**
+     * \brief Opens the given log file for reading
+     * 
+     * \param path the path to the log file
+     * \throws std::runtime_error if the file cannot be opened or is not a record log
+     */
+    inline RecordReader(std::string const& path) {
+        file_ = std::fopen(path.c_str(), "rb");
+        if(!file_) throw std::runtime_error("failed to open record log for reading: " + path);
+
+        char magic[sizeof(RECORD_LOG_MAGIC)];
+        if(std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) || std::memcmp(magic, RECORD_LOG_MAGIC, sizeof(magic)) != 0) {
+            std::fclose(file_);
+            throw std::runtime_error("not a record log: " + path);
+        }
+    }
+
+    inline ~RecordReader() {
+        std::fclose(file_);
+    }
+
+    RecordReader(RecordReader const&) = delete;
+    RecordReader(RecordReader&&) = delete;
+    RecordReader& operator=(RecordReader const&) = delete;
+    RecordReader& operator=(RecordReader&&) = delete;
+
+    /**
+     * \brief Reads the next record
+     * 
+     * \param type receives the type of the record
+     * \param record receives the decoded record
+     * \return true if a record has been read, false if the end of the log has been reached or the record is truncated
+     */
+    inline bool next(RecordType& type, nlohmann::json& record) {
+        uint8_t frame[5];
+        if(std::fread(frame, 1, sizeof(frame), file_) != sizeof(frame)) return false;
+
+        uint32_t len = 0;
+        for(size_t i = 0; i < 4; i++) len |= uint32_t(frame[1 + i]) << (8 * i);
+
+        buffer_.resize(len);
+        if(std::fread(buffer_.data(), 1, len, file_) != len) return false;
+
+        type = RecordType(frame[0]);
+        record = nlohmann::json::from_cbor(buffer_);
+        return true;
+    }
+};
+
+/**
+ * \brief Converts all records of a log into JSON, printing one compact JSON document per line
+ * 
+ * \param reader the log reader
+ * \param out the output stream
+ */
+inline void convert_records_to_json(RecordReader& reader, std::ostream& out) {
+    RecordType type;
+    nlohmann::json record;
+    while(reader.next(type, record)) {
+        out << record.dump() << '\n';
+    }
+}
+
+/**
+ * \brief Converts all records of a log into `RESULT` lines
+ * 
+ * Phase records are unfolded as by \ref Result::add .
+ * 
+ * \param reader the log reader
+ * \param out the output stream
+ */
+inline void convert_records_to_result(RecordReader& reader, std::ostream& out) {
+    RecordType type;
+    nlohmann::json record;
+    while(reader.next(type, record)) {
+        Result r;
+        if(type == RecordType::phase) {
+            r.add_phase_data(record);
+        } else {
+            r = Result::from_json(record);
+        }
+        r.print(out);
+    }
+}
+
+/**
+ * \brief Loads results from text in any of the output formats of pm
+ * 
+ * The text may contain `RESULT` lines, one JSON document of phase data, a JSON array of such documents,
+ * or one compact JSON document per line, as printed by \ref convert_records_to_json .
+ * JSON arrays of `[key, value]` pairs are loaded as results, as returned by \ref Result::to_json_pairs .
+ * Phase data is unfolded as by \ref Result::add , and lines that are neither `RESULT` lines nor JSON are ignored,
+ * so the output of a benchmark can be loaded directly.
+ * 
+ * \param in the input stream
+ * \return the loaded results
+ */
+inline std::vector<Result> load_results(std::istream& in) {
+    std::vector<Result> results;
+    auto const add_phase_data = [&](nlohmann::json const& data){
+        Result r;
+        r.add_phase_data(data);
+        results.push_back(std::move(r));
+    };
+
+    // an array of [key, value] pairs is a result record, any other array is a list of phase data
+    auto const is_result = [](nlohmann::json const& doc){
+        return doc.is_array() && (doc.empty() || doc.front().is_array());
+    };
+
+    std::string const text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    auto const begin = text.find_first_not_of(" \t\r\n");
+    if(begin != std::string::npos && (text[begin] == '{' || text[begin] == '[')) {
+        auto const doc = nlohmann::json::parse(text, nullptr, false);
+        if(doc.is_object()) {
+            add_phase_data(doc);
+            return results;
+        } else if(is_result(doc)) {
+            results.push_back(Result::from_json(doc));
+            return results;
+        } else if(doc.is_array()) {
+            for(auto const& data : doc) add_phase_data(data);
+            return results;
+        }
+    }
+
+    std::istringstream lines(text);
+    std::string line;
+    while(std::getline(lines, line)) {
+        auto const first = line.find_first_not_of(" \t\r");
+        if(first == std::string::npos) continue;
+
+        if(line[first] == '{' || line[first] == '[') {
+            // log output such as "[info] ..." or a line of pretty-printed JSON is not a document and skipped
+            auto const doc = nlohmann::json::parse(line.begin() + first, line.end(), nullptr, false);
+            if(doc.is_object()) {
+                add_phase_data(doc);
+            } else if(is_result(doc)) {
+                results.push_back(Result::from_json(doc));
+            }
+        } else if(line.compare(first, 7, "RESULT ") == 0) {
+            results.push_back(Result::parse(line.substr(first)));
+        }
+    }
+    return results;
+}
+
+/**
+ * \brief Loads results from a file in any of the output formats of pm
+ * 
+ * The file may be a record log, in which every record is loaded as one result, or text as described for \ref load_results(std::istream&) .
+ * 
+ * \param path the path to the file
+ * \return the loaded results
+ * \throws std::runtime_error if the file cannot be opened
+ */
+inline std::vector<Result> load_results(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) throw std::runtime_error("failed to open results for reading: " + path);
+
+    char magic[sizeof(RECORD_LOG_MAGIC)];
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, RECORD_LOG_MAGIC, sizeof(magic)) != 0) {
+        in.clear();
+        in.seekg(0);
+        return load_results(in);
+    }
+    in.close();
+
+    std::vector<Result> results;
+    RecordReader reader(path);
+    RecordType type;
+    nlohmann::json record;
+    while(reader.next(type, record)) {
+        Result r;
+        if(type == RecordType::phase) {
+            r.add_phase_data(record);
+        } else {
+            r = Result::from_json(record);
+        }
+        results.push_back(std::move(r));
+    }
+    return results;
+}
+
+}
+
+#endif
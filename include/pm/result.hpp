@@ -29,8 +29,11 @@
 #define _PM_RESULT_HPP
 
 #include <algorithm>
+#include <charconv>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -64,16 +67,27 @@ namespace pm {
  * \endcode
  */
 class Result {
-private:
-    inline static std::string append_key(std::string const& key_prefix, std::string const& key) {
-        return key_prefix.empty() ? key : (key_prefix + "." + key);
-    }
-
+public:
+    /**
+     * \brief A key-value pair as it is printed
+     */
     struct KeyValuePair {
+        /**
+         * \brief The key
+         */
         std::string key;
+
+        /**
+         * \brief The value
+         */
         std::string value;
     };
 
+private:
+    inline static std::string append_key(std::string const& key_prefix, std::string const& key) {
+        return key_prefix.empty() ? key : (key_prefix + "." + key);
+    }
+
     std::vector<KeyValuePair> pairs_;
 
     inline void add_pairs_recursive(std::string const& key_prefix, nlohmann::json const& data) {
@@ -226,6 +240,17 @@ public:
         add_phase_data("", phase.gather_data());
     }
 
+    /**
+     * \brief Adds all the data of a \ref Phase that has already been gathered
+     * 
+     * This works like \ref add for phases.
+     * 
+     * \param data the data of a \ref Phase , as returned by \ref Phase::gather_data
+     */
+    inline void add_phase_data(nlohmann::json const& data) {
+        add_phase_data("", data);
+    }
+
     /**
      * \brief Sorts the currently stored key-value pairs by their keys
      */
@@ -250,6 +275,101 @@ public:
         if(append_newline) out << std::endl;
     }
 
+    /**
+     * \brief Converts the stored key-value pairs into a JSON object
+     * 
+     * The values are stored as strings, exactly as they would be printed.
+     * If a key occurs multiple times, the last value is kept.
+     * 
+     * \return the key-value pairs as a JSON object
+     */
+    inline nlohmann::json to_json() const {
+        nlohmann::json obj = nlohmann::json::object();
+        for(auto& pair : pairs_) obj[pair.key] = pair.value;
+        return obj;
+    }
+
+    /**
+     * \brief Converts the stored key-value pairs into a JSON array of `[key, value]` pairs
+     * 
+     * As opposed to \ref to_json , this keeps the order of the pairs as well as repeated keys, so \ref from_json restores the exact result.
+     * 
+     * \return the key-value pairs as a JSON array
+     */
+    inline nlohmann::json to_json_pairs() const {
+        auto arr = nlohmann::json::array();
+        for(auto& pair : pairs_) arr.push_back({ pair.key, pair.value });
+        return arr;
+    }
+
+    /**
+     * \brief Restores a result from JSON
+     * 
+     * \param json either a JSON array of `[key, value]` pairs as returned by \ref to_json_pairs , or a JSON object as returned by \ref to_json
+     * \return the result
+     * \throws std::invalid_argument if the JSON is neither
+     */
+    inline static Result from_json(nlohmann::json const& json) {
+        Result r;
+        if(json.is_array()) {
+            for(auto const& pair : json) {
+                if(!pair.is_array() || pair.size() != 2) throw std::invalid_argument("not a key-value pair: " + pair.dump());
+                r.add(pair[0].get<std::string>(), pair[1]);
+            }
+        } else if(json.is_object()) {
+            for(auto const& item : json.items()) r.add(std::string(item.key()), item.value());
+        } else {
+            throw std::invalid_argument("not a result: " + json.dump());
+        }
+        return r;
+    }
+
+    /**
+     * \brief Provides access to the stored key-value pairs in the order in which they were added (or sorted)
+     * 
+     * \return the key-value pairs
+     */
+    inline std::vector<KeyValuePair> const& pairs() const { return pairs_; }
+
+    /**
+     * \brief Parses a line printed by \ref print
+     * 
+     * The line must begin with the prefix, followed by space-separated `key=value` pairs.
+     * Every value is split from its key at the first `=` character.
+     * 
+     * \param line the line
+     * \param prefix the line prefix; `RESULT` by default
+     * \return the parsed key-value pairs
+     * \throws std::invalid_argument if the line does not begin with the prefix or contains a string that is not a key-value pair
+     */
+    inline static Result parse(std::string const& line, std::string const& prefix = "RESULT") {
+        std::istringstream in(line);
+        std::string token;
+        if(!(in >> token) || token != prefix) throw std::invalid_argument("not a result line: " + line);
+
+        Result r;
+        while(in >> token) {
+            auto const eq = token.find('=');
+            if(eq == std::string::npos) throw std::invalid_argument("not a key-value pair: " + token);
+            r.pairs_.emplace_back(token.substr(0, eq), token.substr(eq + 1));
+        }
+        return r;
+    }
+
+    /**
+     * \brief Parses a value of a key-value pair as a number
+     * 
+     * \param value the value
+     * \return the number, or nothing if the entire value is not a number
+     */
+    inline static std::optional<double> parse_number(std::string const& value) {
+        double x;
+        auto const end = value.data() + value.size();
+        auto const r = std::from_chars(value.data(), end, x);
+        if(r.ec != std::errc() || r.ptr != end) return std::nullopt;
+        return x;
+    }
+
     /**
      * \brief Prints a result line into a string using \ref print
      * 
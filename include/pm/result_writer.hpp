@@ -0,0 +1,369 @@
+/**
+ * pm/result_writer.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_RESULT_WRITER_HPP
+#define _PM_RESULT_WRITER_HPP
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace pm {
+
+/**
+ * \brief The output formats of a \ref ResultWriter
+ */
+enum class ResultFormat {
+    /**
+     * \brief `RESULT` lines as printed by \ref Result::print
+     */
+    result,
+
+    /**
+     * \brief Comma-separated values with a header line
+     * 
+     * String values are quoted as described in RFC 4180 if necessary.
+     */
+    csv,
+
+    /**
+     * \brief Tab-separated values with a header line
+     * 
+     * Tabs and line breaks in string values are replaced by spaces.
+     */
+    tsv
+};
+
+/**
+ * \brief Writes many results with the same keys as rows of a table
+ * 
+ * As opposed to \ref Result, which stores every key and value as a string and is thus convenient for printing single results,
+ * the writer is intended for large parameter sweeps that report the same keys for millions of configurations.
+ * The keys are registered once as columns before the first row is written, and values are stored natively in the cells of the current row.
+ * Rows are formatted using `std::to_chars` into a reused buffer that is written to the output stream whenever it exceeds its capacity,
+ * so writing a row does not allocate memory once string cells have reached their final capacity.
+ * 
+ * The following is an example use case:
+ * \code{cpp}
+ * ResultWriter w(std::cout, ResultFormat::csv);
+ * auto const n = w.column("n");
+ * auto const time = w.column("time");
+ * for(size_t i = 0; i < 1'000'000; i++) {
+ *     w.set(n, i);
+ *     w.set(time, measure(i));
+ *     w.write_row();
+ * }
+ * \endcode
+ * 
+ * Cells that are not set for a row are written as empty fields in CSV and TSV, and omitted from `RESULT` lines.
+ */
+class ResultWriter {
+private:
+    enum class CellType : uint8_t { empty, boolean, sint, uint, real32, real, string };
+
+    struct Cell {
+        CellType type = CellType::empty;
+        union {
+            bool b;
+            int64_t i;
+            uint64_t u;
+            float f;
+            double d;
+        };
+        std::string s;
+    };
+
+    std::ostream* out_;
+    ResultFormat format_;
+    std::string prefix_;
+    size_t capacity_;
+    std::vector<std::string> columns_;
+    std::vector<Cell> row_;
+    std::string buffer_;
+    size_t num_rows_;
+
+    template<typename T>
+    inline void append_number(T value) {
+        char tmp[32];
+        auto const r = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        buffer_.append(tmp, r.ptr);
+    }
+
+    inline void append_string(std::string_view s) {
+        if(format_ == ResultFormat::csv && s.find_first_of(",\"\r\n") != std::string_view::npos) {
+            buffer_.push_back('"');
+            for(auto const c : s) {
+                if(c == '"') buffer_.push_back('"');
+                buffer_.push_back(c);
+            }
+            buffer_.push_back('"');
+        } else if(format_ == ResultFormat::tsv) {
+            for(auto const c : s) buffer_.push_back((c == '\t' || c == '\r' || c == '\n') ? ' ' : c);
+        } else {
+            buffer_.append(s);
+        }
+    }
+
+    inline void append_cell(Cell const& cell) {
+        switch(cell.type) {
+            case CellType::empty: break;
+            case CellType::boolean: buffer_.append(cell.b ? "true" : "false"); break;
+            case CellType::sint: append_number(cell.i); break;
+            case CellType::uint: append_number(cell.u); break;
+            case CellType::real32: append_number(cell.f); break;
+            case CellType::real: append_number(cell.d); break;
+            case CellType::string: append_string(cell.s); break;
+        }
+    }
+
+    inline char separator() const {
+        return format_ == ResultFormat::tsv ? '\t' : ',';
+    }
+
+    inline void write_header() {
+        for(size_t i = 0; i < columns_.size(); i++) {
+            if(i > 0) buffer_.push_back(separator());
+            append_string(columns_[i]);
+        }
+        buffer_.push_back('\n');
+    }
+
+    inline Cell& cell(size_t col) {
+        if(col >= row_.size()) throw std::out_of_range("invalid column: " + std::to_string(col));
+        return row_[col];
+    }
+
+public:
+    /**
+     * \brief The default capacity of the output buffer in bytes
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 1ULL << 16;
+
+    /**
+     * \brief Constructs a writer without columns
+     * 
+     * \param out the output stream to write to
+     * \param format the output format
+     * \param capacity the capacity of the output buffer in bytes
+     * \param prefix the line prefix for the \ref ResultFormat::result "RESULT" format; `RESULT` by default
+     */
+    inline ResultWriter(std::ostream& out = std::cout, ResultFormat format = ResultFormat::result, size_t capacity = DEFAULT_CAPACITY, std::string const& prefix = "RESULT")
+        : out_(&out), format_(format), prefix_(prefix), capacity_(capacity), num_rows_(0) {
+        buffer_.reserve(capacity_);
+    }
+
+    /**
+     * \brief Flushes the output buffer
+     */
+    inline ~ResultWriter() {
+        flush();
+    }
+
+    ResultWriter(ResultWriter const&) = delete;
+    ResultWriter& operator=(ResultWriter const&) = delete;
+    ResultWriter(ResultWriter&&) = default;
+
+    /**
+     * \brief Flushes the output buffer, then takes over the given writer
+     * 
+     * \param other the writer to take over
+     */
+    inline ResultWriter& operator=(ResultWriter&& other) {
+        if(this != &other) {
+            flush();
+            out_ = other.out_;
+            format_ = other.format_;
+            prefix_ = std::move(other.prefix_);
+            capacity_ = other.capacity_;
+            columns_ = std::move(other.columns_);
+            row_ = std::move(other.row_);
+            buffer_ = std::move(other.buffer_);
+            num_rows_ = other.num_rows_;
+            other.buffer_.clear(); // nb: the source still flushes its stream on destruction
+        }
+        return *this;
+    }
+
+    /**
+     * \brief Registers a column
+     * 
+     * All columns must be registered before the first row is written.
+     * 
+     * \param key the key of the column
+     * \return the index of the column, to be used when setting values
+     * \throws std::logic_error if a row has already been written
+     */
+    inline size_t column(std::string const& key) {
+        if(num_rows_ > 0) throw std::logic_error("cannot register columns after writing rows");
+        columns_.push_back(key);
+        row_.emplace_back();
+        return columns_.size() - 1;
+    }
+
+    /**
+     * \brief Sets a boolean value in the current row
+     * 
+     * The value will be formatted to `true` or `false` (in all lower-case), respectively.
+     * 
+     * \param col the column index
+     * \param value the value
+     */
+    inline void set(size_t col, bool value) {
+        auto& c = cell(col);
+        c.type = CellType::boolean;
+        c.b = value;
+    }
+
+    /**
+     * \brief Sets an integral value in the current row
+     * 
+     * \tparam T the value type, required to be integral
+     * \param col the column index
+     * \param value the value
+     */
+    template<std::integral T>
+    void set(size_t col, T value) {
+        auto& c = cell(col);
+        if constexpr(std::is_signed_v<T>) {
+            c.type = CellType::sint;
+            c.i = value;
+        } else {
+            c.type = CellType::uint;
+            c.u = value;
+        }
+    }
+
+    /**
+     * \brief Sets a floating point value in the current row
+     * 
+     * The value is formatted in the shortest representation that reads back to the same value of type `T`.
+     * 
+     * \tparam T the value type, required to be floating point
+     * \param col the column index
+     * \param value the value
+     */
+    template<std::floating_point T>
+    void set(size_t col, T value) {
+        auto& c = cell(col);
+        if constexpr(std::is_same_v<T, float>) {
+            c.type = CellType::real32;
+            c.f = value;
+        } else {
+            c.type = CellType::real;
+            c.d = (double)value;
+        }
+    }
+
+    /**
+     * \brief Sets a string value in the current row
+     * 
+     * The string is copied into the cell, whose memory is reused for the following rows.
+     * In the \ref ResultFormat::result "RESULT" format, the string value will not be processed in any way and may cause the output line's format to be violated if it contains characters such as spaces, `=` or newlines.
+     * 
+     * \param col the column index
+     * \param value the value
+     */
+    inline void set(size_t col, std::string_view value) {
+        auto& c = cell(col);
+        c.type = CellType::string;
+        c.s.assign(value);
+    }
+
+    /**
+     * \brief Sets a string value in the current row
+     * 
+     * \param col the column index
+     * \param value the value
+     */
+    inline void set(size_t col, char const* value) {
+        set(col, std::string_view(value));
+    }
+
+    /**
+     * \brief Writes the current row and clears its cells
+     * 
+     * Before the first row, the header line is written for the \ref ResultFormat::csv "CSV" and \ref ResultFormat::tsv "TSV" formats.
+     */
+    inline void write_row() {
+        if(format_ == ResultFormat::result) {
+            buffer_.append(prefix_);
+            for(size_t i = 0; i < row_.size(); i++) {
+                if(row_[i].type == CellType::empty) continue;
+                buffer_.push_back(' ');
+                buffer_.append(columns_[i]);
+                buffer_.push_back('=');
+                append_cell(row_[i]);
+            }
+        } else {
+            if(num_rows_ == 0) write_header();
+            for(size_t i = 0; i < row_.size(); i++) {
+                if(i > 0) buffer_.push_back(separator());
+                append_cell(row_[i]);
+            }
+        }
+        buffer_.push_back('\n');
+
+        for(auto& c : row_) c.type = CellType::empty;
+        ++num_rows_;
+        if(buffer_.size() >= capacity_) flush();
+    }
+
+    /**
+     * \brief Writes the output buffer to the output stream
+     */
+    inline void flush() {
+        if(!buffer_.empty()) {
+            out_->write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+        out_->flush();
+    }
+
+    /**
+     * \brief Reports the number of registered columns
+     * 
+     * \return the number of registered columns
+     */
+    size_t num_columns() const { return columns_.size(); }
+
+    /**
+     * \brief Reports the number of rows written so far
+     * 
+     * \return the number of rows written so far
+     */
+    size_t num_rows() const { return num_rows_; }
+};
+
+}
+
+#endif
@@ -0,0 +1,248 @@
+/**
+ * pm/scoped_phase.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_SCOPED_PHASE_HPP
+#define _PM_SCOPED_PHASE_HPP
+
+#include <cassert>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <pm/concepts.hpp>
+#include <pm/json.hpp>
+#include <pm/phase_child.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief Base for \ref ScopedPhase "scoped phases" that maintains the thread-local stack of active scoped phases
+ * 
+ * The stack is intrusive: every node only stores a pointer to its parent, and the innermost node is kept in a thread-local variable.
+ * Thus, maintaining the stack never allocates memory. Nodes must be destroyed in the reverse order of their construction,
+ * which is checked by an assertion in debug builds.
+ */
+class ScopedPhaseNode {
+private:
+    inline static ScopedPhaseNode*& top() {
+        thread_local ScopedPhaseNode* top = nullptr;
+        return top;
+    }
+
+    ScopedPhaseNode* parent_;
+
+protected:
+    inline ScopedPhaseNode() : parent_(top()) {
+        top() = this;
+    }
+
+    inline ~ScopedPhaseNode() {
+        assert(top() == this && "scoped phases must be left in the reverse order in which they were entered");
+        top() = parent_;
+    }
+
+    /**
+     * \brief The enclosing scoped phase on the current thread, if any
+     * 
+     * \return the enclosing scoped phase, or `nullptr` if there is none
+     */
+    ScopedPhaseNode* parent() const { return parent_; }
+
+public:
+    ScopedPhaseNode(ScopedPhaseNode const&) = delete;
+    ScopedPhaseNode(ScopedPhaseNode&&) = delete;
+    ScopedPhaseNode& operator=(ScopedPhaseNode const&) = delete;
+    ScopedPhaseNode& operator=(ScopedPhaseNode&&) = delete;
+
+    /**
+     * \brief The innermost active scoped phase on the current thread
+     * 
+     * \return the innermost active scoped phase, or `nullptr` if there is none
+     */
+    inline static ScopedPhaseNode* current() { return top(); }
+
+    /**
+     * \brief Appends the given data of a completed child phase
+     * 
+     * \param child the child phase's data
+     */
+    virtual void append_child_data(nlohmann::json&& child) = 0;
+
+    /**
+     * \brief Appends the given completed child phase, whose data has not been gathered yet
+     * 
+     * \param child the child phase
+     */
+    virtual void append_child(std::unique_ptr<PhaseChild>&& child) = 0;
+
+    /**
+     * \brief Makes sure that the next child can be appended without allocating memory, if possible
+     * 
+     * This is called when a child scope is entered, so that leaving it does not have to allocate.
+     */
+    virtual void reserve_child() = 0;
+};
+
+/**
+ * \brief A guard that measures a phase for the lifetime of a scope and attaches it to the enclosing scoped phase
+ * 
+ * The phase is started on construction and stopped on destruction.
+ * Scoped phases form a hierarchy on every thread:
+ * when a scoped phase is destroyed, after stopping its meters, it is appended as a child of the innermost enclosing scoped phase on the same thread.
+ * A phase owned by the guard is moved into the parent, so its data is not gathered before the data of the root of the hierarchy is gathered;
+ * only the data of a phase owned by the application is gathered right away.
+ * Hence, deep call trees can be instrumented without passing parent phases around.
+ * 
+ * Entering a scope that has a parent allocates the node that will hold the child phase in its parent and reserves a slot for it in the parent,
+ * before the phase is started. Both are allocated untracked, so they are not counted by any meter, but their running time is part of the parent's measurement.
+ * Leaving the scope then moves the phase into that node, which does not allocate memory if the phase type retains its meters compactly
+ * (see \ref Phase::Completed ). Only the data of a phase owned by the application is gathered, untracked, when its scope is left.
+ * 
+ * Leaving a scope never throws: if the child cannot be appended to its parent, e.g., because memory is exhausted or the parent
+ * is a \ref RecordScope whose record cannot be written, the child is dropped.
+ * 
+ * The guard either owns its phase, or it wraps a phase owned by the application, typically the root of the hierarchy,
+ * whose data can then be gathered after the scope has been left.
+ * 
+ * For phases that have neither meters nor data, such as \ref NoopPhase , the guard does nothing and should be completely optimized away.
+ * 
+ * \tparam P the phase type
+ */
+template<MeasurementPhase P>
+class ScopedPhase : public ScopedPhaseNode {
+    static_assert(JSONMeasurementPhase<P>, "scoped phases require a JSON data storage");
+
+private:
+    std::optional<P> owned_;
+    P* phase_;
+    std::unique_ptr<phase_child_t<P>> node_; // preallocated on entry to hold the owned phase in the parent
+
+    void prepare_parent() {
+        if(auto* p = parent()) {
+            UntrackedScope untracked;
+            if(owned_) node_ = std::make_unique<phase_child_t<P>>();
+            p->reserve_child();
+        }
+    }
+
+public:
+    /**
+     * \brief Constructs and starts a new phase with the given name
+     * 
+     * \param name the name of the phase
+     */
+    inline ScopedPhase(std::string&& name) : ScopedPhaseNode(), owned_(std::in_place, std::move(name)), phase_(&*owned_) {
+        prepare_parent();
+        phase_->start();
+    }
+
+    /**
+     * \brief Starts the given phase owned by the application
+     * 
+     * \param phase the phase
+     */
+    inline ScopedPhase(P& phase) : ScopedPhaseNode(), phase_(&phase) {
+        prepare_parent();
+        phase_->start();
+    }
+
+    inline ~ScopedPhase() {
+        try {
+            phase_->stop();
+            if(auto* p = parent()) {
+                UntrackedScope untracked;
+
+                // an owned phase is no longer needed, so it can be moved into the parent without serializing it
+                if(node_) {
+                    node_->assign(std::move(*owned_));
+                    p->append_child(std::move(node_));
+                } else {
+                    p->append_child_data(phase_->gather_data());
+                }
+            }
+        } catch(...) {
+            // destructors must not throw, so the child is dropped
+        }
+    }
+
+    void append_child_data(nlohmann::json&& child) override {
+        phase_->append_child_data(std::move(child));
+    }
+
+    void append_child(std::unique_ptr<PhaseChild>&& child) override {
+        if constexpr(requires { phase_->append_child(std::move(child)); }) {
+            phase_->append_child(std::move(child));
+        } else {
+            phase_->append_child_data(child->consume());
+        }
+    }
+
+    void reserve_child() override {
+        if constexpr(requires { phase_->reserve_children(1); }) {
+            phase_->reserve_children(1);
+        }
+    }
+
+    /**
+     * \brief Provides access to the measured phase
+     * 
+     * \return the measured phase
+     */
+    P& phase() { return *phase_; }
+};
+
+/**
+ * \brief Scoped guard for phases that have neither meters nor data, which does nothing
+ * 
+ * \tparam P the phase type
+ */
+template<MeasurementPhase P> requires (!P::has_data() && !P::has_meters())
+class ScopedPhase<P> {
+private:
+    P phase_;
+
+public:
+    inline ScopedPhase(std::string&&) {}
+    inline ScopedPhase(P&) {}
+
+    ScopedPhase(ScopedPhase const&) = delete;
+    ScopedPhase(ScopedPhase&&) = delete;
+    ScopedPhase& operator=(ScopedPhase const&) = delete;
+    ScopedPhase& operator=(ScopedPhase&&) = delete;
+
+    /**
+     * \brief Provides access to a dummy phase
+     * 
+     * \return a dummy phase
+     */
+    P& phase() { return phase_; }
+};
+
+}
+
+#endif
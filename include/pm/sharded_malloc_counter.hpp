@@ -0,0 +1,269 @@
+/**
+ * pm/sharded_malloc_counter.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_SHARDED_MALLOC_COUNTER_HPP
+#define _PM_SHARDED_MALLOC_COUNTER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <pm/malloc_callback.hpp>
+#include <pm/malloc_counter.hpp>
+#include <pm/thread_index.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures memory allocations and frees of concurrently allocating threads
+ * 
+ * This is a variant of \ref MallocCounter for multi-threaded applications.
+ * Each thread only writes to its own cache-line-aligned shard of counters, so allocating threads neither race nor
+ * contend for the same cache line. The shards are combined when the measurement data is queried.
+ * Threads are mapped to shards via \ref pm::thread_index "thread_index"; if more than \ref NUM_SHARDS threads allocate,
+ * some shards are shared, which remains correct but reintroduces some contention.
+ * 
+ * The closing memory and the allocation and free statistics are exact.
+ * The peak is computed as the sum of the per-shard peaks, where each shard's peak is the maximum of the bytes allocated minus freed
+ * by the threads mapped to it. Because the per-shard maxima need not occur at the same time, this is an upper bound for the
+ * true process-wide peak, which would require all threads to update a single shared counter.
+ * It is exact if only a single thread allocates memory during the measurement, and it is closest to the truth if every thread
+ * frees the memory it allocates itself: memory allocated by one thread and freed by another keeps counting towards the
+ * allocating thread's shard, so in a producer-consumer pattern, the reported peak may grow up to the total allocated bytes.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class ShardedMallocCounter : public MallocCallback {
+public:
+    /**
+     * \brief The number of counter shards
+     */
+    static constexpr size_t NUM_SHARDS = 128;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic<uintmax_t> alloc_num;
+        std::atomic<uintmax_t> alloc_bytes;
+        std::atomic<uintmax_t> free_num;
+        std::atomic<uintmax_t> free_bytes;
+        std::atomic<intmax_t> current;
+        std::atomic<intmax_t> peak;
+    };
+
+    bool active_;
+    std::array<Shard, NUM_SHARDS> shards_;
+
+    inline Shard& shard() {
+        return shards_[thread_index() % NUM_SHARDS];
+    }
+
+    template<typename F>
+    inline uintmax_t sum(F&& f) const {
+        uintmax_t result = 0;
+        for(auto& s : shards_) result += f(s);
+        return result;
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        auto& s = shard();
+        s.alloc_num.fetch_add(1, std::memory_order_relaxed);
+        s.alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+        // the shard may be shared by several threads, so the peak is raised by a CAS loop to not lose a concurrent maximum
+        auto const current = s.current.fetch_add((intmax_t)bytes, std::memory_order_relaxed) + (intmax_t)bytes;
+        auto peak = s.peak.load(std::memory_order_relaxed);
+        while(current > peak && !s.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+        }
+    }
+
+    inline void on_free(size_t bytes) override {
+        auto& s = shard();
+        s.free_num.fetch_add(1, std::memory_order_relaxed);
+        s.free_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        s.current.fetch_sub((intmax_t)bytes, std::memory_order_relaxed);
+    }
+
+    inline void reset() {
+        for(auto& s : shards_) {
+            s.alloc_num.store(0, std::memory_order_relaxed);
+            s.alloc_bytes.store(0, std::memory_order_relaxed);
+            s.free_num.store(0, std::memory_order_relaxed);
+            s.free_bytes.store(0, std::memory_order_relaxed);
+            s.current.store(0, std::memory_order_relaxed);
+            s.peak.store(0, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    inline ShardedMallocCounter() : MallocCallback(), active_(false) {
+        reset();
+    }
+
+    inline ~ShardedMallocCounter() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    ShardedMallocCounter(ShardedMallocCounter const& other) = delete;
+    ShardedMallocCounter& operator=(ShardedMallocCounter const& other) = delete;
+
+    inline ShardedMallocCounter(ShardedMallocCounter&& other) {
+        *this = std::move(other);
+    }
+
+    inline ShardedMallocCounter& operator=(ShardedMallocCounter&& other) {
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            auto& s = shards_[i];
+            auto const& o = other.shards_[i];
+            s.alloc_num.store(o.alloc_num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s.alloc_bytes.store(o.alloc_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s.free_num.store(o.free_num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s.free_bytes.store(o.free_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s.current.store(o.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s.peak.store(o.peak.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        active_ = other.active_;
+
+        if(active_) {
+            // nobody should be moving an active malloc counter, but who knows...
+            other.unregister_callback();
+            other.active_ = false;
+            register_callback();
+        }
+
+        return *this;
+    }
+
+    /**
+     * \brief Starts allocation tracking.
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses allocation tracking.
+     */
+    inline void pause() {
+        if(active_) {
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes allocation tracking.
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+        }
+    }
+
+    /**
+     * \brief Ends allocation tracking.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The current number of allocated bytes, summed over all threads
+     * 
+     * Note that this may be negative if the counter has seen frees, but not the corresponding allocations.
+     * 
+     * \return the current number of allocated bytes 
+     */
+    intmax_t count() const { return (intmax_t)(alloc_bytes() - free_bytes()); }
+
+    /**
+     * \brief The sum of the per-shard peak numbers of allocated bytes
+     * 
+     * This is an upper bound for the true peak number of allocated bytes, see the class description.
+     * 
+     * \return the sum of the per-shard peak numbers of allocated bytes
+     */
+    uintmax_t peak() const { return sum([](Shard const& s){ return (uintmax_t)s.peak.load(std::memory_order_relaxed); }); }
+
+    /**
+     * \brief The number of tracked memory allocations
+     * 
+     * \return the number of tracked memory allocations
+     */
+    uintmax_t alloc_num() const { return sum([](Shard const& s){ return s.alloc_num.load(std::memory_order_relaxed); }); }
+
+    /**
+     * \brief The number of bytes allocated by tracked memory allocations
+     * 
+     * \return the number of bytes allocated by tracked memory allocations
+     */
+    uintmax_t alloc_bytes() const { return sum([](Shard const& s){ return s.alloc_bytes.load(std::memory_order_relaxed); }); }
+
+    /**
+     * \brief The number of tracked memory releases
+     * 
+     * \return the number of tracked memory releases
+     */
+    uintmax_t free_num() const { return sum([](Shard const& s){ return s.free_num.load(std::memory_order_relaxed); }); }
+
+    /**
+     * \brief The number of bytes freed by tracked memory releases
+     * 
+     * \return the number of bytes freed by tracked memory releases
+     */
+    uintmax_t free_bytes() const { return sum([](Shard const& s){ return s.free_bytes.load(std::memory_order_relaxed); }); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "memory"; }
+
+    /**
+     * \brief Takes a snapshot of the measured values, summed over all shards
+     * 
+     * \return the snapshot
+     */
+    MallocCounter::Snapshot snapshot() const { return { count(), peak(), alloc_num(), alloc_bytes(), free_num(), free_bytes() }; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The format is the same as that of \ref MallocCounter::gather_metrics .
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const { return snapshot().gather_metrics(); }
+};
+
+}
+
+#endif
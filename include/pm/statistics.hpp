@@ -0,0 +1,268 @@
+/**
+ * pm/statistics.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_STATISTICS_HPP
+#define _PM_STATISTICS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace pm {
+
+/**
+ * \brief Descriptive statistics over a sample of measured values
+ * 
+ * Percentiles are computed by linear interpolation between the closest ranks.
+ */
+struct Statistics {
+    /**
+     * \brief The number of values
+     */
+    size_t num;
+
+    /**
+     * \brief The smallest value
+     */
+    double min;
+
+    /**
+     * \brief The largest value
+     */
+    double max;
+
+    /**
+     * \brief The median value
+     */
+    double median;
+
+    /**
+     * \brief The arithmetic mean
+     */
+    double mean;
+
+    /**
+     * \brief The sample standard deviation
+     */
+    double stddev;
+
+    /**
+     * \brief The 90th percentile
+     */
+    double p90;
+
+    /**
+     * \brief The 99th percentile
+     */
+    double p99;
+
+    /**
+     * \brief Computes the given percentile of a sorted sample
+     * 
+     * \param sorted the values, sorted in ascending order
+     * \param p the percentile in the range \f$[0, 1]\f$
+     * \return the percentile
+     */
+    inline static double percentile(std::vector<double> const& sorted, double p) {
+        if(sorted.empty()) return 0.0;
+
+        double const rank = p * (double)(sorted.size() - 1);
+        size_t const lo = (size_t)rank;
+        size_t const hi = std::min(lo + 1, sorted.size() - 1);
+        return sorted[lo] + (rank - (double)lo) * (sorted[hi] - sorted[lo]);
+    }
+
+    /**
+     * \brief Computes the statistics of the given values
+     * 
+     * \param values the values
+     * \return the statistics of the values
+     */
+    inline static Statistics of(std::vector<double> values) {
+        Statistics s = { values.size(), 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+        if(values.empty()) return s;
+
+        std::sort(values.begin(), values.end());
+        s.min = values.front();
+        s.max = values.back();
+        s.median = percentile(values, 0.5);
+        s.p90 = percentile(values, 0.9);
+        s.p99 = percentile(values, 0.99);
+
+        double sum = 0.0;
+        for(auto const x : values) sum += x;
+        s.mean = sum / (double)values.size();
+
+        if(values.size() > 1) {
+            double sq = 0.0;
+            for(auto const x : values) sq += (x - s.mean) * (x - s.mean);
+            s.stddev = std::sqrt(sq / (double)(values.size() - 1));
+        }
+        return s;
+    }
+
+    /**
+     * \brief Computes the half width of the approximate 95% confidence interval of the mean
+     * 
+     * \return the half width of the confidence interval
+     */
+    inline double confidence_half_width() const {
+        return num > 1 ? 1.96 * stddev / std::sqrt((double)num) : INFINITY;
+    }
+
+    /**
+     * \brief Converts the statistics into a JSON object
+     * 
+     * \return the statistics as a JSON object
+     */
+    inline nlohmann::json to_json() const {
+        nlohmann::json obj;
+        obj["min"] = min;
+        obj["median"] = median;
+        obj["mean"] = mean;
+        obj["stddev"] = stddev;
+        obj["p90"] = p90;
+        obj["p99"] = p99;
+        obj["max"] = max;
+        return obj;
+    }
+};
+
+/**
+ * \brief Computes the regularized incomplete beta function \f$I_x(a, b)\f$
+ * 
+ * The function is evaluated by its continued fraction expansion using Lentz's method.
+ * 
+ * \param a the first shape parameter
+ * \param b the second shape parameter
+ * \param x the argument in the range \f$[0, 1]\f$
+ * \return the value of the function
+ */
+inline double incomplete_beta(double a, double b, double x) {
+    if(x <= 0.0) return 0.0;
+    if(x >= 1.0) return 1.0;
+
+    // the continued fraction converges quickly only for small x, so use the symmetry of the function otherwise
+    if(x > (a + 1.0) / (a + b + 2.0)) return 1.0 - incomplete_beta(b, a, 1.0 - x);
+
+    constexpr double TINY = 1e-30;
+    constexpr double EPSILON = 1e-14;
+    constexpr size_t MAX_ITERATIONS = 400;
+
+    double const front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log1p(-x)) / a;
+    double f = 1.0, c = 1.0, d = 0.0;
+    for(size_t i = 0; i <= MAX_ITERATIONS; i++) {
+        double const m = (double)(i / 2);
+        double numerator;
+        if(i == 0) {
+            numerator = 1.0;
+        } else if(i % 2 == 0) {
+            numerator = (m * (b - m) * x) / ((a + 2.0 * m - 1.0) * (a + 2.0 * m));
+        } else {
+            numerator = -((a + m) * (a + b + m) * x) / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+        }
+
+        d = 1.0 + numerator * d;
+        if(std::abs(d) < TINY) d = TINY;
+        d = 1.0 / d;
+
+        c = 1.0 + numerator / c;
+        if(std::abs(c) < TINY) c = TINY;
+
+        double const cd = c * d;
+        f *= cd;
+        if(std::abs(1.0 - cd) < EPSILON) break;
+    }
+    return front * (f - 1.0);
+}
+
+/**
+ * \brief Performs Welch's t-test on whether two samples have the same mean
+ * 
+ * Unlike Student's t-test, Welch's test does not assume that both samples have the same variance.
+ * 
+ * \param a the statistics of the first sample
+ * \param b the statistics of the second sample
+ * \return the two-sided p-value, or NaN if either sample has fewer than two values
+ */
+inline double welch_t_test(Statistics const& a, Statistics const& b) {
+    if(a.num < 2 || b.num < 2) return NAN;
+
+    double const va = a.stddev * a.stddev / (double)a.num;
+    double const vb = b.stddev * b.stddev / (double)b.num;
+    double const se = va + vb;
+    if(se == 0.0) return a.mean == b.mean ? 1.0 : 0.0;
+
+    double const t = (a.mean - b.mean) / std::sqrt(se);
+    double const df = se * se / (va * va / (double)(a.num - 1) + vb * vb / (double)(b.num - 1));
+    return incomplete_beta(df / 2.0, 0.5, df / (df + t * t));
+}
+
+/**
+ * \brief Aggregates a sequence of structurally identical JSON documents into statistics
+ * 
+ * Every numeric value in the first document is replaced by the \ref Statistics::to_json "statistics" over the values found at the same position in all documents.
+ * Objects are aggregated recursively, whereas all other values, including arrays, are taken from the last document.
+ * 
+ * \param docs the documents to aggregate
+ * \return the aggregated document
+ */
+inline nlohmann::json aggregate(std::vector<nlohmann::json> const& docs) {
+    if(docs.empty()) return nlohmann::json();
+
+    auto const& first = docs.front();
+    if(first.is_number()) {
+        std::vector<double> values;
+        values.reserve(docs.size());
+        for(auto const& d : docs) {
+            if(d.is_number()) values.push_back(d.get<double>());
+        }
+        return Statistics::of(std::move(values)).to_json();
+    } else if(first.is_object()) {
+        nlohmann::json obj = nlohmann::json::object();
+        std::vector<nlohmann::json> items;
+        items.reserve(docs.size());
+        for(auto const& item : first.items()) {
+            items.clear();
+            for(auto const& d : docs) {
+                if(d.is_object() && d.contains(item.key())) items.push_back(d[item.key()]);
+            }
+            obj[item.key()] = aggregate(items);
+        }
+        return obj;
+    } else {
+        return docs.back();
+    }
+}
+
+}
+
+#endif
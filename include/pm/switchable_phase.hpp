@@ -0,0 +1,97 @@
+/**
+ * pm/switchable_phase.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_SWITCHABLE_PHASE_HPP
+#define _PM_SWITCHABLE_PHASE_HPP
+
+#include <pm/measurement_switch.hpp>
+#include <pm/phase.hpp>
+
+namespace pm {
+
+/**
+ * \brief A \ref Phase that only measures while the \ref MeasurementSwitch "measurement switch" is enabled
+ * 
+ * Whereas \ref NoopPhase removes all measurement at compile time, this phase carries all of its meters,
+ * but tests the switch when it is started.
+ * If measurement is disabled at that time, starting, pausing, resuming and stopping the phase does nothing but a single branch,
+ * so the phase can stay in hot paths of release builds.
+ * The meters of a phase that has not been measuring report their initial values.
+ * 
+ * This class satisfies the \ref pm::MeasurementPhase "MeasurementPhase" concept and provides a JSON data storage.
+ * 
+ * \tparam M the declared meters
+ */
+template<Meter<nlohmann::json>... M>
+class SwitchablePhase : public Phase<M...> {
+private:
+    using Base = Phase<M...>;
+
+    bool measuring_ = false;
+
+public:
+    using Base::Base;
+
+    /**
+     * \brief Starts the phase's meters if measurement is enabled for the current thread
+     */
+    void start() {
+        measuring_ = MeasurementSwitch::enabled();
+        if(measuring_) Base::start();
+    }
+
+    /**
+     * \brief Pauses the phase's meters if the phase has been measuring since it was started
+     */
+    void pause() {
+        if(measuring_) Base::pause();
+    }
+
+    /**
+     * \brief Resumes the phase's meters if the phase has been measuring since it was started
+     */
+    void resume() {
+        if(measuring_) Base::resume();
+    }
+
+    /**
+     * \brief Stops the phase's meters if the phase has been measuring since it was started
+     */
+    void stop() {
+        if(measuring_) Base::stop();
+    }
+
+    /**
+     * \brief Tests whether the phase has been measuring since it was started
+     * 
+     * \return true if measurement was enabled when the phase was started, false otherwise
+     */
+    bool measuring() const { return measuring_; }
+};
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * pm/tag_counter.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_TAG_COUNTER_HPP
+#define _PM_TAG_COUNTER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <pm/allocation_tag.hpp>
+#include <pm/malloc_callback.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures memory allocations and frees per \ref AllocationTag "allocation tag"
+ * 
+ * As an implementation of \ref MallocCallback , it receives memory allocation and free callbacks if tudocomp's `malloc` overrides are enabled.
+ * Every allocation is credited to the tag of the \ref TagScope it was made in, and every free is credited to the tag of the freed block,
+ * so that the live bytes and the peak of every tag are known, even if differently tagged allocations are interleaved.
+ * The counters are fixed-size arrays of atomics, so nothing is allocated during the measurement,
+ * and the counter can be used with multiple allocating threads.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class TagCounter : public MallocCallback {
+private:
+    struct Counters {
+        std::atomic<intmax_t> current;
+        std::atomic<uintmax_t> peak;
+        std::atomic<uintmax_t> alloc_num;
+        std::atomic<uintmax_t> alloc_bytes;
+        std::atomic<uintmax_t> free_num;
+        std::atomic<uintmax_t> free_bytes;
+    };
+
+    using Table = std::array<Counters, AllocationTag::MAX_TAGS>;
+
+    bool active_;
+    Table tags_;
+
+    inline static void copy(Counters& to, Counters const& from) {
+        to.current.store(from.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.peak.store(from.peak.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.alloc_num.store(from.alloc_num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.alloc_bytes.store(from.alloc_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.free_num.store(from.free_num.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.free_bytes.store(from.free_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        auto& c = tags_[event_tag()];
+        auto const current = c.current.fetch_add(bytes, std::memory_order_relaxed) + (intmax_t)bytes;
+        if(current > 0) {
+            auto peak = c.peak.load(std::memory_order_relaxed);
+            while((uintmax_t)current > peak && !c.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+        }
+
+        c.alloc_num.fetch_add(1, std::memory_order_relaxed);
+        c.alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    inline void on_free(size_t bytes) override {
+        auto& c = tags_[event_tag()];
+        c.current.fetch_sub(bytes, std::memory_order_relaxed);
+
+        c.free_num.fetch_add(1, std::memory_order_relaxed);
+        c.free_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    inline void reset() {
+        for(auto& c : tags_) {
+            c.current.store(0, std::memory_order_relaxed);
+            c.peak.store(0, std::memory_order_relaxed);
+            c.alloc_num.store(0, std::memory_order_relaxed);
+            c.alloc_bytes.store(0, std::memory_order_relaxed);
+            c.free_num.store(0, std::memory_order_relaxed);
+            c.free_bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    inline TagCounter() : MallocCallback(), active_(false) {
+        reset();
+    }
+
+    inline ~TagCounter() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    TagCounter(TagCounter const& other) = delete;
+    TagCounter& operator=(TagCounter const& other) = delete;
+
+    inline TagCounter(TagCounter&& other) {
+        *this = std::move(other);
+    }
+
+    inline TagCounter& operator=(TagCounter&& other) {
+        for(size_t i = 0; i < AllocationTag::MAX_TAGS; i++) copy(tags_[i], other.tags_[i]);
+        active_ = other.active_;
+
+        if(active_) {
+            // nobody should be moving an active tag counter, but who knows...
+            other.unregister_callback();
+            other.active_ = false;
+            register_callback();
+        }
+
+        return *this;
+    }
+
+    /**
+     * \brief Starts allocation tracking.
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses allocation tracking.
+     */
+    inline void pause() {
+        if(active_) {
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes allocation tracking.
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+        }
+    }
+
+    /**
+     * \brief Ends allocation tracking.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The current number of bytes allocated with the given tag
+     * 
+     * Note that this may be negative if the counter has seen frees, but not the corresponding allocations.
+     * 
+     * \param tag the allocation tag
+     * \return the current number of bytes allocated with the given tag
+     */
+    intmax_t count(AllocationTag tag) const { return tags_[tag.id()].current.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The peak number of bytes allocated with the given tag
+     * 
+     * \param tag the allocation tag
+     * \return the peak number of bytes allocated with the given tag
+     */
+    uintmax_t peak(AllocationTag tag) const { return tags_[tag.id()].peak.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The number of tracked memory allocations with the given tag
+     * 
+     * \param tag the allocation tag
+     * \return the number of tracked memory allocations with the given tag
+     */
+    uintmax_t alloc_num(AllocationTag tag) const { return tags_[tag.id()].alloc_num.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The number of bytes allocated by tracked memory allocations with the given tag
+     * 
+     * \param tag the allocation tag
+     * \return the number of bytes allocated by tracked memory allocations with the given tag
+     */
+    uintmax_t alloc_bytes(AllocationTag tag) const { return tags_[tag.id()].alloc_bytes.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The number of tracked releases of blocks with the given tag
+     * 
+     * \param tag the allocation tag
+     * \return the number of tracked releases of blocks with the given tag
+     */
+    uintmax_t free_num(AllocationTag tag) const { return tags_[tag.id()].free_num.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The number of bytes freed by tracked releases of blocks with the given tag
+     * 
+     * \param tag the allocation tag
+     * \return the number of bytes freed by tracked releases of blocks with the given tag
+     */
+    uintmax_t free_bytes(AllocationTag tag) const { return tags_[tag.id()].free_bytes.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "tags"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * For every tag that has seen allocations or frees, the same metrics as those of a \ref MallocCounter are reported under the tag's name.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        auto obj = nlohmann::json::object();
+        for(size_t i = 0; i < AllocationTag::MAX_TAGS; i++) {
+            auto const& c = tags_[i];
+            auto const alloc_num = c.alloc_num.load(std::memory_order_relaxed);
+            auto const free_num = c.free_num.load(std::memory_order_relaxed);
+            if(alloc_num || free_num) {
+                nlohmann::json tag;
+                tag["peak"] = c.peak.load(std::memory_order_relaxed);
+                tag["closing"] = c.current.load(std::memory_order_relaxed);
+                tag["alloc_num"] = alloc_num;
+                tag["alloc_bytes"] = c.alloc_bytes.load(std::memory_order_relaxed);
+                tag["free_num"] = free_num;
+                tag["free_bytes"] = c.free_bytes.load(std::memory_order_relaxed);
+                obj[AllocationTag::name(i)] = std::move(tag);
+            }
+        }
+        return obj;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * pm/thread_index.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_THREAD_INDEX_HPP
+#define _PM_THREAD_INDEX_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace pm {
+
+/**
+ * \brief The assumed size of a cache line in bytes
+ * 
+ * Data that is written to by different threads concurrently is aligned to this size in order to avoid false sharing.
+ */
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * \brief Reports a small index that uniquely identifies the calling thread
+ * 
+ * Indices are assigned consecutively, starting from zero, in the order in which threads first call this function.
+ * They are never reused, even after a thread has terminated.
+ * 
+ * The function neither allocates memory nor takes any locks, so it is safe to use from within `malloc` hooks.
+ * 
+ * \return the index of the calling thread
+ */
+inline size_t thread_index() {
+    static std::atomic<size_t> next = 0;
+    thread_local size_t index = SIZE_MAX;
+    if(index == SIZE_MAX) index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+}
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * pm/trace_recorder.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_TRACE_RECORDER_HPP
+#define _PM_TRACE_RECORDER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+#include <pm/thread_index.hpp>
+#include <pm/tsc_clock.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief The type of a \ref TraceEvent
+ */
+enum class TraceEventType : uint8_t {
+    begin = 'B',
+    end = 'E',
+    pause = 'P',
+    resume = 'R'
+};
+
+/**
+ * \brief An event recorded by a \ref TraceRecorder
+ */
+struct TraceEvent {
+    /**
+     * \brief The maximum length of an event's name, longer names are truncated
+     */
+    static constexpr size_t MAX_NAME = 54;
+
+    /**
+     * \brief The TSC value at the time of the event
+     */
+    uint64_t ticks;
+
+    /**
+     * \brief The type of the event
+     */
+    TraceEventType type;
+
+    /**
+     * \brief The null-terminated name of the phase that caused the event
+     */
+    char name[MAX_NAME + 1];
+};
+
+/**
+ * \brief Records the begin, end, pause and resume events of all \ref Phase "phases" for viewing them on a timeline
+ * 
+ * While a recorder exists, every phase records its events with the \ref TscClock "TSC" timestamp and the \ref thread_index "index" of the calling thread.
+ * Every thread records into its own fixed-size single-producer ring buffer, which is allocated (untracked) when the thread records its first event,
+ * so recording an event neither allocates memory nor takes any locks.
+ * If a ring buffer is full, events are dropped and counted.
+ * The ring buffers are drained by \ref collect , which may be called periodically from any thread while events are being recorded.
+ * 
+ * The collected events are written in the Chrome trace event format by \ref write ,
+ * which can be opened in timeline viewers such as `chrome://tracing` or Perfetto.
+ * Every event is shown on the timeline of the thread that recorded it, so a phase is shown as a slice on the timeline of its thread,
+ * interrupted by the gaps during which it was paused, only if it is started, paused, resumed and stopped on the same thread.
+ * Otherwise, its begin and end events land on different timelines and do not form a slice.
+ * 
+ * Only one recorder may exist at a time.
+ * It must not be destroyed while other threads may still be recording events.
+ */
+class TraceRecorder {
+public:
+    /**
+     * \brief The default capacity of every thread's ring buffer in events
+     */
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 14;
+
+private:
+    struct Ring {
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> head; // written by the producer
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail; // written by the consumer
+        std::atomic<uintmax_t> dropped;
+        size_t thread;
+        std::unique_ptr<TraceEvent[]> events;
+        Ring* next;
+    };
+
+    struct Collected {
+        size_t thread;
+        TraceEvent event;
+    };
+
+    inline static std::atomic<TraceRecorder*>& active() {
+        static std::atomic<TraceRecorder*> active = nullptr;
+        return active;
+    }
+
+    inline static uint64_t next_id() {
+        static std::atomic<uint64_t> next = 1;
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t id_;
+    size_t capacity_;
+    uint64_t origin_;
+    std::atomic<Ring*> rings_;
+
+    std::mutex mutex_;
+    std::vector<Collected> collected_;
+
+    // the calling thread's ring buffer, which is created on first use
+    inline Ring& ring() {
+        thread_local struct {
+            uint64_t id = 0;
+            Ring* ring = nullptr;
+        } cache;
+
+        if(cache.id != id_) {
+            UntrackedScope untracked;
+            auto* r = new Ring();
+            r->head.store(0, std::memory_order_relaxed);
+            r->tail.store(0, std::memory_order_relaxed);
+            r->dropped.store(0, std::memory_order_relaxed);
+            r->thread = thread_index();
+            r->events = std::make_unique<TraceEvent[]>(capacity_);
+
+            // publish the ring to the consumer
+            r->next = rings_.load(std::memory_order_relaxed);
+            while(!rings_.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {}
+
+            cache.id = id_;
+            cache.ring = r;
+        }
+        return *cache.ring;
+    }
+
+    inline void push(TraceEventType type, std::string_view name) {
+        auto const ticks = TscClock::start_ticks();
+        auto& r = ring();
+
+        auto const head = r.head.load(std::memory_order_relaxed);
+        if(head - r.tail.load(std::memory_order_acquire) >= capacity_) {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& e = r.events[head & (capacity_ - 1)];
+        e.ticks = ticks;
+        e.type = type;
+        size_t const len = std::min(name.size(), TraceEvent::MAX_NAME);
+        std::memcpy(e.name, name.data(), len);
+        e.name[len] = 0;
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+public:
+    /**
+     * \brief Records an event with the active recorder, if any
+     * 
+     * This is called by \ref Phase "phases" and can be used to record events for custom measurement phases.
+     * The event is attributed to the calling thread, so the events of one phase should all be recorded on the same thread.
+     * 
+     * \param type the event type
+     * \param name the name of the phase that caused the event
+     */
+    inline static void record(TraceEventType type, std::string_view name) {
+        if(auto* r = active().load(std::memory_order_acquire)) r->push(type, name);
+    }
+
+    /**
+     * \brief Tests whether a recorder is currently active
+     * 
+     * \return true if a recorder exists
+     */
+    inline static bool enabled() {
+        return active().load(std::memory_order_relaxed) != nullptr;
+    }
+
+    /**
+     * \brief Constructs and activates a recorder
+     * 
+     * If another recorder is already active, a `std::logic_error` is thrown.
+     * 
+     * \param capacity the capacity of every thread's ring buffer in events (will be rounded up to a power of two)
+     */
+    inline TraceRecorder(size_t capacity = DEFAULT_CAPACITY)
+        : id_(next_id()),
+          capacity_(std::bit_ceil(std::max(capacity, size_t(1)))),
+          rings_(nullptr) {
+
+        TscClock::calibrate();
+        origin_ = TscClock::start_ticks();
+
+        TraceRecorder* expected = nullptr;
+        if(!active().compare_exchange_strong(expected, this, std::memory_order_acq_rel)) {
+            throw std::logic_error("another trace recorder is already active");
+        }
+    }
+
+    inline ~TraceRecorder() {
+        TraceRecorder* expected = this;
+        active().compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+
+        auto* r = rings_.load(std::memory_order_acquire);
+        while(r) {
+            auto* next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+    TraceRecorder(TraceRecorder const&) = delete;
+    TraceRecorder(TraceRecorder&&) = delete;
+    TraceRecorder& operator=(TraceRecorder const&) = delete;
+    TraceRecorder& operator=(TraceRecorder&&) = delete;
+
+    /**
+     * \brief Drains the ring buffers of all threads
+     * 
+     * This can be called from any thread while events are being recorded, in order to keep the ring buffers from overflowing.
+     */
+    void collect() {
+        std::lock_guard lock(mutex_);
+        for(auto* r = rings_.load(std::memory_order_acquire); r; r = r->next) {
+            auto const tail = r->tail.load(std::memory_order_relaxed);
+            auto const head = r->head.load(std::memory_order_acquire);
+            for(size_t i = tail; i < head; i++) collected_.push_back({ r->thread, r->events[i & (capacity_ - 1)] });
+            r->tail.store(head, std::memory_order_release);
+        }
+    }
+
+    /**
+     * \brief The number of events collected so far
+     * 
+     * \return the number of collected events
+     */
+    size_t num_events() {
+        std::lock_guard lock(mutex_);
+        return collected_.size();
+    }
+
+    /**
+     * \brief The number of events that were dropped because a ring buffer was full
+     * 
+     * \return the number of dropped events
+     */
+    uintmax_t dropped() const {
+        uintmax_t dropped = 0;
+        for(auto* r = rings_.load(std::memory_order_acquire); r; r = r->next) dropped += r->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+    /**
+     * \brief Collects all recorded events and writes them in the Chrome trace event format
+     * 
+     * Timestamps are given in microseconds since the construction of the recorder.
+     * Begin and resume events are written as the beginnings of slices (`B`), end and pause events as their ends (`E`).
+     * 
+     * \param out the output stream
+     */
+    void write(std::ostream& out) {
+        collect();
+
+        std::lock_guard lock(mutex_);
+        auto const pid = (uintmax_t)getpid();
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for(auto const& c : collected_) {
+            auto const& e = c.event;
+            bool const begins = (e.type == TraceEventType::begin || e.type == TraceEventType::resume);
+
+            if(!first) out << ",";
+            first = false;
+
+            out << "\n{\"name\":" << nlohmann::json(std::string_view(e.name)).dump();
+            out << ",\"ph\":\"" << (begins ? 'B' : 'E') << "\"";
+            out << ",\"ts\":" << nlohmann::json(TscClock::to_nanos(e.ticks - origin_) / 1000.0).dump();
+            out << ",\"pid\":" << pid;
+            out << ",\"tid\":" << c.thread;
+            if(e.type == TraceEventType::pause || e.type == TraceEventType::resume) {
+                out << ",\"args\":{\"" << (begins ? "resume" : "pause") << "\":true}";
+            }
+            out << "}";
+        }
+        out << "\n],\"otherData\":{\"dropped\":" << dropped() << "}}\n";
+    }
+
+    /**
+     * \brief Collects all recorded events and writes them to a file in the Chrome trace event format
+     * 
+     * \param path the output file path
+     * \throws std::runtime_error if the file cannot be opened
+     */
+    void write(std::string const& path) {
+        std::ofstream out(path);
+        if(!out) throw std::runtime_error("failed to open trace file for writing: " + path);
+        write(out);
+    }
+};
+
+}
+
+#endif
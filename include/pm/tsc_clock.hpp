@@ -0,0 +1,150 @@
+/**
+ * pm/tsc_clock.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_TSC_CLOCK_HPP
+#define _PM_TSC_CLOCK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PM_HAS_TSC
+#include <x86intrin.h>
+#endif
+
+namespace pm {
+
+/**
+ * \brief Low-overhead access to the CPU's time stamp counter (TSC)
+ * 
+ * On x86, reading the TSC takes only a few dozen cycles, which is considerably cheaper than querying the system clock.
+ * The reads are fenced such that no preceding or subsequent instructions are executed out of order across them.
+ * The TSC is assumed to be invariant, i.e., to tick at a constant rate across all cores regardless of frequency scaling,
+ * which is the case for all x86 processors of the last decade (see the `constant_tsc` and `nonstop_tsc` CPU flags).
+ * 
+ * The TSC frequency is calibrated against `std::chrono::steady_clock` once, on the first call to \ref calibrate or \ref ticks_per_nano ,
+ * which takes approximately \ref CALIBRATION_MILLIS milliseconds.
+ * Applications that care about this delay should call \ref calibrate at startup.
+ * 
+ * On other architectures, the steady clock's nanosecond ticks are used instead and no calibration is needed.
+ */
+class TscClock {
+public:
+    /**
+     * \brief The duration of the calibration in milliseconds
+     */
+    static constexpr unsigned CALIBRATION_MILLIS = 20;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    inline static uint64_t steady_nanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    inline static double measure_ticks_per_nano() {
+        #ifdef PM_HAS_TSC
+        auto const t0 = steady_nanos();
+        auto const c0 = stop_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(CALIBRATION_MILLIS));
+        auto const t1 = steady_nanos();
+        auto const c1 = stop_ticks();
+        return (double)(c1 - c0) / (double)(t1 - t0);
+        #else
+        return 1.0;
+        #endif
+    }
+
+public:
+    /**
+     * \brief Reads the TSC at the beginning of a measured section
+     * 
+     * The read cannot be executed before any preceding instructions, and no subsequent instructions can be executed before it.
+     * 
+     * \return the current TSC value
+     */
+    inline static uint64_t start_ticks() {
+        #ifdef PM_HAS_TSC
+        _mm_lfence();
+        uint64_t const t = __rdtsc();
+        _mm_lfence();
+        return t;
+        #else
+        return steady_nanos();
+        #endif
+    }
+
+    /**
+     * \brief Reads the TSC at the end of a measured section
+     * 
+     * Using `rdtscp`, the read waits for all preceding instructions to complete, and no subsequent instructions can be executed before it.
+     * 
+     * \return the current TSC value
+     */
+    inline static uint64_t stop_ticks() {
+        #ifdef PM_HAS_TSC
+        unsigned aux;
+        uint64_t const t = __rdtscp(&aux);
+        _mm_lfence();
+        return t;
+        #else
+        return steady_nanos();
+        #endif
+    }
+
+    /**
+     * \brief Calibrates the TSC frequency unless that has already been done
+     */
+    inline static void calibrate() {
+        ticks_per_nano();
+    }
+
+    /**
+     * \brief The calibrated TSC frequency in ticks per nanosecond
+     * 
+     * \return the number of TSC ticks per nanosecond
+     */
+    inline static double ticks_per_nano() {
+        static double const ticks_per_nano = measure_ticks_per_nano();
+        return ticks_per_nano;
+    }
+
+    /**
+     * \brief Converts the given number of TSC ticks to nanoseconds
+     * 
+     * \param ticks the number of ticks
+     * \return the corresponding duration in nanoseconds
+     */
+    inline static double to_nanos(uint64_t ticks) {
+        return (double)ticks / ticks_per_nano();
+    }
+};
+
+}
+
+#endif
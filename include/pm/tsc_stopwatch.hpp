@@ -0,0 +1,157 @@
+/**
+ * pm/tsc_stopwatch.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PM_TSC_STOPWATCH_HPP
+#define _PM_TSC_STOPWATCH_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <nlohmann/json.hpp>
+#include <pm/tsc_clock.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures time durations using the CPU's time stamp counter
+ * 
+ * This is a drop-in replacement for \ref Stopwatch with a much smaller overhead per reading, which makes it suitable for fine-grained phases in hot loops.
+ * The time stamp counter is read via \ref TscClock , and ticks are converted to time using \ref TscClock "its" one-time calibration only when queried.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ * 
+ * \tparam report_cycles if true, the raw number of elapsed TSC ticks is reported under the key `cycles` instead of the elapsed time under the key `time`
+ */
+template<bool report_cycles = false>
+class BasicTscStopwatch {
+private:
+    uint64_t start_;
+    uint64_t elapsed_;
+
+public:
+    /**
+     * \brief Constructs a new stopwatch
+     * 
+     * Note that this does \em not start the stopwatch; \ref start must be called manually.
+     */
+    inline BasicTscStopwatch() : start_(0), elapsed_(0) {}
+
+    BasicTscStopwatch(BasicTscStopwatch const& other) = delete;
+    BasicTscStopwatch(BasicTscStopwatch&& other) = default;
+    BasicTscStopwatch& operator=(BasicTscStopwatch const& other) = delete;
+    BasicTscStopwatch& operator=(BasicTscStopwatch&& other) = default;
+
+    /**
+     * \brief Starts the time measurement
+     * 
+     * This will reset the elapsed time to zero
+     */
+    inline void start() {
+        elapsed_ = 0;
+        resume();
+    }
+
+    /**
+     * \brief Pauses the time measurement
+     * 
+     */
+    inline void pause() {
+        elapsed_ += TscClock::stop_ticks() - start_;
+    }
+
+    /**
+     * \brief Resumes the time measurement
+     * 
+     */
+    inline void resume() {
+        start_ = TscClock::start_ticks();
+    }
+
+    /**
+     * \brief Stops the time measurement
+     * 
+     * This is technically equivalent to pausing the stopwatch.
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief Reports the number of elapsed TSC ticks
+     * 
+     * \return the number of elapsed TSC ticks
+     */
+    uint64_t elapsed_cycles() const { return elapsed_; }
+
+    /**
+     * \brief Reports the measured elapsed time in nanosecond precision
+     * 
+     * \return uintmax_t the measured elapsed time in nanosecond precision
+     */
+    uintmax_t elapsed_time_nanos() const { return (uintmax_t)TscClock::to_nanos(elapsed_); }
+
+    /**
+     * \brief Reports the measured elapsed time in milliseconds
+     * 
+     * \return the measured elapsed time in milliseconds
+     */
+    double elapsed_time_millis() const { return TscClock::to_nanos(elapsed_) / 1'000'000.0; }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return report_cycles ? "cycles" : "time"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        if constexpr(report_cycles) {
+            return elapsed_cycles();
+        } else {
+            return elapsed_time_millis();
+        }
+    }
+};
+
+/**
+ * \brief A \ref BasicTscStopwatch that reports the elapsed time in milliseconds, just like \ref Stopwatch
+ */
+using TscStopwatch = BasicTscStopwatch<false>;
+
+/**
+ * \brief A \ref BasicTscStopwatch that reports the raw number of elapsed TSC ticks
+ */
+using TscCycleStopwatch = BasicTscStopwatch<true>;
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * pm/untracked_scope.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_UNTRACKED_SCOPE_HPP
+#define _PM_UNTRACKED_SCOPE_HPP
+
+#include <pm/malloc/hook.hpp>
+
+namespace pm {
+
+/**
+ * \brief Excludes the memory allocated by the current thread from allocation tracking during its lifetime
+ * 
+ * Blocks allocated while the scope exists are marked in their header, so neither their allocation nor their eventual free
+ * are reported to any \ref MallocCallback, regardless of when or by which thread they are freed.
+ * Scopes can be nested.
+ * 
+ * pm uses this for its own bookkeeping, e.g., when children are appended to a \ref Phase while enclosing meters are running.
+ * 
+ * Untracked allocations require tudocomp's `malloc` overrides with block headers,
+ * i.e., this has no effect if the overrides are disabled or if pm was built with `PM_MALLOC_USABLE_SIZE`.
+ */
+class UntrackedScope {
+private:
+    #if defined(PM_MALLOC) && !defined(_WIN32)
+    bool prev_;
+    #endif
+
+public:
+    #if defined(PM_MALLOC) && !defined(_WIN32)
+    inline UntrackedScope() : prev_(malloc_hook::set_untracked(true)) {
+    }
+
+    inline ~UntrackedScope() {
+        malloc_hook::set_untracked(prev_);
+    }
+    #else
+    inline UntrackedScope() {}
+    #endif
+
+    UntrackedScope(UntrackedScope const&) = delete;
+    UntrackedScope(UntrackedScope&&) = delete;
+    UntrackedScope& operator=(UntrackedScope const&) = delete;
+    UntrackedScope& operator=(UntrackedScope&&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,392 @@
+/**
+ * pm/worker_load.hpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _PM_WORKER_LOAD_HPP
+#define _PM_WORKER_LOAD_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+#include <pm/malloc_callback.hpp>
+#include <pm/thread_index.hpp>
+#include <pm/tsc_clock.hpp>
+#include <pm/untracked_scope.hpp>
+
+namespace pm {
+
+/**
+ * \brief Measures the load of the worker threads of a parallel region
+ * 
+ * Every worker thread, identified by a number such as `omp_get_thread_num()`, records its busy time into its own preallocated,
+ * cache-line-aligned slot by opening a \ref Scope around the work it does, so workers never write to shared memory.
+ * If tudocomp's `malloc` overrides are enabled, the allocations made by a worker within a scope are counted in its slot as well.
+ * 
+ * Next to the per-worker figures, the load imbalance (the maximum busy time divided by the mean busy time) and the parallel efficiency
+ * (the total busy time divided by the number of workers times the elapsed wall time) are reported, both relative to the workers that recorded any work.
+ * Busy times are measured using the \ref TscClock . The slots are allocated on construction, so no allocations are necessary during the measurement.
+ * Scopes of workers whose numbers exceed the maximum number of workers are not recorded, but counted as out of range.
+ * The data should only be gathered once all workers are done.
+ * 
+ * This class satisfies the \ref pm::Meter "Meter" concept for gathering data in JSON data storages.
+ */
+class WorkerLoad : public MallocCallback {
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        uint64_t busy_ticks;
+        uintmax_t tasks;
+        uintmax_t alloc_num;
+        uintmax_t alloc_bytes;
+    };
+
+    // the slot the calling thread currently records into
+    struct Binding {
+        WorkerLoad const* owner;
+        Slot* slot;
+    };
+
+    inline static Binding& binding() {
+        thread_local Binding binding = { nullptr, nullptr };
+        return binding;
+    }
+
+    bool active_;
+    size_t max_workers_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<uintmax_t> out_of_range_; // number of scopes of workers without a slot
+    uint64_t start_ticks_;
+    uint64_t wall_ticks_;
+
+    inline void reset() {
+        for(size_t i = 0; i < max_workers_; i++) slots_[i] = Slot{ 0, 0, 0, 0 };
+        out_of_range_.store(0, std::memory_order_relaxed);
+        wall_ticks_ = 0;
+    }
+
+protected:
+    inline void on_alloc(size_t bytes) override {
+        auto const& b = binding();
+        if(b.owner == this) {
+            ++b.slot->alloc_num;
+            b.slot->alloc_bytes += bytes;
+        }
+    }
+
+    inline void on_free(size_t) override {
+    }
+
+public:
+    /**
+     * \brief Records the busy time of a worker for the lifetime of a scope
+     * 
+     * Scopes must be opened by the worker thread itself, and a worker's scopes must not overlap.
+     */
+    class Scope {
+    private:
+        Slot* slot_;
+        Binding prev_;
+        uint64_t start_;
+
+    public:
+        /**
+         * \brief Starts recording the busy time of the given worker
+         * 
+         * \param load the measurement
+         * \param worker the worker's number; if it is not less than the maximum number of workers, the scope is only counted as out of range
+         */
+        inline Scope(WorkerLoad& load, size_t worker) : slot_(nullptr), prev_(binding()), start_(0) {
+            if(worker < load.max_workers_) {
+                slot_ = &load.slots_[worker];
+                binding() = { &load, slot_ };
+                start_ = TscClock::start_ticks();
+            } else {
+                load.out_of_range_.fetch_add(1, std::memory_order_relaxed);
+                binding() = { nullptr, nullptr };
+            }
+        }
+
+        inline ~Scope() {
+            if(slot_) {
+                slot_->busy_ticks += TscClock::stop_ticks() - start_;
+                ++slot_->tasks;
+            }
+            binding() = prev_;
+        }
+
+        Scope(Scope const&) = delete;
+        Scope(Scope&&) = delete;
+        Scope& operator=(Scope const&) = delete;
+        Scope& operator=(Scope&&) = delete;
+    };
+
+    /**
+     * \brief Constructs a measurement
+     * 
+     * \param max_workers the maximum number of workers, by default the number of hardware threads
+     */
+    inline WorkerLoad(size_t max_workers = std::max(std::thread::hardware_concurrency(), 1U))
+        : MallocCallback(),
+          active_(false),
+          max_workers_(std::max(max_workers, size_t(1))),
+          out_of_range_(0),
+          start_ticks_(0),
+          wall_ticks_(0) {
+
+        TscClock::calibrate();
+
+        UntrackedScope untracked;
+        slots_ = std::make_unique<Slot[]>(max_workers_);
+        reset();
+    }
+
+    inline ~WorkerLoad() {
+        // unregister before this object is destroyed, because other threads may still be dispatching to it
+        unregister_callback();
+    }
+
+    WorkerLoad(WorkerLoad const& other) = delete;
+    WorkerLoad& operator=(WorkerLoad const& other) = delete;
+
+    inline WorkerLoad(WorkerLoad&& other)
+        : MallocCallback(),
+          active_(false),
+          max_workers_(0),
+          out_of_range_(0),
+          start_ticks_(0),
+          wall_ticks_(0) {
+
+        *this = std::move(other);
+    }
+
+    inline WorkerLoad& operator=(WorkerLoad&& other) {
+        bool const active = other.active_;
+        pause();
+        other.pause();
+
+        // the source receives this measurement's slots, so it never refers to slots it no longer owns
+        std::swap(max_workers_, other.max_workers_);
+        std::swap(slots_, other.slots_);
+        out_of_range_.store(other.out_of_range_.exchange(out_of_range_.load(std::memory_order_relaxed), std::memory_order_relaxed), std::memory_order_relaxed);
+        std::swap(start_ticks_, other.start_ticks_);
+        std::swap(wall_ticks_, other.wall_ticks_);
+
+        if(active) resume();
+        return *this;
+    }
+
+    /**
+     * \brief Starts the measurement
+     * 
+     * This resets all workers' slots.
+     */
+    inline void start() {
+        reset();
+        resume();
+    }
+
+    /**
+     * \brief Pauses the wall time measurement and allocation tracking
+     * 
+     * Workers' scopes are not affected.
+     */
+    inline void pause() {
+        if(active_) {
+            wall_ticks_ += TscClock::stop_ticks() - start_ticks_;
+            unregister_callback();
+            active_ = false;
+        }
+    }
+
+    /**
+     * \brief Resumes the wall time measurement and allocation tracking
+     */
+    inline void resume() {
+        if(!active_) {
+            register_callback();
+            active_ = true;
+            start_ticks_ = TscClock::start_ticks();
+        }
+    }
+
+    /**
+     * \brief Ends the measurement
+     */
+    inline void stop() {
+        pause();
+    }
+
+    /**
+     * \brief The maximum number of workers
+     * 
+     * \return the maximum number of workers
+     */
+    size_t max_workers() const { return max_workers_; }
+
+    /**
+     * \brief The busy time of the given worker in milliseconds
+     * 
+     * \param worker the worker's number
+     * \return the worker's busy time in milliseconds
+     */
+    double busy_millis(size_t worker) const { return TscClock::to_nanos(slots_[worker].busy_ticks) * 1e-6; }
+
+    /**
+     * \brief The number of scopes the given worker has completed
+     * 
+     * \param worker the worker's number
+     * \return the worker's number of completed scopes
+     */
+    uintmax_t tasks(size_t worker) const { return slots_[worker].tasks; }
+
+    /**
+     * \brief The number of memory allocations made by the given worker within its scopes
+     * 
+     * \param worker the worker's number
+     * \return the worker's number of allocations
+     */
+    uintmax_t alloc_num(size_t worker) const { return slots_[worker].alloc_num; }
+
+    /**
+     * \brief The number of bytes allocated by the given worker within its scopes
+     * 
+     * \param worker the worker's number
+     * \return the worker's number of allocated bytes
+     */
+    uintmax_t alloc_bytes(size_t worker) const { return slots_[worker].alloc_bytes; }
+
+    /**
+     * \brief The number of scopes opened by workers whose numbers exceed the maximum number of workers
+     * 
+     * These scopes are not recorded in any slot.
+     * 
+     * \return the number of out-of-range scopes
+     */
+    uintmax_t out_of_range() const { return out_of_range_.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief The elapsed wall time in milliseconds
+     * 
+     * \return the elapsed wall time in milliseconds
+     */
+    double wall_millis() const { return TscClock::to_nanos(wall_ticks_) * 1e-6; }
+
+    /**
+     * \brief The number of workers that have completed any scope
+     * 
+     * \return the number of active workers
+     */
+    size_t num_workers() const {
+        return std::count_if(slots_.get(), slots_.get() + max_workers_, [](Slot const& s){ return s.tasks > 0; });
+    }
+
+    /**
+     * \brief The maximum busy time of any worker divided by the mean busy time of all active workers
+     * 
+     * \return the load imbalance, which is one if the load is perfectly balanced, or zero if no worker was active
+     */
+    double imbalance() const {
+        uint64_t max = 0, sum = 0;
+        for(size_t i = 0; i < max_workers_; i++) {
+            max = std::max(max, slots_[i].busy_ticks);
+            sum += slots_[i].busy_ticks;
+        }
+        auto const num = num_workers();
+        return sum ? (double)max * num / (double)sum : 0.0;
+    }
+
+    /**
+     * \brief The total busy time of all active workers divided by their number times the elapsed wall time
+     * 
+     * \return the parallel efficiency, which is one if all active workers were busy all the time, or zero if no worker was active
+     */
+    double efficiency() const {
+        uint64_t sum = 0;
+        for(size_t i = 0; i < max_workers_; i++) sum += slots_[i].busy_ticks;
+        auto const num = num_workers();
+        return (num && wall_ticks_) ? (double)sum / ((double)num * (double)wall_ticks_) : 0.0;
+    }
+
+    /**
+     * \brief The key for identifying this measurement in a data storage
+     * 
+     * \return the key for identifying this measurement in a data storage
+     */
+    std::string key() const { return "worker_load"; }
+
+    /**
+     * \brief Gathers data in a JSON data storage
+     * 
+     * The per-worker figures are reported as arrays up to the highest active worker.
+     * If any scopes were opened by workers without a slot, their number is reported as `out_of_range`.
+     * 
+     * \param data the JSON data storage
+     */
+    nlohmann::json gather_metrics() const {
+        size_t end = 0;
+        for(size_t i = 0; i < max_workers_; i++) {
+            if(slots_[i].tasks) end = i + 1;
+        }
+
+        auto busy = nlohmann::json::array();
+        auto tasks = nlohmann::json::array();
+        auto alloc_num = nlohmann::json::array();
+        auto alloc_bytes = nlohmann::json::array();
+        double max_busy = 0, sum_busy = 0;
+        for(size_t i = 0; i < end; i++) {
+            auto const b = busy_millis(i);
+            busy.push_back(b);
+            tasks.push_back(slots_[i].tasks);
+            alloc_num.push_back(slots_[i].alloc_num);
+            alloc_bytes.push_back(slots_[i].alloc_bytes);
+            max_busy = std::max(max_busy, b);
+            sum_busy += b;
+        }
+
+        auto const num = num_workers();
+
+        nlohmann::json obj;
+        obj["wall"] = wall_millis();
+        obj["workers"] = num;
+        obj["busy"] = std::move(busy);
+        obj["tasks"] = std::move(tasks);
+        obj["alloc_num"] = std::move(alloc_num);
+        obj["alloc_bytes"] = std::move(alloc_bytes);
+        obj["max_busy"] = max_busy;
+        obj["mean_busy"] = num ? sum_busy / num : 0.0;
+        obj["imbalance"] = imbalance();
+        obj["efficiency"] = efficiency();
+        if(auto const n = out_of_range()) obj["out_of_range"] = n;
+        return obj;
+    }
+};
+
+}
+
+#endif
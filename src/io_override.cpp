@@ -0,0 +1,95 @@
+/**
+ * io_override.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if defined(__linux__) && defined(__LP64__)
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pm/io/hook.hpp>
+
+// nb: the C library's stdio functions use its internal wrappers of the system calls, so their I/O is only seen when buffers are flushed or filled via these
+
+namespace {
+
+thread_local pm::io_hook::Totals totals = { 0, 0, 0, 0 };
+
+inline ssize_t on_read(ssize_t result) {
+    ++totals.read_num;
+    if(result > 0) totals.read_bytes += result;
+    return result;
+}
+
+inline ssize_t on_write(ssize_t result) {
+    ++totals.write_num;
+    if(result > 0) totals.write_bytes += result;
+    return result;
+}
+
+}
+
+pm::io_hook::Totals pm::io_hook::thread_totals() {
+    return totals;
+}
+
+// the system calls, bypassing the C library's wrappers that we override
+extern "C" ssize_t read(int fd, void* buf, size_t count) {
+    return on_read(syscall(SYS_read, fd, buf, count));
+}
+
+extern "C" ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    return on_read(syscall(SYS_pread64, fd, buf, count, offset));
+}
+
+extern "C" ssize_t pread64(int fd, void* buf, size_t count, off_t offset) {
+    return pread(fd, buf, count, offset);
+}
+
+extern "C" ssize_t write(int fd, void const* buf, size_t count) {
+    return on_write(syscall(SYS_write, fd, buf, count));
+}
+
+extern "C" ssize_t pwrite(int fd, void const* buf, size_t count, off_t offset) {
+    return on_write(syscall(SYS_pwrite64, fd, buf, count, offset));
+}
+
+extern "C" ssize_t pwrite64(int fd, void const* buf, size_t count, off_t offset) {
+    return pwrite(fd, buf, count, offset);
+}
+
+#else
+
+#pragma message "The read and write overrides are only supported on 64-bit Linux. I/O will not be tracked per thread."
+
+#include <pm/io/hook.hpp>
+
+pm::io_hook::Totals pm::io_hook::thread_totals() {
+    return { 0, 0, 0, 0 };
+}
+
+#endif
@@ -27,24 +27,182 @@
 
 #ifdef PM_MALLOC
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
 #include <pm/malloc/hook.hpp>
 #include <pm/malloc_callback.hpp>
+#include <pm/measurement_switch.hpp>
+#include <pm/thread_index.hpp>
 
 using namespace pm;
 
 void* MallocCallback::install_ = malloc(0);
 
-auto init_callback() {
-    std::vector<MallocCallback*> cb;
-    cb.reserve(32);
-    return cb;
+namespace {
+
+constexpr size_t NUM_READER_SLOTS = 128;
+
+// an immutable list of registered callbacks
+struct Snapshot {
+    size_t size;
+    MallocCallback* callbacks[MallocCallback::MAX_CALLBACKS];
+};
+
+// counts the dispatches in progress on either snapshot in a group of threads
+struct alignas(CACHE_LINE_SIZE) ReaderSlot {
+    std::atomic<size_t> active[2];
+};
+
+// nb: all of these are constant-initialized, so they are usable before any dynamic initialization has happened
+Snapshot snapshots[2];
+std::atomic<Snapshot*> current = &snapshots[0];
+std::atomic<size_t> num_callbacks = 0;
+std::mutex writer_mutex;
+ReaderSlot readers[NUM_READER_SLOTS];
+thread_local bool dispatching = false;
+thread_local uintmax_t notifications = 0;
+
+// the block whose allocation or free is currently being dispatched
+struct Event {
+    void const* block;
+    uint8_t tag;
+};
+
+thread_local Event current_event = { nullptr, 0 };
+
+// pins the current snapshot for the duration of a dispatch
+class DispatchGuard {
+private:
+    ReaderSlot& slot_;
+    Snapshot const* snapshot_;
+    size_t index_;
+
+public:
+    inline DispatchGuard() : slot_(readers[thread_index() % NUM_READER_SLOTS]) {
+        dispatching = true;
+        auto* snapshot = current.load(std::memory_order_seq_cst);
+        while(true) {
+            index_ = snapshot - snapshots;
+            slot_.active[index_].fetch_add(1, std::memory_order_seq_cst);
+
+            // the snapshot is pinned unless it has been replaced in the meantime
+            auto* const check = current.load(std::memory_order_seq_cst);
+            if(check == snapshot) break;
+
+            slot_.active[index_].fetch_sub(1, std::memory_order_release);
+            snapshot = check;
+        }
+        snapshot_ = snapshot;
+    }
+
+    inline ~DispatchGuard() {
+        slot_.active[index_].fetch_sub(1, std::memory_order_release);
+        dispatching = false;
+    }
+
+    inline Snapshot const& snapshot() const { return *snapshot_; }
+};
+
+// waits until no thread is dispatching to the given snapshot, which has been replaced before the call
+// nb: dispatches that begin afterwards pin the replacement, so they cannot hold up the wait
+void wait_for_readers(Snapshot const* replaced) {
+    size_t const index = replaced - snapshots;
+    for(auto& r : readers) {
+        while(r.active[index].load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// publishes the snapshot computed by f from the current one
+template<typename F>
+void update(F&& f) {
+    auto* cur = current.load(std::memory_order_relaxed);
+    auto* next = (cur == &snapshots[0]) ? &snapshots[1] : &snapshots[0];
+    f(*cur, *next);
+    current.store(next, std::memory_order_seq_cst);
+    num_callbacks.store(next->size, std::memory_order_relaxed);
+
+    // wait for all readers of the old snapshot, so it can be safely overwritten by the next update
+    wait_for_readers(cur);
 }
 
-std::vector<MallocCallback*> MallocCallback::registry_ = init_callback();
-bool MallocCallback::critical_ = false;
+}
+
+void MallocCallback::register_callback() {
+    std::lock_guard lock(writer_mutex);
+    if(registered_) return;
+
+    if(current.load(std::memory_order_relaxed)->size >= MAX_CALLBACKS) {
+        throw std::length_error("too many registered malloc callbacks");
+    }
+
+    update([&](Snapshot const& cur, Snapshot& next){
+        std::copy(cur.callbacks, cur.callbacks + cur.size, next.callbacks);
+        next.callbacks[cur.size] = this;
+        next.size = cur.size + 1;
+    });
+    registered_ = true;
+}
+
+void MallocCallback::unregister_callback() {
+    std::lock_guard lock(writer_mutex);
+    if(!registered_) return;
+
+    update([&](Snapshot const& cur, Snapshot& next){
+        auto end = std::remove_copy(cur.callbacks, cur.callbacks + cur.size, next.callbacks, this);
+        next.size = end - next.callbacks;
+    });
+    registered_ = false;
+}
+
+void MallocCallback::notify_malloc(size_t bytes, uint8_t tag, void const* block) {
+    // nb: without callbacks, this is the only work done per event
+    if(num_callbacks.load(std::memory_order_relaxed) == 0) return;
+    if(dispatching || !MeasurementSwitch::enabled()) return;
+
+    ++notifications;
+    current_event = { block, tag };
+    DispatchGuard guard;
+    auto const& snapshot = guard.snapshot();
+    for(size_t i = 0; i < snapshot.size; i++) snapshot.callbacks[i]->on_alloc(bytes);
+}
+
+void MallocCallback::notify_free(size_t bytes, uint8_t tag, void const* block) {
+    // nb: without callbacks, this is the only work done per event
+    if(num_callbacks.load(std::memory_order_relaxed) == 0) return;
+    if(dispatching || !MeasurementSwitch::enabled()) return;
+
+    ++notifications;
+    current_event = { block, tag };
+    DispatchGuard guard;
+    auto const& snapshot = guard.snapshot();
+    for(size_t i = 0; i < snapshot.size; i++) snapshot.callbacks[i]->on_free(bytes);
+}
+
+uintmax_t MallocCallback::num_notifications() {
+    return notifications;
+}
+
+size_t MallocCallback::num_registered() {
+    return num_callbacks.load(std::memory_order_relaxed);
+}
+
+uint8_t MallocCallback::event_tag() {
+    return current_event.tag;
+}
+
+void const* MallocCallback::event_block() {
+    return current_event.block;
+}
 
 // implement malloc_hook
-void malloc_hook::on_malloc(size_t bytes) { MallocCallback::notify_malloc(bytes); }
-void malloc_hook::on_free(size_t bytes)   { MallocCallback::notify_free(bytes); }
+void malloc_hook::on_malloc(void const* ptr, size_t bytes, uint8_t tag) { MallocCallback::notify_malloc(bytes, tag, ptr); }
+void malloc_hook::on_free(void const* ptr, size_t bytes, uint8_t tag)   { MallocCallback::notify_free(bytes, tag, ptr); }
 
 #endif
@@ -33,51 +33,318 @@
 
 #define GNU_SOURCE
 
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <malloc.h>
+#include <unistd.h>
 #include <pm/malloc/hook.hpp>
 
+#ifdef PM_MALLOC_RTLD_NEXT
+#include <atomic>
+#include <dlfcn.h>
+#endif
+
+static_assert(sizeof(char) == 1); // sanity
+
+// access to the underlying allocator
+#ifdef PM_MALLOC_RTLD_NEXT
+
+// the underlying allocator is the next one in link order, which is looked up using dlsym
+// dlsym may allocate memory itself, which is served from a static bootstrap buffer during the lookup
+
+namespace {
+
+using MallocFunc = void* (*)(size_t);
+using FreeFunc = void (*)(void*);
+using ReallocFunc = void* (*)(void*, size_t);
+using MemalignFunc = void* (*)(size_t, size_t);
+using UsableSizeFunc = size_t (*)(void*);
+
+MallocFunc next_malloc_ = nullptr;
+FreeFunc next_free_ = nullptr;
+ReallocFunc next_realloc_ = nullptr;
+MemalignFunc next_memalign_ = nullptr;
+UsableSizeFunc next_malloc_usable_size_ = nullptr;
+
+constexpr int UNRESOLVED = 0;
+constexpr int RESOLVING = 1;
+constexpr int RESOLVED = 2;
+std::atomic<int> state = UNRESOLVED;
+
+constexpr size_t BOOTSTRAP_BUFFER_SIZE = 64 * 1024;
+alignas(std::max_align_t) char bootstrap_buffer[BOOTSTRAP_BUFFER_SIZE];
+std::atomic<size_t> bootstrap_used = 0;
+
+void* bootstrap_alloc(size_t alignment, size_t size) {
+    alignment = std::max(alignment, alignof(std::max_align_t));
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+    size_t used = bootstrap_used.load(std::memory_order_relaxed);
+    size_t offset;
+    do {
+        offset = (used + alignment - 1) & ~(alignment - 1);
+        if(offset + size > BOOTSTRAP_BUFFER_SIZE) return NULL; // out of bootstrap memory
+    } while(!bootstrap_used.compare_exchange_weak(used, offset + size, std::memory_order_relaxed));
+    return bootstrap_buffer + offset;
+}
+
+inline bool is_bootstrap(void* ptr) {
+    return ptr >= bootstrap_buffer && ptr < bootstrap_buffer + BOOTSTRAP_BUFFER_SIZE;
+}
+
+// the number of bytes of the bootstrap buffer after the given pointer
+inline size_t bootstrap_remaining(void* ptr) {
+    return bootstrap_buffer + BOOTSTRAP_BUFFER_SIZE - (char*)ptr;
+}
+
+// resolves the underlying allocator, returns false if the lookup is currently in progress
+bool resolve() {
+    int expected = UNRESOLVED;
+    if(state.compare_exchange_strong(expected, RESOLVING, std::memory_order_acquire)) {
+        next_malloc_ = (MallocFunc)dlsym(RTLD_NEXT, "malloc");
+        next_free_ = (FreeFunc)dlsym(RTLD_NEXT, "free");
+        next_realloc_ = (ReallocFunc)dlsym(RTLD_NEXT, "realloc");
+        next_memalign_ = (MemalignFunc)dlsym(RTLD_NEXT, "memalign");
+        next_malloc_usable_size_ = (UsableSizeFunc)dlsym(RTLD_NEXT, "malloc_usable_size");
+        state.store(RESOLVED, std::memory_order_release);
+        return true;
+    } else {
+        return expected == RESOLVED;
+    }
+}
+
+inline bool resolved() {
+    return state.load(std::memory_order_acquire) == RESOLVED || resolve();
+}
+
+// resolve the underlying allocator early, before any threads are started
+__attribute__((constructor(101))) void init() {
+    resolve();
+}
+
+inline void* next_malloc(size_t size) {
+    return resolved() ? next_malloc_(size) : bootstrap_alloc(alignof(std::max_align_t), size);
+}
+
+inline void next_free(void* ptr) {
+    // nb: blocks allocated during the bootstrap are never freed
+    if(!is_bootstrap(ptr) && resolved()) next_free_(ptr);
+}
+
+inline void* next_realloc(void* ptr, size_t size) {
+    if(is_bootstrap(ptr)) {
+        // move blocks allocated during the bootstrap into the underlying allocator
+        void* new_ptr = next_malloc(size);
+        if(new_ptr) memcpy(new_ptr, ptr, std::min(size, bootstrap_remaining(ptr)));
+        return new_ptr;
+    }
+    return resolved() ? next_realloc_(ptr, size) : NULL;
+}
+
+inline void* next_memalign(size_t alignment, size_t size) {
+    return resolved() ? next_memalign_(alignment, size) : bootstrap_alloc(alignment, size);
+}
+
+inline size_t next_malloc_usable_size(void* ptr) {
+    if(is_bootstrap(ptr)) return 0; // nb: untracked
+    return resolved() ? next_malloc_usable_size_(ptr) : 0;
+}
+
+}
+
+#else
+
+// the underlying allocator is glibc's
+
 extern "C" void* __libc_malloc(size_t);
 extern "C" void  __libc_free(void*);
 extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void* __libc_memalign(size_t, size_t);
 
-static_assert(sizeof(char) == 1); // sanity
+namespace {
+
+inline void* next_malloc(size_t size) { return __libc_malloc(size); }
+inline void next_free(void* ptr) { __libc_free(ptr); }
+inline void* next_realloc(void* ptr, size_t size) { return __libc_realloc(ptr, size); }
+inline void* next_memalign(size_t alignment, size_t size) { return __libc_memalign(alignment, size); }
+
+#ifdef PM_MALLOC_USABLE_SIZE
+inline size_t next_malloc_usable_size(void* ptr) { return malloc_usable_size(ptr); }
+#endif
+
+}
+
+#endif
+
+#ifdef PM_MALLOC_USABLE_SIZE
+
+// nb: without a block header, a free cannot tell whether the block was allocated untracked or with which tag,
+// so all allocations are tracked and untagged
+bool pm::malloc_hook::set_untracked(bool) {
+    return false;
+}
+
+uint8_t pm::malloc_hook::set_tag(uint8_t) {
+    return 0;
+}
+
+// the sizes of blocks are queried from the allocator using malloc_usable_size, so no block header is needed
+// nb: this reports the usable sizes of blocks, which may be larger than the requested sizes
+
+extern "C" void* malloc(size_t size) {
+    if(!size) return NULL;
+
+    void* ptr = next_malloc(size);
+    if(!ptr) return ptr; // malloc failed
+
+    pm::malloc_hook::on_malloc(ptr, next_malloc_usable_size(ptr), 0);
+    return ptr;
+}
+
+extern "C" void free(void* ptr) {
+    if(!ptr) return;
+
+    pm::malloc_hook::on_free(ptr, next_malloc_usable_size(ptr), 0);
+    next_free(ptr);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    if(!size) {
+        free(ptr);
+        return NULL;
+    } else if(!ptr) {
+        return malloc(size);
+    } else {
+        // nb: the free is reported before the old block is released, because another thread may be handed out its address right afterwards
+        size_t const old_size = next_malloc_usable_size(ptr);
+        pm::malloc_hook::on_free(ptr, old_size, 0);
+
+        void* new_ptr = next_realloc(ptr, size);
+        if(!new_ptr) {
+            // realloc failed, the old block remains valid
+            pm::malloc_hook::on_malloc(ptr, old_size, 0);
+            return new_ptr;
+        }
 
-constexpr size_t MEMBLOCK_MAGIC = 0xFEDCBA9876543210;
+        pm::malloc_hook::on_malloc(new_ptr, next_malloc_usable_size(new_ptr), 0);
+        return new_ptr;
+    }
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) {
+    if(!size) return NULL;
+
+    void* ptr = next_memalign(alignment, size);
+    if(!ptr) return ptr; // memalign failed
+
+    pm::malloc_hook::on_malloc(ptr, next_malloc_usable_size(ptr), 0);
+    return ptr;
+}
+
+#else
+
+// the 16 lowest bits of the magic number hold the block's flags and allocation tag
+constexpr size_t MEMBLOCK_MAGIC = 0xFEDCBA9876540000;
+constexpr size_t MEMBLOCK_META = 0xFFFF;
+constexpr size_t MEMBLOCK_ALIGNED = 0x1;   // the block has an AlignedBlockHeader
+constexpr size_t MEMBLOCK_UNTRACKED = 0x2; // neither the allocation nor the free of the block are reported
+constexpr size_t MEMBLOCK_TAG_SHIFT = 8;   // the allocation tag is stored in bits 8 to 15
+constexpr size_t MEMBLOCK_TAG = 0xFF << MEMBLOCK_TAG_SHIFT;
+
+namespace {
+
+// the flags and allocation tag of blocks allocated by the current thread
+thread_local size_t meta = 0;
+
+}
+
+bool pm::malloc_hook::set_untracked(bool value) {
+    bool const prev = meta & MEMBLOCK_UNTRACKED;
+    meta = value ? (meta | MEMBLOCK_UNTRACKED) : (meta & ~MEMBLOCK_UNTRACKED);
+    return prev;
+}
+
+uint8_t pm::malloc_hook::set_tag(uint8_t tag) {
+    uint8_t const prev = (meta & MEMBLOCK_TAG) >> MEMBLOCK_TAG_SHIFT;
+    meta = (meta & ~MEMBLOCK_TAG) | ((size_t)tag << MEMBLOCK_TAG_SHIFT);
+    return prev;
+}
 
 struct BlockHeader {
     size_t magic;
     size_t size;
 };
 
+// header of blocks with alignments larger than that of a regular malloc
+// the block allocated from the underlying allocator begins offset bytes before the returned pointer
+struct AlignedBlockHeader {
+    size_t offset;
+    BlockHeader block;
+};
+
+inline BlockHeader* get_header(void* ptr) {
+    return (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
+}
+
 inline bool is_managed(BlockHeader* block) {
-    return (block->magic == MEMBLOCK_MAGIC);
+    return (block->magic & ~MEMBLOCK_META) == MEMBLOCK_MAGIC;
+}
+
+inline bool is_aligned(BlockHeader* block) {
+    return block->magic & MEMBLOCK_ALIGNED;
+}
+
+inline bool is_tracked(BlockHeader* block) {
+    return !(block->magic & MEMBLOCK_UNTRACKED);
+}
+
+inline uint8_t get_tag(BlockHeader* block) {
+    return (block->magic & MEMBLOCK_TAG) >> MEMBLOCK_TAG_SHIFT;
+}
+
+// the pointer to the block allocated from the underlying allocator
+inline void* get_base(void* ptr, BlockHeader* block) {
+    if(is_aligned(block)) {
+        auto aligned_block = (AlignedBlockHeader*)((char*)ptr - sizeof(AlignedBlockHeader));
+        return (char*)ptr - aligned_block->offset;
+    } else {
+        return block;
+    }
 }
 
 extern "C" void* malloc(size_t size) {
     if(!size) return NULL;
 
-    void *ptr = __libc_malloc(size + sizeof(BlockHeader));
+    void *ptr = next_malloc(size + sizeof(BlockHeader));
     if(!ptr) return ptr; // malloc failed
 
     auto block = (BlockHeader*)ptr;
-    block->magic = MEMBLOCK_MAGIC;
+    block->magic = MEMBLOCK_MAGIC | meta;
     block->size = size;
 
-    pm::malloc_hook::on_malloc(size);
+    void* const user_ptr = (char*)ptr + sizeof(BlockHeader);
+    if(is_tracked(block)) pm::malloc_hook::on_malloc(user_ptr, size, get_tag(block));
 
-    return (char*)ptr + sizeof(BlockHeader);
+    return user_ptr;
 }
 
 extern "C" void free(void* ptr) {
     if(!ptr) return;
 
-    auto block = (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
+    auto block = get_header(ptr);
     if(is_managed(block)) {
-        pm::malloc_hook::on_free(block->size);
-        __libc_free(block);
+        if(is_tracked(block)) pm::malloc_hook::on_free(ptr, block->size, get_tag(block));
+
+        void* base = get_base(ptr, block);
+        block->magic = 0; // avoid mistaking stale headers for managed blocks
+        next_free(base);
     } else {
-        __libc_free(ptr);
+        next_free(ptr);
     }
 }
 
@@ -88,34 +355,117 @@ extern "C" void* realloc(void* ptr, size_t size) {
     } else if(!ptr) {
         return malloc(size);
     } else {
-        auto block = (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
-        if(is_managed(block)) {
+        auto block = get_header(ptr);
+        if(is_managed(block) && !is_aligned(block)) {
             size_t old_size = block->size;
-            void *new_ptr = __libc_realloc(block, size + sizeof(BlockHeader));
+            bool const old_tracked = is_tracked(block);
+            uint8_t const old_tag = get_tag(block);
+
+            // nb: the free is reported before the old block is released, because another thread may be handed out its address right afterwards
+            if(old_tracked) pm::malloc_hook::on_free(ptr, old_size, old_tag);
 
+            void *new_ptr = next_realloc(block, size + sizeof(BlockHeader));
+            if(!new_ptr) {
+                // realloc failed, the old block remains valid
+                if(old_tracked) pm::malloc_hook::on_malloc(ptr, old_size, old_tag);
+                return new_ptr;
+            }
+
+            // nb: whether the new block is tracked and its tag depend on the current thread, not on the old block
             auto new_block = (BlockHeader*)new_ptr;
-            new_block->magic = MEMBLOCK_MAGIC; // just making sure
+            new_block->magic = MEMBLOCK_MAGIC | meta;
             new_block->size = size;
 
-            pm::malloc_hook::on_free(old_size);
-            pm::malloc_hook::on_malloc(size);
+            void* const user_ptr = (char*)new_ptr + sizeof(BlockHeader);
+            if(is_tracked(new_block)) pm::malloc_hook::on_malloc(user_ptr, size, get_tag(new_block));
+
+            return user_ptr;
+        } else if(is_managed(block)) {
+            // the underlying allocator cannot reallocate an aligned block with an offset, so we move it manually
+            void* new_ptr = malloc(size);
+            if(!new_ptr) return new_ptr; // malloc failed, the old block remains valid
 
-            return (char*)new_ptr + sizeof(BlockHeader);
+            memcpy(new_ptr, ptr, std::min(size, block->size));
+            free(ptr);
+            return new_ptr;
         } else {
-            return __libc_realloc(ptr, size);
+            return next_realloc(ptr, size);
         }
     }
 }
 
+extern "C" void* memalign(size_t alignment, size_t size) {
+    // like glibc, treat alignments that are not a power of two as the next power of two
+    alignment = std::bit_ceil(alignment);
+
+    // blocks returned by malloc are already aligned suitably for any fundamental type
+    if(alignment <= alignof(std::max_align_t)) return malloc(size);
+    if(!size) return NULL;
+
+    // alignment is now a power of two larger than sizeof(AlignedBlockHeader),
+    // so the header fits in front of the first aligned address within the block
+    if(size > SIZE_MAX - alignment) return NULL; // overflow
+    void* base = next_memalign(alignment, size + alignment);
+    if(!base) return base; // memalign failed
+
+    char* ptr = (char*)base + alignment;
+    auto aligned_block = (AlignedBlockHeader*)(ptr - sizeof(AlignedBlockHeader));
+    aligned_block->offset = alignment;
+    aligned_block->block.magic = MEMBLOCK_MAGIC | MEMBLOCK_ALIGNED | meta;
+    aligned_block->block.size = size;
+
+    if(is_tracked(&aligned_block->block)) pm::malloc_hook::on_malloc(ptr, size, get_tag(&aligned_block->block));
+
+    return ptr;
+}
+
+extern "C" size_t malloc_usable_size(void* ptr) {
+    if(!ptr) return 0;
+
+    auto block = get_header(ptr);
+    if(is_managed(block)) return block->size;
+
+    #ifdef PM_MALLOC_RTLD_NEXT
+    // e.g., a block allocated before the overrides were loaded
+    return next_malloc_usable_size(ptr);
+    #else
+    // nb: glibc's allocator is only reachable through the overrides, so every block it hands out is managed
+    return 0;
+    #endif
+}
+
+#endif
+
 extern "C" void* calloc(size_t num, size_t size) {
     size *= num;
     if(!size) return NULL;
 
     void* ptr = malloc(size);
-    memset(ptr, 0, size);
+    if(ptr) memset(ptr, 0, size);
     return ptr;
 }
 
-// TODO: aligned_alloc
+extern "C" void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if(alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+
+    void* ptr = memalign(alignment, size);
+    if(!ptr && size) return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+extern "C" void* valloc(size_t size) {
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+extern "C" void* pvalloc(size_t size) {
+    size_t const page_size = sysconf(_SC_PAGESIZE);
+    return memalign(page_size, ((size + page_size - 1) / page_size) * page_size);
+}
 
 #endif
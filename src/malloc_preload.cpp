@@ -0,0 +1,157 @@
+/**
+ * malloc_preload.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// installs a process-wide allocation counter when loaded via LD_PRELOAD
+// the counter's metrics are written to the file given by PM_PRELOAD_OUTPUT (or stderr) on exit,
+// and whenever the signal given by PM_PRELOAD_SIGNAL is received
+
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pm/sharded_malloc_counter.hpp>
+
+namespace {
+
+constexpr char const* ENV_OUTPUT = "PM_PRELOAD_OUTPUT";
+constexpr char const* ENV_SIGNAL = "PM_PRELOAD_SIGNAL";
+
+// the counter is never destroyed, so it keeps counting during the destruction of static objects
+alignas(pm::ShardedMallocCounter) char counter_storage[sizeof(pm::ShardedMallocCounter)];
+pm::ShardedMallocCounter* counter = nullptr;
+
+// the output path, with %p replaced by the process ID when a report is written
+char output_path[4096];
+
+// buffer for formatting reports
+struct Writer {
+    char buffer[512];
+    char* pos = buffer;
+
+    void append(char const* s) {
+        size_t const len = strlen(s);
+        memcpy(pos, s, len);
+        pos += len;
+    }
+
+    template<typename T>
+    void append(T value) {
+        pos = std::to_chars(pos, buffer + sizeof(buffer), value).ptr;
+    }
+
+    template<typename T>
+    void append_field(char const* key, T value, bool last = false) {
+        append("\"");
+        append(key);
+        append("\":");
+        append(value);
+        if(!last) append(",");
+    }
+};
+
+// formats the output path for the current process
+void format_output_path(char* path, size_t size) {
+    char* out = path;
+    char* const end = path + size - 1;
+    for(char const* p = output_path; *p && out < end; p++) {
+        if(p[0] == '%' && p[1] == 'p') {
+            out = std::to_chars(out, end, getpid()).ptr;
+            ++p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = 0;
+}
+
+// writes a report in the format of pm::ShardedMallocCounter::gather_metrics as a single line of JSON
+// nb: this is async-signal-safe, so it can be called from a signal handler
+void report() {
+    Writer w;
+    w.append("{");
+    w.append_field("alloc_bytes", counter->alloc_bytes());
+    w.append_field("alloc_num", counter->alloc_num());
+    w.append_field("closing", counter->count());
+    w.append_field("free_bytes", counter->free_bytes());
+    w.append_field("free_num", counter->free_num());
+    w.append_field("peak", counter->peak(), true);
+    w.append("}\n");
+
+    int fd = STDERR_FILENO;
+    if(output_path[0]) {
+        char path[sizeof(output_path) + 16];
+        format_output_path(path, sizeof(path));
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0) return;
+    }
+
+    for(char const* p = w.buffer; p < w.pos;) {
+        auto const written = write(fd, p, w.pos - p);
+        if(written <= 0) break;
+        p += written;
+    }
+
+    if(fd != STDERR_FILENO) close(fd);
+}
+
+void on_signal(int) {
+    int const saved_errno = errno;
+    report();
+    errno = saved_errno;
+}
+
+void on_exit() {
+    counter->stop();
+    report();
+}
+
+__attribute__((constructor(102))) void init() {
+    if(auto path = getenv(ENV_OUTPUT)) {
+        strncpy(output_path, path, sizeof(output_path) - 1);
+    }
+
+    // the counter must exist before the signal handler can report it
+    counter = new(counter_storage) pm::ShardedMallocCounter();
+    counter->start();
+    atexit(on_exit);
+
+    if(auto sig = getenv(ENV_SIGNAL)) {
+        struct sigaction action = {};
+        action.sa_handler = on_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(atoi(sig), &action, nullptr);
+    }
+}
+
+}
@@ -0,0 +1,120 @@
+/**
+ * mmap_override.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if defined(__linux__) && defined(__LP64__)
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pm/malloc/mmap_hook.hpp>
+
+// nb: glibc's malloc maps memory using its internal __mmap, so it is not seen here and not counted twice
+
+namespace {
+
+std::atomic<uintmax_t> map_num = 0;
+std::atomic<uintmax_t> map_bytes = 0;
+std::atomic<uintmax_t> unmap_num = 0;
+std::atomic<uintmax_t> unmap_bytes = 0;
+
+void on_map(size_t bytes) {
+    map_num.fetch_add(1, std::memory_order_relaxed);
+    map_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void on_unmap(size_t bytes) {
+    unmap_num.fetch_add(1, std::memory_order_relaxed);
+    unmap_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// the system calls, bypassing the C library's wrappers that we override
+void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    return (void*)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+}
+
+}
+
+pm::mmap_hook::Totals pm::mmap_hook::totals() {
+    return {
+        map_num.load(std::memory_order_relaxed),
+        map_bytes.load(std::memory_order_relaxed),
+        unmap_num.load(std::memory_order_relaxed),
+        unmap_bytes.load(std::memory_order_relaxed)
+    };
+}
+
+extern "C" void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    void* ptr = sys_mmap(addr, length, prot, flags, fd, offset);
+    if(ptr != MAP_FAILED) on_map(length);
+    return ptr;
+}
+
+extern "C" void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+extern "C" int munmap(void* addr, size_t length) {
+    int const result = (int)syscall(SYS_munmap, addr, length);
+    if(result == 0) on_unmap(length);
+    return result;
+}
+
+extern "C" void* mremap(void* old_address, size_t old_size, size_t new_size, int flags, ...) {
+    void* new_address = nullptr;
+    if(flags & MREMAP_FIXED) {
+        va_list args;
+        va_start(args, flags);
+        new_address = va_arg(args, void*);
+        va_end(args);
+    }
+
+    void* ptr = (void*)syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+    if(ptr != MAP_FAILED) {
+        if(new_size > old_size) {
+            on_map(new_size - old_size);
+        } else if(new_size < old_size) {
+            on_unmap(old_size - new_size);
+        }
+    }
+    return ptr;
+}
+
+#else
+
+#pragma message "The mmap override is only supported on 64-bit Linux. Mapped memory will not be tracked."
+
+#include <pm/malloc/mmap_hook.hpp>
+
+pm::mmap_hook::Totals pm::mmap_hook::totals() {
+    return { 0, 0, 0, 0 };
+}
+
+#endif
@@ -2,11 +2,25 @@
 #include "doctest.h"
 
 #include <pm.hpp>
+#include <pm/benchmark.hpp>
 
 namespace pm::examples {
 
 using namespace pm;
 
+PM_BENCHMARK_PHASE(sum, pm::MemoryTimePhase) {
+    size_t const bufsize = 100'000;
+    char* buffer = new char[bufsize];
+    for(size_t i = 0; i < bufsize; i++) buffer[i] = (char)i;
+
+    int sum = 0;
+    for(size_t i = 0; i < bufsize; i++) sum += buffer[i];
+    pm::do_not_optimize(sum);
+    delete[] buffer;
+
+    phase.data()["sum"] = sum;
+}
+
 // nb: these aren't really "unit tests", they mainly exist to check whether the examples compile
 TEST_SUITE("pm") {
     TEST_CASE("MemoryTimePhase") { 
@@ -36,7 +50,11 @@ TEST_SUITE("pm") {
         {
             auto const json = compute_phase.gather_data();
             CHECK(json[pm::JSON_KEY_DATA]["sum"] == -497952);
+            #ifdef PM_MALLOC_USABLE_SIZE
+            CHECK(json[pm::JSON_KEY_METRICS]["memory"]["peak"] >= 1'000'000); // nb: usable size
+            #else
             CHECK(json[pm::JSON_KEY_METRICS]["memory"]["peak"] == 1'000'000);
+            #endif
         }
     }
 
@@ -101,6 +119,68 @@ TEST_SUITE("pm") {
 
         std::cout << compute_phase.gather_data().dump(4) << std::endl;
     }
+
+    TEST_CASE("Benchmark") {
+        pm::BenchmarkConfig config;
+        config.warmup = 1;
+        config.max_repetitions = 20;
+        config.budget_millis = 100.0;
+
+        auto const results = pm::BenchmarkRegistry::run("^sum$", config);
+        std::cout << results.dump(4) << std::endl;
+
+        // not in example:
+        {
+            REQUIRE(results.size() == 1);
+            auto const& json = results[0];
+            CHECK(json[pm::JSON_KEY_NAME] == "sum");
+            CHECK(json[pm::JSON_KEY_DATA]["repetitions"] >= config.min_repetitions);
+            CHECK(json[pm::JSON_KEY_DATA]["repetitions"] <= config.max_repetitions);
+            CHECK(json[pm::JSON_KEY_METRICS]["time"]["median"] > 0.0);
+            #ifdef PM_MALLOC_USABLE_SIZE
+            CHECK(json[pm::JSON_KEY_METRICS]["memory"]["peak"]["min"] >= 100'000); // nb: usable size
+            #else
+            CHECK(json[pm::JSON_KEY_METRICS]["memory"]["peak"]["min"] == 100'000);
+            #endif
+        }
+    }
+
+    void scoped_iota(char* buffer, size_t bufsize) {
+        pm::ScopedPhase<pm::TimePhase> scope("Iota");
+        for(size_t i = 0; i < bufsize; i++) buffer[i] = (char)i;
+    }
+
+    int scoped_sum(char const* buffer, size_t bufsize) {
+        pm::ScopedPhase<pm::TimePhase> scope("Sum");
+        int sum = 0;
+        for(size_t i = 0; i < bufsize; i++) sum += buffer[i];
+        return sum;
+    }
+
+    TEST_CASE("Scoped") {
+        pm::MemoryTimePhase compute_phase("Example");
+        {
+            pm::ScopedPhase scope(compute_phase);
+
+            size_t const bufsize = 1'000'000;
+            char* buffer = new char[bufsize];
+            scoped_iota(buffer, bufsize);
+            int const sum = scoped_sum(buffer, bufsize);
+            delete[] buffer;
+
+            compute_phase.data()["sum"] = sum;
+        }
+
+        std::cout << compute_phase.gather_data().dump(4) << std::endl;
+
+        // not in example:
+        {
+            auto const json = compute_phase.gather_data();
+            REQUIRE(json[pm::JSON_KEY_CHILDREN].size() == 2);
+            CHECK(json[pm::JSON_KEY_CHILDREN][0][pm::JSON_KEY_NAME] == "Iota");
+            CHECK(json[pm::JSON_KEY_CHILDREN][1][pm::JSON_KEY_NAME] == "Sum");
+        }
+    }
 }
 
 }
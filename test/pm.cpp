@@ -3,7 +3,17 @@
 
 #include <thread>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <pm.hpp>
+#include <pm/benchmark.hpp>
+#include <pm/record_log.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 namespace pm::test {
 
@@ -34,6 +44,168 @@ TEST_SUITE("pm") {
         }
     }
 
+    TEST_CASE("TscStopwatch") {
+        TscClock::calibrate();
+        CHECK(TscClock::ticks_per_nano() > 0.0);
+
+        TscStopwatch s;
+        CHECK(s.elapsed_time_millis() == 0);
+        CHECK(s.key() == "time");
+
+        SUBCASE("single") {
+            s.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s.stop();
+
+            // allow for some calibration error
+            CHECK(s.elapsed_time_millis() >= 9.5);
+            CHECK(s.elapsed_cycles() > 0);
+        }
+
+        SUBCASE("pause_resume") {
+            s.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s.pause();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s.resume();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s.stop();
+            CHECK(s.elapsed_time_millis() >= 19.0);
+            CHECK(s.elapsed_time_millis() < 30.0);
+        }
+
+        SUBCASE("cycles") {
+            Phase<TscCycleStopwatch> phase("test");
+            phase.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            phase.stop();
+
+            auto const cycles = phase.meter<0>().elapsed_cycles();
+            CHECK(cycles > 0);
+            CHECK(phase.gather_data()[JSON_KEY_METRICS]["cycles"] == cycles);
+        }
+    }
+
+    TEST_CASE("LapHistogram") {
+        LapHistogram h({ 50.0, 99.0, 99.9 });
+        CHECK(h.count() == 0);
+        CHECK(h.percentile_nanos(50.0) == 0.0);
+
+        SUBCASE("record") {
+            // record 1000 laps of 1000 ticks and 10 laps of 100000 ticks
+            for(size_t i = 0; i < 1000; i++) h.record(1000);
+            for(size_t i = 0; i < 10; i++) h.record(100000);
+            CHECK(h.count() == 1010);
+
+            auto const tick = TscClock::to_nanos(1);
+            CHECK(h.min_nanos() == doctest::Approx(1000 * tick));
+            CHECK(h.max_nanos() == doctest::Approx(100000 * tick));
+
+            // percentiles are exact up to the bucket width
+            CHECK(h.percentile_nanos(0.0) >= 1000 * tick);
+            CHECK(h.percentile_nanos(50.0) >= 1000 * tick);
+            CHECK(h.percentile_nanos(50.0) <= 1000 * tick * (1.0 + 1.0 / LapHistogram::Buckets::SUB_BUCKETS));
+            CHECK(h.percentile_nanos(99.9) == doctest::Approx(100000 * tick));
+            CHECK(h.percentile_nanos(100.0) == doctest::Approx(100000 * tick));
+
+            auto const json = h.gather_metrics();
+            CHECK(json["count"] == 1010);
+            CHECK(json.contains("p50"));
+            CHECK(json.contains("p99"));
+            CHECK(json.contains("p99_9"));
+
+            h.reset();
+            CHECK(h.count() == 0);
+        }
+
+        SUBCASE("move") {
+            for(size_t i = 0; i < 10; i++) h.record(1000);
+
+            // a moved-from histogram is empty and remains usable
+            LapHistogram moved(std::move(h));
+            CHECK(moved.count() == 10);
+            CHECK(h.count() == 0);
+            h.start();
+            h.stop();
+            h.record(1000);
+            h.reset();
+            CHECK(h.count() == 0);
+            CHECK(h.gather_metrics()["count"] == 0);
+        }
+
+        SUBCASE("laps") {
+            for(size_t i = 0; i < 100; i++) {
+                h.start();
+                h.stop();
+            }
+            h.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            h.stop();
+
+            CHECK(h.count() == 101);
+            CHECK(h.max_nanos() >= 900'000.0);
+            CHECK(h.percentile_nanos(50.0) < h.max_nanos());
+        }
+
+        SUBCASE("pause") {
+            h.start();
+            h.pause();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            h.resume();
+            h.stop();
+
+            CHECK(h.count() == 1);
+            CHECK(h.max_nanos() < 900'000.0);
+        }
+    }
+
+    TEST_CASE("CpuTime") {
+        auto spin = [](std::chrono::milliseconds duration){
+            auto const until = std::chrono::steady_clock::now() + duration;
+            while(std::chrono::steady_clock::now() < until) {}
+        };
+
+        SUBCASE("thread") {
+            ThreadCpuTime t;
+            CHECK(t.elapsed_time_millis() == 0);
+
+            t.start();
+            spin(std::chrono::milliseconds(20));
+            t.pause();
+            spin(std::chrono::milliseconds(20));
+            t.resume();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            t.stop();
+
+            // sleeping and paused time must not count, but we may have been descheduled while spinning
+            CHECK(t.elapsed_time_millis() > 0.0);
+            CHECK(t.elapsed_time_millis() < 30.0);
+        }
+
+        SUBCASE("process") {
+            ProcessCpuTime t;
+            t.start();
+            std::thread worker([&](){ spin(std::chrono::milliseconds(10)); });
+            worker.join();
+            t.stop();
+
+            CHECK(t.elapsed_time_millis() > 0.0);
+            CHECK(t.key() == "process_cpu_time");
+        }
+
+        SUBCASE("context_switches") {
+            ContextSwitches c;
+            c.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            c.stop();
+
+            // sleeping blocks the thread
+            CHECK(c.voluntary() >= 1);
+            CHECK(c.gather_metrics()["voluntary"] == c.voluntary());
+            CHECK(c.gather_metrics()["involuntary"] == c.involuntary());
+        }
+    }
+
     TEST_CASE("MallocCounter") {
         // because the malloc override is disabled, we shouldn't be counting anything!
         SUBCASE("basic") {
@@ -57,6 +229,403 @@ TEST_SUITE("pm") {
         }
     }
 
+    TEST_CASE("ShardedMallocCounter") {
+        // because the malloc override is disabled, we shouldn't be counting anything!
+        ShardedMallocCounter c;
+        c.start();
+        {
+            char* array = new char[1024];
+            array[0] = 0;
+            CHECK(c.count() == 0);
+            delete[] array;
+        }
+        c.stop();
+
+        CHECK(c.count() == 0);
+        CHECK(c.peak() == 0);
+        CHECK(c.alloc_num() == 0);
+        CHECK(c.free_num() == 0);
+    }
+
+    TEST_CASE("MallocSampler") {
+        // because the malloc override is disabled, we shouldn't be sampling anything!
+        Phase<MallocSampler> phase("test");
+        phase.meter<0>() = MallocSampler(1);
+        phase.start();
+        {
+            char* array = new char[1024];
+            array[0] = 0;
+            delete[] array;
+        }
+        phase.stop();
+
+        CHECK(phase.meter<0>().samples() == 0);
+        CHECK(phase.gather_data()[JSON_KEY_METRICS]["allocation_sites"]["sites"].empty());
+    }
+
+    TEST_CASE("MallocHistogram") {
+        // because the malloc override is disabled, we shouldn't be counting anything!
+        MallocHistogram h;
+        h.start();
+        {
+            char* array = new char[1024];
+            array[0] = 0;
+            delete[] array;
+        }
+        h.stop();
+
+        CHECK(h.alloc_count(1024) == 0);
+        CHECK(h.free_count(1024) == 0);
+        CHECK(h.gather_metrics()["alloc"].empty());
+        CHECK(h.gather_metrics()["free"].empty());
+    }
+
+    TEST_CASE("LeakTracker") {
+        // because the malloc override is disabled, we shouldn't be tracking anything!
+        LeakTracker t;
+        t.start();
+        char* array = new char[1024];
+        array[0] = 0;
+        t.stop();
+        delete[] array;
+
+        CHECK(t.num_blocks() == 0);
+        CHECK(t.gather_metrics()["sizes"].empty());
+    }
+
+    TEST_CASE("TagCounter") {
+        // because the malloc override is disabled, we shouldn't be counting anything!
+        AllocationTag tag("test");
+        TagCounter c;
+        c.start();
+        {
+            TagScope scope(tag);
+            char* array = new char[1024];
+            array[0] = 0;
+            delete[] array;
+        }
+        c.stop();
+
+        CHECK(c.alloc_num(tag) == 0);
+        CHECK(c.peak(tag) == 0);
+        CHECK(c.gather_metrics().empty());
+    }
+
+    TEST_CASE("LogBuckets") {
+        using B = LogBuckets<2>;
+
+        // small values have buckets of their own
+        for(uint64_t v = 0; v < B::SUB_BUCKETS; v++) CHECK(B::index(v) == v);
+
+        // every power of two is divided into four sub-buckets
+        CHECK(B::index(8) == B::index(9));
+        CHECK(B::index(10) == B::index(11));
+        CHECK(B::index(9) + 1 == B::index(10));
+        CHECK(B::lower(B::index(48)) == 48);
+        CHECK(B::upper(B::index(48)) == 55);
+        CHECK(B::index(UINT64_MAX) == B::NUM_BUCKETS - 1);
+        CHECK(B::upper(B::NUM_BUCKETS - 1) == UINT64_MAX);
+
+        // the buckets are contiguous and every value lies within its bucket
+        for(size_t i = 0; i + 1 < B::NUM_BUCKETS; i++) {
+            CHECK(B::upper(i) + 1 == B::lower(i + 1));
+            CHECK(B::index(B::lower(i)) == i);
+            CHECK(B::index(B::upper(i)) == i);
+        }
+
+        using P = LogBuckets<0>;
+        CHECK(P::index(1) == 1);
+        CHECK(P::index(2) == 2);
+        CHECK(P::index(3) == 2);
+        CHECK(P::index(4) == 3);
+        CHECK(P::NUM_BUCKETS == 65);
+    }
+
+    TEST_CASE("MemoryTimeline") {
+        // because the malloc override is disabled, we shouldn't be tracking anything!
+        MemoryTimeline t(std::chrono::milliseconds(1));
+        t.start();
+        {
+            char* array = new char[1024];
+            array[0] = 0;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            delete[] array;
+        }
+        t.stop();
+
+        CHECK(t.num_samples() > 0);
+        for(size_t i = 0; i < t.num_samples(); i++) CHECK(t.bytes(i) == 0);
+
+        // a moved-from timeline is empty and remains usable
+        MemoryTimeline moved(std::move(t));
+        CHECK(moved.num_samples() > 0);
+        CHECK(t.num_samples() == 0);
+        t.start();
+        t.pause();
+        t.resume();
+        t.stop();
+        CHECK(t.num_samples() == 0);
+        CHECK(t.interval() == std::chrono::milliseconds(1));
+        CHECK(t.gather_metrics()["bytes"].empty());
+    }
+
+    TEST_CASE("ProcessMemory") {
+        constexpr size_t size = 16 * 1024 * 1024;
+
+        ProcessMemory m;
+        m.start();
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        REQUIRE(ptr != MAP_FAILED);
+        char* array = (char*)ptr;
+        for(size_t i = 0; i < size; i += 4096) array[i] = 1; // touch pages
+        m.stop();
+        munmap(ptr, size);
+
+        // the mapped memory is invisible to malloc tracking, but not to the OS
+        if(resident_set_size() > 0) {
+            CHECK(m.rss() >= intmax_t(size / 2));
+            CHECK(m.peak() >= size);
+        }
+        CHECK(m.minor_faults() > 0);
+        CHECK(m.mmap().map_bytes == 0); // nb: mmap override is disabled
+
+        auto const json = m.gather_metrics();
+        CHECK(json["rss"] == m.rss());
+        CHECK(json["minor_faults"] == m.minor_faults());
+        CHECK(!json.contains("mmap_bytes"));
+    }
+
+    TEST_CASE("IoCounter") {
+        constexpr size_t size = 1024 * 1024;
+        std::string const path = "test_io_counter.bin";
+        std::vector<char> buffer(size, 'x');
+
+        IoCounter c;
+        c.start();
+        int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        REQUIRE(fd >= 0);
+        CHECK(::write(fd, buffer.data(), size) == ssize_t(size));
+        CHECK(::pread(fd, buffer.data(), size, 0) == ssize_t(size));
+        ::close(fd);
+        c.stop();
+        std::remove(path.c_str());
+
+        if(ProcessIo::now().write_syscalls > 0) {
+            CHECK(c.io().write_bytes >= size);
+            CHECK(c.io().read_bytes >= size);
+            CHECK(c.io().write_syscalls >= 1);
+            CHECK(c.io().read_syscalls >= 1);
+            CHECK(c.write_throughput() > 0.0);
+        }
+        CHECK(c.thread().write_bytes == 0); // nb: read and write overrides are disabled
+
+        auto const json = c.gather_metrics();
+        CHECK(json["write_bytes"] == c.io().write_bytes);
+        CHECK(json["block_out"] == c.block_out());
+        CHECK(!json.contains("thread"));
+
+        // the meter's own reads of procfs are not counted
+        c.start();
+        c.stop();
+        if(ProcessIo::now().read_syscalls > 0) {
+            CHECK(c.io().read_syscalls == 0);
+            CHECK(c.io().read_bytes == 0);
+        }
+    }
+
+    TEST_CASE("PerfCounters") {
+        SUBCASE("default") {
+            // hardware events may not be available (e.g., in virtual machines), but this must not fail
+            PerfCounters c;
+            c.start();
+            c.stop();
+
+            auto const json = c.gather_metrics();
+            size_t num_available = 0;
+            for(size_t i = 0; i < c.num_events(); i++) {
+                if(c.available(i)) ++num_available;
+            }
+            CHECK(c.num_events() == 6);
+            CHECK(json.value("unavailable", nlohmann::json::array()).size() == c.num_events() - num_available);
+        }
+
+        SUBCASE("unavailable") {
+            // an event that cannot be opened is neither counted nor used for derived rates
+            PerfCounters c({ PerfEvent::instructions(), PerfEvent{ "bogus_misses", UINT32_MAX, 0 } });
+            c.start();
+            c.stop();
+
+            CHECK(!c.available(1));
+            auto const json = c.gather_metrics();
+            CHECK(!json.contains("bogus_misses"));
+            CHECK(!json.contains("bogus_mpki"));
+            CHECK(json["unavailable"].back() == "bogus_misses");
+        }
+
+        SUBCASE("software") {
+            PerfCounters c({ PerfEvent::page_faults(), PerfEvent::context_switches() });
+            c.start();
+            {
+                // touch fresh pages to cause page faults
+                constexpr size_t size = 16 * 1024 * 1024;
+                char* array = new char[size];
+                for(size_t i = 0; i < size; i += 4096) array[i] = 1;
+                delete[] array;
+            }
+            c.pause();
+            auto const faults = c.count("page_faults");
+            c.resume();
+            c.stop();
+
+            if(c.available(0)) {
+                CHECK(faults > 0);
+                CHECK(c.count(size_t(0)) >= faults);
+                CHECK(c.gather_metrics()["page_faults"] == c.count(size_t(0)));
+                CHECK(c.gather_metrics()["running"] > 0.0);
+            } else {
+                MESSAGE("perf events are not available");
+            }
+        }
+
+        SUBCASE("phase") {
+            Phase<PerfCounters, Stopwatch> phase("test");
+            phase.meter<0>() = PerfCounters({ PerfEvent::page_faults() });
+            phase.start();
+            phase.stop();
+            CHECK(phase.gather_data()[JSON_KEY_METRICS].contains("perf"));
+        }
+    }
+
+    TEST_CASE("RaplEnergy") {
+        SUBCASE("system") {
+            // RAPL may not be available or readable (e.g., in virtual machines), but this must not fail
+            RaplEnergy e;
+            e.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            e.stop();
+
+            auto const json = e.gather_metrics();
+            CHECK(json["domains"].size() == e.num_domains());
+            CHECK(e.joules() >= 0.0);
+            if(e.num_domains() == 0) MESSAGE("RAPL is not available");
+        }
+
+        SUBCASE("powercap") {
+            // mock the powercap file system
+            std::filesystem::path const root = "test_powercap";
+            std::filesystem::remove_all(root);
+
+            auto const write = [](std::filesystem::path const& path, std::string const& content){
+                std::ofstream(path) << content << '\n';
+            };
+            auto const zone = [&](std::filesystem::path const& dir, std::string const& name, uint64_t energy){
+                std::filesystem::create_directories(dir);
+                write(dir / "name", name);
+                write(dir / "energy_uj", std::to_string(energy));
+                write(dir / "max_energy_range_uj", "1000000000");
+            };
+
+            zone(root / "intel-rapl:0", "package-0", 999'000'000);
+            zone(root / "intel-rapl:0" / "intel-rapl:0:0", "dram", 5'000'000);
+            zone(root / "intel-rapl-mmio:0", "package-0", 0); // duplicate, must be ignored
+            std::filesystem::create_directories(root / "intel-rapl:1"); // no counters
+            zone(root / "intel-rapl:2", "psys", 0); // platform, contains the package
+
+            RaplEnergy e(root.string());
+            REQUIRE(e.num_domains() == 3);
+            CHECK(e.name(0) == "package-0");
+            CHECK(e.name(1) == "package-0.dram");
+            CHECK(e.name(2) == "psys");
+
+            e.start();
+            write(root / "intel-rapl:0" / "energy_uj", "2000000"); // wrapped around
+            write(root / "intel-rapl:0" / "intel-rapl:0:0" / "energy_uj", "6500000");
+            write(root / "intel-rapl:2" / "energy_uj", "20000000");
+            e.pause();
+            write(root / "intel-rapl:0" / "energy_uj", "9000000"); // not measured
+            e.resume();
+            write(root / "intel-rapl:0" / "energy_uj", "10000000");
+            e.stop();
+
+            // the counter ranges over [0, 1000000000], so wrapping around from 999000000 to 2000000 takes 3000001 microjoules
+            CHECK(e.joules(0) == doctest::Approx(4.000001).epsilon(1e-9));
+            CHECK(e.joules(1) == doctest::Approx(1.5));
+            CHECK(e.joules(2) == doctest::Approx(20.0));
+            CHECK(e.joules() == e.joules(0)); // packages only, psys is not counted twice
+            CHECK(e.watts() > 0.0);
+
+            auto const json = e.gather_metrics();
+            CHECK(json["joules"] == e.joules());
+            CHECK(json["domains"]["package-0.dram"]["joules"] == e.joules(1));
+            CHECK(json["domains"]["psys"]["joules"] == e.joules(2));
+            CHECK(json["unavailable"] == nlohmann::json::array({ "intel-rapl:1" }));
+
+            std::filesystem::remove_all(root);
+        }
+    }
+
+    TEST_CASE("WorkerLoad") {
+        constexpr size_t num_workers = 4;
+
+        ParallelPhase phase("parallel");
+        phase.meter<0>() = WorkerLoad(8);
+        phase.start();
+        {
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < num_workers; i++) {
+                workers.emplace_back([&, i](){
+                    // worker i has (i+1) tasks of 5 ms each
+                    for(size_t j = 0; j <= i; j++) {
+                        WorkerLoad::Scope scope(phase.meter<0>(), i);
+                        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    }
+                });
+            }
+            for(auto& t : workers) t.join();
+        }
+        phase.stop();
+
+        auto const& load = phase.meter<0>();
+        CHECK(load.max_workers() == 8);
+        CHECK(load.num_workers() == num_workers);
+        for(size_t i = 0; i < num_workers; i++) {
+            CHECK(load.tasks(i) == i + 1);
+            CHECK(load.busy_millis(i) >= 5.0 * (i + 1));
+            CHECK(load.busy_millis(i) <= load.wall_millis());
+        }
+        CHECK(load.tasks(num_workers) == 0);
+        CHECK(load.imbalance() > 1.0);
+        CHECK(load.efficiency() > 0.0);
+        CHECK(load.efficiency() <= 1.0);
+
+        // nb: no allocations are counted, because the malloc override is disabled
+        auto const json = phase.gather_data()["metrics"]["worker_load"];
+        CHECK(json["workers"] == num_workers);
+        CHECK(json["busy"].size() == num_workers);
+        CHECK(json["tasks"][3] == 4);
+        CHECK(json["alloc_bytes"][0] == 0);
+        CHECK(json["imbalance"] == load.imbalance());
+        CHECK(!json.contains("out_of_range"));
+
+        // workers without a slot are counted, but not recorded
+        {
+            WorkerLoad::Scope scope(phase.meter<0>(), 8);
+        }
+        CHECK(load.out_of_range() == 1);
+        CHECK(load.num_workers() == num_workers);
+        CHECK(load.gather_metrics()["out_of_range"] == 1);
+
+        // a moved-from measurement has no workers and remains usable
+        WorkerLoad source(2);
+        WorkerLoad moved(std::move(source));
+        CHECK(moved.max_workers() == 2);
+        CHECK(source.max_workers() == 0);
+        source.start();
+        source.stop();
+        CHECK(source.num_workers() == 0);
+        CHECK(source.gather_metrics()["workers"] == 0);
+    }
+
     TEST_CASE("Phase") {
         Phase<MallocCounter, Stopwatch> phase("test");
         phase.start();
@@ -71,6 +640,697 @@ TEST_SUITE("pm") {
         CHECK(phase.meter<0>().peak() == 0); // nb: malloc override is disabled
     }
 
+    TEST_CASE("SwitchablePhase") {
+        REQUIRE(MeasurementSwitch::enabled());
+
+        SUBCASE("enabled") {
+            SwitchablePhase<Stopwatch> phase("test");
+            phase.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            phase.stop();
+            CHECK(phase.measuring());
+            CHECK(phase.meter<0>().elapsed_time_millis() >= 10);
+        }
+
+        SUBCASE("disabled") {
+            MeasurementSwitch::disable();
+            CHECK(!MeasurementSwitch::enabled());
+
+            SwitchablePhase<Stopwatch> phase("test");
+            phase.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            phase.pause();
+            phase.resume();
+            phase.stop();
+            CHECK(!phase.measuring());
+            CHECK(phase.meter<0>().elapsed_time_millis() == 0);
+            CHECK(phase.gather_data()["metrics"]["time"] == 0);
+
+            // disabled measurement can be forced on for a thread
+            bool forced = false;
+            std::thread([&](){
+                MeasurementSwitch::Scope scope;
+                forced = MeasurementSwitch::enabled();
+            }).join();
+            CHECK(forced);
+            CHECK(!MeasurementSwitch::enabled());
+
+            MeasurementSwitch::enable();
+        }
+
+        SUBCASE("scoped") {
+            MeasurementSwitch::disable();
+            {
+                MeasurementSwitch::Scope scope;
+                ScopedPhase<SwitchablePhase<Stopwatch>> phase("test");
+                CHECK(phase.phase().measuring());
+            }
+            MeasurementSwitch::enable();
+        }
+    }
+
+    TEST_CASE("Statistics") {
+        SUBCASE("basic") {
+            auto const s = Statistics::of({ 5.0, 1.0, 4.0, 2.0, 3.0 });
+            CHECK(s.num == 5);
+            CHECK(s.min == 1.0);
+            CHECK(s.max == 5.0);
+            CHECK(s.median == 3.0);
+            CHECK(s.mean == 3.0);
+            CHECK(s.stddev == doctest::Approx(1.5811).epsilon(0.001));
+            CHECK(s.p90 == doctest::Approx(4.6));
+            CHECK(s.p99 == doctest::Approx(4.96));
+        }
+
+        SUBCASE("empty") {
+            auto const s = Statistics::of({});
+            CHECK(s.num == 0);
+            CHECK(s.mean == 0.0);
+            CHECK(s.stddev == 0.0);
+        }
+
+        SUBCASE("aggregate") {
+            std::vector<nlohmann::json> docs;
+            for(int i = 1; i <= 3; i++) {
+                nlohmann::json doc;
+                doc["time"] = i;
+                doc["memory"]["peak"] = 10 * i;
+                doc["label"] = "run" + std::to_string(i);
+                docs.push_back(doc);
+            }
+
+            auto const agg = aggregate(docs);
+            CHECK(agg["time"]["median"] == 2.0);
+            CHECK(agg["time"]["min"] == 1.0);
+            CHECK(agg["memory"]["peak"]["max"] == 30.0);
+            CHECK(agg["label"] == "run3");
+        }
+
+        SUBCASE("welch") {
+            auto const a = Statistics::of({ 1.0, 2.0, 3.0, 4.0, 5.0 });
+            auto const b = Statistics::of({ 2.0, 3.0, 4.0, 5.0, 6.0 });
+            CHECK(welch_t_test(a, b) == doctest::Approx(0.3466).epsilon(0.001));
+            CHECK(welch_t_test(b, a) == doctest::Approx(0.3466).epsilon(0.001));
+            CHECK(welch_t_test(a, a) == doctest::Approx(1.0));
+
+            // with two degrees of freedom, the p-value is 1 - |t| / sqrt(2 + t^2)
+            CHECK(welch_t_test(Statistics::of({ 0.0, 2.0 }), Statistics::of({ 1.0, 3.0 })) == doctest::Approx(1.0 - std::sqrt(0.5) / std::sqrt(2.5)));
+
+            CHECK(std::isnan(welch_t_test(a, Statistics::of({ 1.0 }))));
+            CHECK(welch_t_test(Statistics::of({ 1.0, 1.0 }), Statistics::of({ 2.0, 2.0 })) == 0.0);
+        }
+    }
+
+    TEST_CASE("Comparison") {
+        SUBCASE("single") {
+            Comparison cmp(0.1);
+            cmp.add_baseline(Result::parse("RESULT algorithm=test time=100 memory=50"));
+            cmp.add_candidate(Result::parse("RESULT algorithm=test time=120 memory=52 extra=1"));
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 2);
+            CHECK(v[0].key == "memory");
+            CHECK(v[0].change == doctest::Approx(0.04));
+            CHECK(!v[0].regression);
+            CHECK(v[1].key == "time");
+            CHECK(v[1].change == doctest::Approx(0.2));
+            CHECK(std::isnan(v[1].p_value));
+            CHECK(v[1].regression);
+            CHECK(cmp.regressed());
+        }
+
+        SUBCASE("repetitions") {
+            std::istringstream baseline(
+                "RESULT time=100 noise=10\n"
+                "some unrelated output\n"
+                "RESULT time=101 noise=20\n"
+                "RESULT time=99 noise=10\n");
+            std::istringstream candidate(
+                "RESULT time=110 noise=20\n"
+                "RESULT time=111 noise=10\n"
+                "RESULT time=109 noise=20\n");
+
+            Comparison cmp;
+            for(auto const& r : load_results(baseline)) cmp.add_baseline(r);
+            for(auto const& r : load_results(candidate)) cmp.add_candidate(r);
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 2);
+            CHECK(v[0].key == "noise");
+            CHECK(v[0].change > 0.05);
+            CHECK(v[0].p_value > 0.05);
+            CHECK(!v[0].regression); // not significant
+            CHECK(v[1].key == "time");
+            CHECK(v[1].p_value < 0.01);
+            CHECK(v[1].regression);
+        }
+
+        SUBCASE("phase") {
+            Comparison cmp;
+            for(int i = 0; i < 2; i++) {
+                TimePhase phase("root");
+                phase.start();
+                phase.stop();
+                cmp.add_baseline_phase_data(phase.gather_data());
+                cmp.add_candidate_phase_data(phase.gather_data());
+            }
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 1);
+            CHECK(v[0].key == "metrics.time");
+        }
+
+        SUBCASE("groups") {
+            Comparison cmp(0.1);
+            cmp.group_by("n");
+            cmp.add_baseline(Result::parse("RESULT algorithm=a n=10 time=100"));
+            cmp.add_baseline(Result::parse("RESULT algorithm=b n=10 time=200"));
+            cmp.add_baseline(Result::parse("RESULT algorithm=b n=20 time=400"));
+            cmp.add_candidate(Result::parse("RESULT algorithm=a n=10 time=100"));
+            cmp.add_candidate(Result::parse("RESULT algorithm=b n=10 time=240"));
+            cmp.add_candidate(Result::parse("RESULT algorithm=b n=30 time=1000"));
+
+            // pooled, the time would not have changed; n=20 and n=30 have no counterpart
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 2);
+            CHECK(v[0].group == "algorithm=a n=10");
+            CHECK(!v[0].regression);
+            CHECK(v[1].group == "algorithm=b n=10");
+            CHECK(v[1].key == "time");
+            CHECK(v[1].regression);
+            CHECK(cmp.unmatched_baseline() == std::vector<std::string>{ "algorithm=b n=20" });
+            CHECK(cmp.unmatched_candidate() == std::vector<std::string>{ "algorithm=b n=30" });
+        }
+
+        SUBCASE("unmatched") {
+            // the order of the pairs does not matter for the identity, but a metric missing on one side is reported
+            Comparison cmp;
+            cmp.add_baseline(Result::parse("RESULT algorithm=a input=x time=100 memory=10"));
+            cmp.add_candidate(Result::parse("RESULT input=x time=100 algorithm=a"));
+            cmp.add_candidate(Result::parse("RESULT algorithm=a input=x time=100 io=5"));
+            CHECK(cmp.unmatched_baseline().empty());
+            CHECK(cmp.unmatched_candidate().empty());
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 1);
+            CHECK(v[0].group == "algorithm=a input=x");
+            CHECK(v[0].candidate.num == 2);
+
+            using Metrics = std::vector<std::pair<std::string, std::string>>;
+            CHECK(cmp.unmatched_baseline_metrics() == Metrics{ { "algorithm=a input=x", "memory" } });
+            CHECK(cmp.unmatched_candidate_metrics() == Metrics{ { "algorithm=a input=x", "io" } });
+        }
+
+        SUBCASE("phase data") {
+            nlohmann::json baseline, candidate;
+            baseline[JSON_KEY_DATA]["n"] = 10;
+            baseline[JSON_KEY_METRICS]["time"] = 100;
+            candidate[JSON_KEY_DATA]["n"] = 10;
+            candidate[JSON_KEY_METRICS]["time"] = 100;
+
+            // data is part of the identity, not compared as a metric
+            Comparison cmp;
+            cmp.add_baseline_phase_data(baseline);
+            cmp.add_candidate_phase_data(candidate);
+            candidate[JSON_KEY_DATA]["n"] = 20;
+            cmp.add_candidate_phase_data(candidate);
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 1);
+            CHECK(v[0].group == "data.n=10");
+            CHECK(v[0].key == "metrics.time");
+            CHECK(v[0].candidate.num == 1);
+        }
+
+        SUBCASE("benchmark") {
+            // the number of repetitions depends on the time budget, so it is neither identity nor metric
+            BenchmarkConfig config;
+            config.warmup = 1;
+            config.min_repetitions = 2;
+            config.max_repetitions = 2;
+            config.target_confidence = 0.0;
+            auto const baseline = benchmark("noop", [](){}, config);
+            config.max_repetitions = 3;
+            config.min_repetitions = 3;
+            auto const candidate = benchmark("noop", [](){}, config);
+
+            Comparison cmp;
+            cmp.add_baseline_phase_data(baseline);
+            cmp.add_candidate_phase_data(candidate);
+            CHECK(cmp.unmatched_baseline().empty());
+            CHECK(cmp.unmatched_candidate().empty());
+
+            auto const v = cmp.compare();
+            REQUIRE(!v.empty());
+            for(auto const& c : v) {
+                CHECK(c.group.empty());
+                CHECK(c.key.starts_with("metrics.time."));
+            }
+        }
+
+        SUBCASE("direction") {
+            Comparison cmp(0.1);
+            cmp.higher_is_better("throughput");
+            cmp.add_baseline(Result::parse("RESULT io.throughput=100 time=100"));
+            cmp.add_candidate(Result::parse("RESULT io.throughput=80 time=80"));
+
+            auto const v = cmp.compare();
+            REQUIRE(v.size() == 2);
+            CHECK(v[0].key == "io.throughput");
+            CHECK(v[0].higher_is_better);
+            CHECK(v[0].regression);
+            CHECK(v[1].key == "time");
+            CHECK(!v[1].higher_is_better);
+            CHECK(!v[1].regression);
+        }
+    }
+
+    TEST_CASE("Benchmark") {
+        BenchmarkConfig config;
+        config.warmup = 2;
+        config.min_repetitions = 3;
+        config.max_repetitions = 10;
+        config.target_confidence = 0.0;
+        config.budget_millis = 1e9;
+
+        size_t calls = 0;
+        auto const json = benchmark("count", [&](TimePhase& phase){
+            ++calls;
+            phase.data()["calls"] = calls;
+        }, config);
+
+        // without a confidence target and an infinite budget, the maximum number of repetitions is used
+        CHECK(calls == 12);
+        CHECK(json[JSON_KEY_NAME] == "count");
+        CHECK(json[JSON_KEY_DATA]["repetitions"] == 10);
+        CHECK(json[JSON_KEY_DATA]["warmup"] == 2);
+        CHECK(json[JSON_KEY_DATA]["calls"] == 12);
+        CHECK(json[JSON_KEY_METRICS]["time"].contains("median"));
+
+        // the time budget is respected
+        config.budget_millis = 5.0;
+        config.max_repetitions = 1000;
+        auto const budgeted = benchmark("sleep", [](){ std::this_thread::sleep_for(std::chrono::milliseconds(2)); }, config);
+        CHECK(budgeted[JSON_KEY_DATA]["repetitions"] == 3);
+
+        // invalid arguments are rejected before any benchmark is run
+        auto main = [](std::vector<std::string> args){
+            args.insert(args.begin(), "bench");
+            std::vector<char*> argv;
+            for(auto& a : args) argv.push_back(a.data());
+            return benchmark_main((int)argv.size(), argv.data());
+        };
+        CHECK(main({ "--filter", "(" }) == EXIT_FAILURE);
+        CHECK(main({ "--list", "--filter", "[" }) == EXIT_FAILURE);
+        CHECK(main({ "--warmup", "three" }) == EXIT_FAILURE);
+        CHECK(main({ "--warmup", "-1" }) == EXIT_FAILURE);
+        CHECK(main({ "--budget", "1e3ms" }) == EXIT_FAILURE);
+        CHECK(main({ "--confidence", "-0.1" }) == EXIT_FAILURE);
+        CHECK(main({ "--min-repetitions", "5", "--max-repetitions", "2" }) == EXIT_FAILURE);
+        CHECK(main({ "--max-repetitions" }) == EXIT_FAILURE);
+        CHECK(main({ "--bogus" }) == EXIT_FAILURE);
+        CHECK(main({ "--list", "--filter", "^$" }) == EXIT_SUCCESS);
+    }
+
+    TEST_CASE("Calibration") {
+        calibrate<TimePhase>(100);
+        CHECK(Overhead::phase<TimePhase>() > 0.0);
+        CHECK(Overhead::stopwatch() > 0.0);
+        CHECK(Overhead::hook<TimePhase>() >= 0.0);
+
+        SUBCASE("nested") {
+            // measure many empty child phases, whose overhead should be mostly subtracted
+            Phase<Stopwatch, CalibratedStopwatch> parent("parent");
+            parent.start();
+            for(size_t i = 0; i < 1000; i++) {
+                TimePhase child("child");
+                child.start();
+                child.stop();
+            }
+            parent.stop();
+
+            auto const& s = parent.meter<1>();
+            CHECK(s.corrected_time_millis() >= 0.0);
+            CHECK(s.corrected_time_millis() < s.elapsed_time_millis());
+
+            auto const json = parent.gather_data();
+            CHECK(json[JSON_KEY_METRICS]["calibrated_time"]["corrected"] == s.corrected_time_millis());
+            CHECK(json[JSON_KEY_METRICS]["calibrated_time"]["raw"] == s.elapsed_time_millis());
+            CHECK(json[JSON_KEY_METRICS].contains("time"));
+        }
+
+        SUBCASE("uncorrected") {
+            // without nested phases, only the stopwatch's own overhead is subtracted
+            CalibratedStopwatch s;
+            s.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s.stop();
+            CHECK(s.corrected_time_millis() >= 9.9);
+            CHECK(s.corrected_time_millis() <= s.elapsed_time_millis());
+        }
+
+        Overhead::phase<TimePhase>() = 0.0;
+        Overhead::hook<TimePhase>() = 0.0;
+    }
+
+    TEST_CASE("Hierarchy") {
+        auto make_child = [](size_t i){
+            TimePhase child("child" + std::to_string(i));
+            child.start();
+            child.stop();
+            child.data()["i"] = i;
+            return child;
+        };
+
+        SUBCASE("move") {
+            Phase<> root("root");
+            TimePhase copied = make_child(0);
+            root.append_child(copied);
+            root.append_child(make_child(1));
+
+            TimePhase inner = make_child(2);
+            inner.append_child(make_child(3));
+            root.append_child(std::move(inner));
+
+            auto const json = root.gather_data();
+            REQUIRE(json[JSON_KEY_CHILDREN].size() == 3);
+            CHECK(json[JSON_KEY_CHILDREN][0][JSON_KEY_NAME] == "child0");
+            CHECK(json[JSON_KEY_CHILDREN][1][JSON_KEY_NAME] == "child1");
+            CHECK(json[JSON_KEY_CHILDREN][1][JSON_KEY_DATA]["i"] == 1);
+            CHECK(json[JSON_KEY_CHILDREN][2][JSON_KEY_CHILDREN][0][JSON_KEY_NAME] == "child3");
+
+            // gathering again yields the same result
+            CHECK(root.gather_data() == json);
+
+            // consuming yields the same result and leaves the phase empty
+            CHECK(std::move(root).gather_data() == json);
+            CHECK(root.name().empty());
+            CHECK(!root.gather_data().contains(JSON_KEY_CHILDREN));
+        }
+
+        SUBCASE("large") {
+            constexpr size_t num = 100'000;
+            Phase<> root("root");
+            for(size_t i = 0; i < num; i++) root.append_child(make_child(i));
+            root.data()["num"] = num;
+
+            auto const json = std::move(root).gather_data();
+            REQUIRE(json[JSON_KEY_CHILDREN].size() == num);
+            CHECK(json[JSON_KEY_CHILDREN][num - 1][JSON_KEY_DATA]["i"] == num - 1);
+            CHECK(json[JSON_KEY_DATA]["num"] == num);
+        }
+    }
+
+    TEST_CASE("ScopedPhase") {
+        SUBCASE("hierarchy") {
+            auto leaf = [](std::string&& name){
+                ScopedPhase<TimePhase> scope(std::move(name));
+                scope.phase().data()["leaf"] = true;
+            };
+
+            TimePhase root("root");
+            {
+                ScopedPhase<TimePhase> scope(root);
+                CHECK(ScopedPhaseNode::current() == &scope);
+                {
+                    ScopedPhase<Phase<>> a("a");
+                    leaf("a1");
+                    leaf("a2");
+                }
+                leaf("b");
+            }
+            CHECK(ScopedPhaseNode::current() == nullptr);
+
+            auto const json = root.gather_data();
+            REQUIRE(json[JSON_KEY_CHILDREN].size() == 2);
+            auto const& a = json[JSON_KEY_CHILDREN][0];
+            CHECK(a[JSON_KEY_NAME] == "a");
+            REQUIRE(a[JSON_KEY_CHILDREN].size() == 2);
+            CHECK(a[JSON_KEY_CHILDREN][0][JSON_KEY_NAME] == "a1");
+            CHECK(a[JSON_KEY_CHILDREN][1][JSON_KEY_NAME] == "a2");
+            CHECK(a[JSON_KEY_CHILDREN][1][JSON_KEY_DATA]["leaf"] == true);
+            CHECK(json[JSON_KEY_CHILDREN][1][JSON_KEY_NAME] == "b");
+            CHECK(json[JSON_KEY_CHILDREN][1][JSON_KEY_METRICS].contains("time"));
+        }
+
+        SUBCASE("threads") {
+            TimePhase root("root");
+            {
+                ScopedPhase<TimePhase> scope(root);
+                std::thread worker([](){
+                    // the worker thread has its own hierarchy
+                    CHECK(ScopedPhaseNode::current() == nullptr);
+                    ScopedPhase<TimePhase> child("worker");
+                });
+                worker.join();
+            }
+            CHECK(!root.gather_data().contains(JSON_KEY_CHILDREN));
+        }
+
+        SUBCASE("failing parent") {
+            struct FailingScope : public ScopedPhaseNode {
+                void append_child_data(nlohmann::json&&) override { throw std::runtime_error("append_child_data"); }
+                void append_child(std::unique_ptr<PhaseChild>&&) override { throw std::runtime_error("append_child"); }
+                void reserve_child() override {}
+            };
+
+            FailingScope parent;
+            {
+                // leaving the scope does not throw, the child is dropped instead
+                ScopedPhase<TimePhase> child("child");
+            }
+            TimePhase owned("owned");
+            {
+                ScopedPhase<TimePhase> child(owned);
+            }
+            CHECK(ScopedPhaseNode::current() == &parent);
+        }
+
+        SUBCASE("noop") {
+            ScopedPhase<NoopPhase> scope("noop");
+            CHECK(ScopedPhaseNode::current() == nullptr);
+            static_assert(!std::is_base_of_v<ScopedPhaseNode, ScopedPhase<NoopPhase>>);
+        }
+    }
+
+    TEST_CASE("RecordLog") {
+        std::string const path = "test_record_log.bin";
+        std::remove(path.c_str());
+
+        {
+            TimePhase phase("first");
+            phase.start();
+            phase.stop();
+            phase.data()["x"] = 1;
+
+            RecordWriter w(path);
+            w.write(phase);
+
+            // unsorted and with a repeated key, which must be restored exactly
+            Result r;
+            r.add("n", 42);
+            r.add("algorithm", "test");
+            r.add("n", 43);
+            w.write(r);
+
+            // top-level scoped phases are written as records when they end
+            {
+                RecordScope scope(w);
+                ScopedPhase<TimePhase> second("second");
+                {
+                    ScopedPhase<TimePhase> child("child");
+                }
+            }
+        }
+        {
+            // reopening appends
+            RecordWriter w(path);
+            w.write(Phase<>("third"));
+        }
+
+        {
+            RecordReader reader(path);
+            RecordType type;
+            nlohmann::json record;
+
+            REQUIRE(reader.next(type, record));
+            CHECK(type == RecordType::phase);
+            CHECK(record[JSON_KEY_NAME] == "first");
+            CHECK(record[JSON_KEY_DATA]["x"] == 1);
+
+            REQUIRE(reader.next(type, record));
+            CHECK(type == RecordType::result);
+            CHECK(record == nlohmann::json::parse(R"([["n","42"],["algorithm","test"],["n","43"]])"));
+            CHECK(Result::from_json(record).str() == "RESULT n=42 algorithm=test n=43");
+
+            REQUIRE(reader.next(type, record));
+            CHECK(type == RecordType::phase);
+            CHECK(record[JSON_KEY_NAME] == "second");
+            CHECK(record[JSON_KEY_CHILDREN][0][JSON_KEY_NAME] == "child");
+
+            REQUIRE(reader.next(type, record));
+            CHECK(record[JSON_KEY_NAME] == "third");
+
+            CHECK(!reader.next(type, record));
+        }
+
+        {
+            RecordReader reader(path);
+            std::ostringstream out;
+            convert_records_to_result(reader, out);
+
+            std::istringstream lines(out.str());
+            std::string line;
+            std::getline(lines, line);
+            CHECK(line.starts_with("RESULT metrics.time="));
+            CHECK(line.ends_with(" data.x=1"));
+            std::getline(lines, line);
+            CHECK(line == "RESULT n=42 algorithm=test n=43");
+        }
+
+        {
+            auto const results = load_results(path);
+            REQUIRE(results.size() == 4);
+            CHECK(results[1].str() == "RESULT n=42 algorithm=test n=43");
+        }
+
+        {
+            RecordReader reader(path);
+            std::ostringstream out;
+            convert_records_to_json(reader, out);
+
+            std::istringstream lines(out.str());
+            std::string line;
+            size_t num = 0;
+            while(std::getline(lines, line)) {
+                auto const record = nlohmann::json::parse(line);
+                CHECK((num == 1 ? record.is_array() : record.is_object()));
+                ++num;
+            }
+            CHECK(num == 4);
+
+            // the JSON lines restore the exact result as well
+            std::istringstream json_lines(out.str());
+            auto const results = load_results(json_lines);
+            REQUIRE(results.size() == 4);
+            CHECK(results[1].str() == "RESULT n=42 algorithm=test n=43");
+        }
+
+        {
+            // log output that looks like JSON is ignored
+            std::istringstream log("[info] running sort\n{\nRESULT name=sort time=5\n}\n");
+            auto const results = load_results(log);
+            REQUIRE(results.size() == 1);
+            CHECK(results[0].str() == "RESULT name=sort time=5");
+        }
+
+        std::remove(path.c_str());
+        CHECK_THROWS_AS(RecordReader{path}, std::runtime_error);
+
+        if(std::filesystem::exists("/dev/full")) {
+            // write errors are reported, even if they occur while leaving a scoped phase
+            RecordWriter w("/dev/full");
+            {
+                RecordScope scope(w);
+                ScopedPhase<Phase<>> phase("phase");
+                phase.phase().data()["payload"] = std::string(1 << 20, 'x'); // exceeds the FILE buffer
+            }
+            CHECK_THROWS_AS(w.flush(), std::runtime_error);
+        }
+    }
+
+    TEST_CASE("TraceRecorder") {
+        SUBCASE("events") {
+            CHECK(!TraceRecorder::enabled());
+            {
+                TraceRecorder recorder;
+                CHECK(TraceRecorder::enabled());
+                CHECK_THROWS_AS(TraceRecorder{}, std::logic_error);
+
+                TimePhase outer("outer");
+                outer.start();
+                {
+                    TimePhase inner("inner");
+                    inner.start();
+                    inner.stop();
+                }
+                outer.pause();
+                outer.resume();
+                {
+                    // stopping a paused phase does not end it a second time
+                    TimePhase paused("paused");
+                    paused.start();
+                    paused.pause();
+                    paused.stop();
+                }
+                std::thread([](){
+                    TimePhase worker("worker with a name that is too long to fit into a trace event");
+                    worker.start();
+                    worker.stop();
+                }).join();
+                outer.stop();
+
+                std::stringstream out;
+                recorder.write(out);
+                CHECK(recorder.num_events() == 10);
+                CHECK(recorder.dropped() == 0);
+
+                auto const json = nlohmann::json::parse(out.str());
+                auto const& events = json["traceEvents"];
+                REQUIRE(events.size() == 10);
+
+                // events of the same thread are in order
+                auto const main_tid = [&](){
+                    for(auto const& e : events) if(e["name"] == "outer") return e["tid"].get<size_t>();
+                    return SIZE_MAX;
+                }();
+
+                std::vector<std::string> main_events, worker_events;
+                for(auto const& e : events) {
+                    auto const ev = e["ph"].get<std::string>() + e["name"].get<std::string>();
+                    if(e["tid"] == main_tid) main_events.push_back(ev);
+                    else worker_events.push_back(ev);
+                }
+                CHECK(main_events == std::vector<std::string>{ "Bouter", "Binner", "Einner", "Eouter", "Bouter", "Bpaused", "Epaused", "Eouter" });
+                REQUIRE(worker_events.size() == 2);
+                CHECK(worker_events[0].size() == 1 + TraceEvent::MAX_NAME);
+
+                double last = 0;
+                for(auto const& e : events) {
+                    if(e["tid"] == main_tid) {
+                        CHECK(e["ts"].get<double>() >= last);
+                        last = e["ts"];
+                    }
+                }
+            }
+
+            // nothing is recorded without a recorder
+            CHECK(!TraceRecorder::enabled());
+            TimePhase phase("untraced");
+            phase.start();
+            phase.stop();
+        }
+
+        SUBCASE("dropped") {
+            TraceRecorder recorder(4);
+            for(size_t i = 0; i < 3; i++) {
+                TimePhase phase("phase");
+                phase.start();
+                phase.stop();
+            }
+            CHECK(recorder.dropped() == 2);
+
+            // collecting makes room again
+            recorder.collect();
+            TimePhase phase("phase");
+            phase.start();
+            phase.stop();
+            CHECK(recorder.dropped() == 2);
+            recorder.collect();
+            CHECK(recorder.num_events() == 6);
+        }
+    }
+
     TEST_CASE("Result") {
         SUBCASE("primitive") {
             Result r;
@@ -96,6 +1356,170 @@ TEST_SUITE("pm") {
             // nb: we cannot match the exact output here, because the sleep introduces randomness
             CHECK(r.str().starts_with("RESULT data.int=-1337 metrics.time="));
         }
+
+        SUBCASE("parse") {
+            auto const r = Result::parse("RESULT algorithm=test time=3.125 expr=a=b");
+            CHECK(r.str() == "RESULT algorithm=test time=3.125 expr=a=b");
+            CHECK_THROWS_AS(Result::parse("algorithm=test"), std::invalid_argument);
+            CHECK_THROWS_AS(Result::parse("RESULT algorithm"), std::invalid_argument);
+        }
+    }
+
+    TEST_CASE("ResultWriter") {
+        SUBCASE("result") {
+            std::ostringstream out;
+            {
+                ResultWriter w(out);
+                auto const algo = w.column("algorithm");
+                auto const n = w.column("n");
+                auto const time = w.column("time");
+                auto const ok = w.column("ok");
+                for(int i = 0; i < 2; i++) {
+                    w.set(algo, "test");
+                    w.set(n, -1337 + i);
+                    w.set(time, 3.125);
+                    if(i == 0) w.set(ok, false);
+                    w.write_row();
+                }
+                CHECK(w.num_rows() == 2);
+                CHECK_THROWS_AS(w.column("late"), std::logic_error);
+                CHECK_THROWS_AS(w.set(4, 0), std::out_of_range);
+            }
+            CHECK(out.str() == "RESULT algorithm=test n=-1337 time=3.125 ok=false\nRESULT algorithm=test n=-1336 time=3.125\n");
+        }
+
+        SUBCASE("csv") {
+            std::ostringstream out;
+            {
+                ResultWriter w(out, ResultFormat::csv, 16); // small buffer to flush repeatedly
+                auto const name = w.column("name");
+                auto const size = w.column("size");
+                for(size_t i = 0; i < 3; i++) {
+                    if(i != 1) w.set(name, i == 0 ? "plain" : "a \"quoted\", value");
+                    w.set(size, (size_t(1) << 63) + i);
+                    w.write_row();
+                }
+            }
+            CHECK(out.str() == "name,size\n"
+                               "plain,9223372036854775808\n"
+                               ",9223372036854775809\n"
+                               "\"a \"\"quoted\"\", value\",9223372036854775810\n");
+        }
+
+        SUBCASE("tsv") {
+            std::ostringstream out;
+            {
+                ResultWriter w(out, ResultFormat::tsv);
+                auto const name = w.column("name");
+                auto const x = w.column("x");
+                w.set(name, "tab\there");
+                w.set(x, 0.1f);
+                w.write_row();
+            }
+            CHECK(out.str() == "name\tx\ntab here\t0.1\n");
+        }
+
+        SUBCASE("move") {
+            // assigning to a writer flushes its buffered rows first
+            std::ostringstream out1, out2;
+            {
+                ResultWriter w(out1);
+                auto const x = w.column("x");
+                w.set(x, 1);
+                w.write_row();
+
+                ResultWriter other(out2);
+                auto const y = other.column("y");
+                other.set(y, 2);
+                other.write_row();
+
+                w = std::move(other);
+                CHECK(out1.str() == "RESULT x=1\n");
+                w.set(y, 3);
+                w.write_row();
+            }
+            CHECK(out1.str() == "RESULT x=1\n");
+            CHECK(out2.str() == "RESULT y=2\nRESULT y=3\n");
+        }
+    }
+
+    TEST_CASE("Aggregator") {
+        SUBCASE("result") {
+            Aggregator agg;
+            agg.add(Result::parse("RESULT algorithm=test time=3 memory=10"));
+            agg.add(Result::parse("RESULT algorithm=test time=5 memory=30"));
+            agg.add(Result::parse("RESULT algorithm=test time=1"));
+            CHECK(agg.num_ranks() == 3);
+
+            auto const summary = agg.summary();
+            CHECK(summary["ranks"] == 3);
+            auto const& time = summary["keys"]["time"];
+            CHECK(time["num"] == 3);
+            CHECK(time["min"] == 1.0);
+            CHECK(time["max"] == 5.0);
+            CHECK(time["mean"] == 3.0);
+            CHECK(time["sum"] == 9.0);
+            CHECK(time["min_rank"] == 2);
+            CHECK(time["max_rank"] == 1);
+            CHECK(summary["keys"]["memory"]["num"] == 2);
+            CHECK(summary["keys"]["algorithm"]["value"] == "test");
+
+            CHECK(agg.result().str() == "RESULT ranks=3 algorithm=test memory.min=10.0 memory.max=30.0 memory.mean=20.0 memory.sum=40.0 memory.max_rank=1 "
+                                        "time.min=1.0 time.max=5.0 time.mean=3.0 time.sum=9.0 time.max_rank=1");
+        }
+
+        SUBCASE("repeated key") {
+            Aggregator agg;
+            agg.add(Result::parse("RESULT time=3 time=7"));
+            agg.add(Result::parse("RESULT time=5"));
+
+            auto const summary = agg.summary();
+            auto const& time = summary["keys"]["time"];
+            CHECK(time["num"] == 3);
+            CHECK(time["max"] == 7.0);
+            CHECK(time["sum"] == 15.0);
+        }
+
+        SUBCASE("turning non-numeric") {
+            // numeric values seen before keep only their extremes
+            Aggregator agg;
+            agg.add(Result::parse("RESULT x=5"));
+            agg.add(Result::parse("RESULT x=1"));
+            agg.add(Result::parse("RESULT x=3"));
+            agg.add(Result::parse("RESULT x=abc"));
+            agg.add(Result::parse("RESULT x=abc"));
+
+            auto const summary = agg.summary();
+            auto const& x = summary["keys"]["x"];
+            CHECK(x["num"] == 5);
+            CHECK(!x.contains("min"));
+            CHECK(x["values"] == nlohmann::json::array({ "1", "5", "abc" }));
+        }
+
+        SUBCASE("phase") {
+            Aggregator agg;
+            for(size_t rank = 0; rank < 4; rank++) {
+                nlohmann::json child;
+                child["name"] = "sort";
+                child["metrics"]["time"] = (double)((rank + 1) % 4);
+
+                nlohmann::json data;
+                data["name"] = "root";
+                data["data"]["rank"] = 3 - rank; // reported in reverse order
+                data["data"]["host"] = (rank % 2) ? "a" : "b";
+                data["children"] = nlohmann::json::array({ child });
+                agg.add_phase_data(data);
+            }
+
+            auto const summary = agg.summary();
+            CHECK(summary["ranks"] == 4);
+            auto const& time = summary["keys"]["sort.metrics.time"];
+            CHECK(time["max"] == 3.0);
+            CHECK(time["max_rank"] == 1);
+            CHECK(time["min_rank"] == 0);
+            CHECK(summary["keys"]["data.host"]["values"].size() == 2);
+            CHECK(!summary["keys"].contains("data.rank"));
+        }
     }
 }
 
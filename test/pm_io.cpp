@@ -0,0 +1,97 @@
+/**
+ * pm_io.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pm.hpp>
+
+namespace pm::test {
+
+using namespace pm;
+
+TEST_SUITE("pm_io") {
+    TEST_CASE("IoCounter") {
+        constexpr size_t size = 64 * 1024;
+        std::string const path = "test_pm_io.bin";
+        std::vector<char> buffer(size, 'x');
+
+        int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        REQUIRE(fd >= 0);
+
+        SUBCASE("thread") {
+            IoCounter c;
+            c.start();
+            CHECK(::write(fd, buffer.data(), size) == ssize_t(size));
+            CHECK(::pwrite(fd, buffer.data(), size / 2, size) == ssize_t(size / 2));
+            CHECK(::pread(fd, buffer.data(), size, 0) == ssize_t(size));
+            CHECK(::read(fd, buffer.data(), size) == ssize_t(size / 2)); // nb: the file offset is after the first write
+            c.stop();
+
+            CHECK(c.thread().write_num == 2);
+            CHECK(c.thread().write_bytes == size + size / 2);
+            CHECK(c.thread().read_num == 2);
+            CHECK(c.thread().read_bytes == size + size / 2);
+
+            auto const json = c.gather_metrics();
+            CHECK(json["thread"]["write_bytes"] == size + size / 2);
+        }
+
+        SUBCASE("other threads") {
+            IoCounter c;
+            c.start();
+            std::thread([&](){
+                CHECK(::write(fd, buffer.data(), size) == ssize_t(size));
+            }).join();
+            c.stop();
+
+            // the other thread's write is seen only in the process-wide figures
+            CHECK(c.thread().write_num == 0);
+            if(ProcessIo::now().write_syscalls > 0) CHECK(c.io().write_bytes >= size);
+        }
+
+        SUBCASE("errors") {
+            auto const before = io_hook::thread_totals();
+            CHECK(::read(-1, buffer.data(), size) == -1);
+            auto const after = io_hook::thread_totals();
+            CHECK(after.read_num == before.read_num + 1);
+            CHECK(after.read_bytes == before.read_bytes);
+        }
+
+        ::close(fd);
+        std::remove(path.c_str());
+    }
+}
+
+}
@@ -1,14 +1,57 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <thread>
+#include <vector>
 
 #include <pm.hpp>
 
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
 namespace pm::test {
 
 using namespace pm;
 
+// the number of bytes that the malloc override reports for an allocation of the given size
+size_t tracked_size(size_t bytes) {
+    #ifdef PM_MALLOC_USABLE_SIZE
+    void* ptr = malloc(bytes);
+    auto const size = malloc_usable_size(ptr);
+    free(ptr);
+    return size;
+    #else
+    return bytes;
+    #endif
+}
+
+// the number of bytes that the malloc override reports for the given block, allocated with the given size
+size_t tracked_size(void* ptr, size_t bytes) {
+    #ifdef PM_MALLOC_USABLE_SIZE
+    (void)bytes;
+    return malloc_usable_size(ptr);
+    #else
+    (void)ptr;
+    return bytes;
+    #endif
+}
+
+size_t const size_64 = tracked_size(64);
+size_t const size_1024 = tracked_size(1024);
+
+std::array<size_t, 11> const size_pow2 = [](){
+    std::array<size_t, 11> sizes;
+    for(size_t i = 0; i < sizes.size(); i++) sizes[i] = tracked_size(1U << i);
+    return sizes;
+}();
+
 TEST_SUITE("pm_malloc") {
     class TestCallback : public MallocCallback {
     public:
@@ -29,19 +72,40 @@ TEST_SUITE("pm_malloc") {
         }
     };
 
+    class AllocatingCallback : public MallocCallback {
+    public:
+        AllocatingCallback() : MallocCallback() {
+            register_callback();
+        }
+
+        size_t num = 0;
+
+        virtual void on_alloc(size_t) override {
+            ++num;
+
+            // this allocation must not be reported again
+            char* array = new char[16];
+            array[0] = 0;
+            delete[] array;
+        }
+
+        virtual void on_free(size_t) override {
+        }
+    };
+
     TEST_CASE("MallocCallback") {
         SUBCASE("basic") {
             TestCallback cb;
             {
                 char* array = new char[1024];
                 array[0] = 0;
-                CHECK(cb.current == 1024);
-                CHECK(cb.peak == 1024);
+                CHECK(cb.current == size_1024);
+                CHECK(cb.peak == size_1024);
                 delete[] array;
             }
 
             CHECK(cb.current == 0);
-            CHECK(cb.peak == 1024);
+            CHECK(cb.peak == size_1024);
         }
 
         SUBCASE("peak") {
@@ -49,20 +113,20 @@ TEST_SUITE("pm_malloc") {
 
             for(size_t i = 0; i <= 10; i++) {
                 char* array = new char[1U << i];
-                CHECK(cb.current == 1U << i);
-                CHECK(cb.peak == 1U << i);
+                CHECK(cb.current == size_pow2[i]);
+                CHECK(cb.peak == size_pow2[i]);
                 array[0] = 0;
                 delete[] array;
                 CHECK(cb.current == 0);
-                CHECK(cb.peak == 1U << i);
+                CHECK(cb.peak == size_pow2[i]);
             }
             for(size_t i = 10; i > 0; i--) {
                 char* array = new char[1U << (i-1)];
-                CHECK(cb.current == 1U << (i-1));
+                CHECK(cb.current == size_pow2[i-1]);
                 array[0] = 0;
                 delete[] array;
                 CHECK(cb.current == 0);
-                CHECK(cb.peak == 1024);
+                CHECK(cb.peak == size_1024);
             }
         }
 
@@ -76,11 +140,83 @@ TEST_SUITE("pm_malloc") {
                 array2[0] = 0;
                 delete[] array2;
                 CHECK(cb2.current == 0);
-                CHECK(cb2.peak == 1024);
+                CHECK(cb2.peak == size_1024);
             }
             delete[] array1;
             CHECK(cb1.current == 0);
-            CHECK(cb1.peak == 2048);
+            CHECK(cb1.peak == 2 * size_1024);
+        }
+
+        SUBCASE("unregistered") {
+            // without registered callbacks, events are not dispatched and therefore not counted
+            REQUIRE(MallocCallback::num_registered() == 0);
+            auto const before = MallocCallback::num_notifications();
+            {
+                char* array = new char[64];
+                array[0] = 0;
+                delete[] array;
+            }
+            CHECK(MallocCallback::num_notifications() == before);
+
+            TestCallback cb;
+            {
+                char* array = new char[64];
+                array[0] = 0;
+                delete[] array;
+            }
+            CHECK(MallocCallback::num_notifications() - before == 2);
+        }
+
+        SUBCASE("reentrant") {
+            AllocatingCallback cb;
+            {
+                char* array = new char[1024];
+                array[0] = 0;
+                delete[] array;
+            }
+            CHECK(cb.num == 1);
+        }
+
+        SUBCASE("concurrent") {
+            constexpr size_t num_threads = 4;
+            constexpr size_t num_phases = 250;
+
+            std::atomic<bool> stop = false;
+            std::atomic<size_t> failures = 0;
+
+            // some threads keep allocating while others register and unregister counters
+            std::vector<std::thread> allocators;
+            for(size_t i = 0; i < num_threads; i++) {
+                allocators.emplace_back([&](){
+                    while(!stop) {
+                        char* array = new char[64];
+                        array[0] = 0;
+                        delete[] array;
+                    }
+                });
+            }
+
+            std::vector<std::thread> registrants;
+            for(size_t i = 0; i < num_threads; i++) {
+                registrants.emplace_back([&](){
+                    for(size_t j = 0; j < num_phases; j++) {
+                        ShardedMallocCounter c;
+                        c.start();
+                        char* array = new char[128];
+                        array[0] = 0;
+                        delete[] array;
+                        c.stop();
+
+                        if(c.alloc_num() < 1 || c.alloc_bytes() < 128) ++failures;
+                    }
+                });
+            }
+
+            for(auto& t : registrants) t.join();
+            stop = true;
+            for(auto& t : allocators) t.join();
+
+            CHECK(failures == 0);
         }
     }
 
@@ -91,18 +227,18 @@ TEST_SUITE("pm_malloc") {
             {
                 char* array = new char[1024];
                 array[0] = 0;
-                CHECK(c.count() == 1024);
-                CHECK(c.peak() == 1024);
+                CHECK(c.count() == size_1024);
+                CHECK(c.peak() == size_1024);
                 delete[] array;
             }
             c.stop();
 
             CHECK(c.count() == 0);
-            CHECK(c.peak() == 1024);
+            CHECK(c.peak() == size_1024);
             CHECK(c.alloc_num() == 1);
-            CHECK(c.alloc_bytes() == 1024);
+            CHECK(c.alloc_bytes() == size_1024);
             CHECK(c.free_num() == 1);
-            CHECK(c.free_bytes() == 1024);
+            CHECK(c.free_bytes() == size_1024);
         }
 
         SUBCASE("pause") {
@@ -128,6 +264,675 @@ TEST_SUITE("pm_malloc") {
         }
     }
 
+    TEST_CASE("MeasurementSwitch") {
+        TestCallback cb;
+        MeasurementSwitch::disable();
+        {
+            char* array = new char[1024];
+            array[0] = 0;
+            CHECK(cb.peak == 0);
+            delete[] array;
+
+            MeasurementSwitch::Scope scope;
+            array = new char[1024];
+            array[0] = 0;
+            CHECK(cb.peak == size_1024);
+            delete[] array;
+        }
+        MeasurementSwitch::enable();
+
+        CHECK(cb.current == 0);
+        CHECK(cb.peak == size_1024);
+    }
+
+    TEST_CASE("ShardedMallocCounter") {
+        SUBCASE("basic") {
+            ShardedMallocCounter c;
+            c.start();
+            {
+                char* array = new char[1024];
+                array[0] = 0;
+                CHECK(c.count() == size_1024);
+                CHECK(c.peak() == size_1024);
+                delete[] array;
+            }
+            c.stop();
+
+            CHECK(c.count() == 0);
+            CHECK(c.peak() == size_1024);
+            CHECK(c.alloc_num() == 1);
+            CHECK(c.alloc_bytes() == size_1024);
+            CHECK(c.free_num() == 1);
+            CHECK(c.free_bytes() == size_1024);
+        }
+
+        SUBCASE("threads") {
+            constexpr size_t num_threads = 8;
+            constexpr size_t num_allocs = 1000;
+
+            ShardedMallocCounter c;
+            std::atomic<bool> go = false;
+            std::atomic<size_t> done = 0;
+            std::atomic<bool> stopped = false;
+
+            // create the threads before starting the measurement so their own allocations are not counted
+            std::vector<std::thread> threads;
+            threads.reserve(num_threads);
+            for(size_t i = 0; i < num_threads; i++) {
+                threads.emplace_back([&](){
+                    while(!go) std::this_thread::yield();
+                    for(size_t j = 0; j < num_allocs; j++) {
+                        char* array = new char[64];
+                        array[0] = 0;
+                        delete[] array;
+                    }
+                    ++done;
+
+                    // the thread's own state is released upon termination, which should not be counted either
+                    while(!stopped) std::this_thread::yield();
+                });
+            }
+
+            c.start();
+            go = true;
+            while(done < num_threads) std::this_thread::yield();
+            c.stop();
+
+            stopped = true;
+            for(auto& t : threads) t.join();
+
+            CHECK(c.count() == 0);
+            CHECK(c.alloc_num() == num_threads * num_allocs);
+            CHECK(c.alloc_bytes() == num_threads * num_allocs * size_64);
+            CHECK(c.free_num() == num_threads * num_allocs);
+            CHECK(c.free_bytes() == num_threads * num_allocs * size_64);
+            CHECK(c.peak() >= size_64);
+            CHECK(c.peak() <= num_threads * size_64);
+        }
+    }
+
+    TEST_CASE("Aligned") {
+        MallocCounter c;
+        size_t const page_size = sysconf(_SC_PAGESIZE);
+
+        // checks that the given block is aligned and currently counted, and frees it
+        auto check_and_free = [&](void* ptr, size_t alignment, size_t bytes){
+            REQUIRE(ptr != nullptr);
+            CHECK((uintptr_t)ptr % alignment == 0);
+            size_t const size = tracked_size(ptr, bytes);
+            CHECK(c.count() == size);
+            free(ptr);
+            c.stop();
+
+            CHECK(c.count() == 0);
+            CHECK(c.peak() == size);
+            CHECK(c.alloc_num() == 1);
+            CHECK(c.alloc_bytes() == size);
+            CHECK(c.free_num() == 1);
+            CHECK(c.free_bytes() == size);
+        };
+
+        SUBCASE("aligned_alloc") {
+            c.start();
+            check_and_free(aligned_alloc(64, 1024), 64, 1024);
+        }
+
+        SUBCASE("posix_memalign") {
+            void* ptr = nullptr;
+            c.start();
+            CHECK(posix_memalign(&ptr, 256, 1000) == 0);
+            check_and_free(ptr, 256, 1000);
+        }
+
+        SUBCASE("posix_memalign_invalid") {
+            void* ptr = nullptr;
+            c.start();
+            CHECK(posix_memalign(&ptr, 24, 1000) == EINVAL);
+            CHECK(posix_memalign(&ptr, 0, 1000) == EINVAL);
+            c.stop();
+            CHECK(ptr == nullptr);
+            CHECK(c.alloc_num() == 0);
+        }
+
+        SUBCASE("memalign") {
+            c.start();
+            check_and_free(memalign(128, 100), 128, 100);
+        }
+
+        SUBCASE("memalign_small") {
+            c.start();
+            check_and_free(memalign(8, 100), 8, 100);
+        }
+
+        SUBCASE("valloc") {
+            c.start();
+            check_and_free(valloc(100), page_size, 100);
+        }
+
+        SUBCASE("pvalloc") {
+            c.start();
+            check_and_free(pvalloc(100), page_size, page_size);
+        }
+
+        SUBCASE("realloc") {
+            c.start();
+            auto ptr = (char*)aligned_alloc(64, 64);
+            REQUIRE(ptr != nullptr);
+            for(size_t i = 0; i < 64; i++) ptr[i] = (char)i;
+
+            ptr = (char*)realloc(ptr, 128);
+            REQUIRE(ptr != nullptr);
+            for(size_t i = 0; i < 64; i++) CHECK(ptr[i] == (char)i);
+            size_t const size = tracked_size(ptr, 128);
+            CHECK(c.count() == size);
+
+            free(ptr);
+            c.stop();
+            CHECK(c.count() == 0);
+            CHECK(c.alloc_num() == 2);
+            CHECK(c.free_num() == 2);
+        }
+
+        SUBCASE("malloc_usable_size") {
+            c.start();
+            void* ptr = aligned_alloc(64, 1024);
+            CHECK(malloc_usable_size(ptr) >= 1024);
+            check_and_free(ptr, 64, 1024);
+        }
+
+        SUBCASE("operator new") {
+            struct alignas(64) Vector {
+                char data[64];
+            };
+
+            c.start();
+            auto v = new Vector[16];
+            v[0].data[0] = 0;
+            REQUIRE(v != nullptr);
+            CHECK((uintptr_t)v % 64 == 0);
+            size_t const size = tracked_size(v, 16 * sizeof(Vector));
+            CHECK(c.count() == size);
+            delete[] v;
+            c.stop();
+
+            CHECK(c.count() == 0);
+            CHECK(c.alloc_bytes() == size);
+            CHECK(c.free_bytes() == size);
+        }
+    }
+
+    // nb: not inlined so it shows up in the call stacks of samples
+    __attribute__((noinline)) void allocate_blocks(size_t num, size_t bytes) {
+        for(size_t i = 0; i < num; i++) {
+            char* array = new char[bytes];
+            array[0] = 0;
+            delete[] array;
+        }
+    }
+
+    TEST_CASE("MallocSampler") {
+        constexpr size_t interval = 64 * 1024;
+        constexpr size_t num = 1024;
+        constexpr size_t bytes = 4096;
+
+        MallocSampler s(interval, 5);
+        s.start();
+        allocate_blocks(num, bytes);
+        s.stop();
+
+        // we sample every 64 KiB on average out of 4 MiB, so we can expect about 64 samples
+        CHECK(s.samples() > 16);
+        CHECK(s.samples() < 256);
+        CHECK(s.dropped() == 0);
+        CHECK(s.num_sites() >= 1);
+
+        auto const json = s.gather_metrics();
+        CHECK(json["samples"] == s.samples());
+        CHECK(json["interval"] == interval);
+        REQUIRE(json["sites"].size() >= 1);
+        CHECK(json["sites"].size() <= 5);
+
+        // the estimate should be in the right ballpark
+        uintmax_t const estimate = json["bytes"];
+        CHECK(estimate > num * bytes / 2);
+        CHECK(estimate < num * bytes * 2);
+
+        auto const& top = json["sites"][0];
+        CHECK(top["samples"] >= 1);
+        CHECK(top["stack"].size() >= 1);
+        for(size_t i = 1; i < json["sites"].size(); i++) {
+            CHECK(json["sites"][i]["bytes"] <= json["sites"][i-1]["bytes"]);
+        }
+
+        // a moved-from sampler is empty and remains usable
+        MallocSampler moved(std::move(s));
+        CHECK(moved.num_sites() >= 1);
+        CHECK(s.num_sites() == 0);
+        CHECK(s.samples() == 0);
+        CHECK(s.gather_metrics()["sites"].empty());
+        s.start();
+        allocate_blocks(num, bytes);
+        s.stop();
+        CHECK(s.num_sites() == 0);
+    }
+
+    TEST_CASE("MallocHistogram") {
+        constexpr size_t num = 100;
+        size_t const size_48 = tracked_size(48);
+        size_t const size_4096 = tracked_size(4096);
+
+        MallocHistogram h;
+        h.start();
+        allocate_blocks(num, 48);
+        allocate_blocks(num / 2, 4096);
+        h.stop();
+
+        CHECK(h.alloc_count(size_48) == num);
+        CHECK(h.free_count(size_48) == num);
+        CHECK(h.alloc_count(size_4096) == num / 2);
+        CHECK(h.free_count(size_4096) == num / 2);
+
+        // nothing is tracked after stopping
+        allocate_blocks(num, 48);
+        CHECK(h.alloc_count(size_48) == num);
+
+        auto const json = h.gather_metrics();
+        REQUIRE(json["alloc"].size() == 2);
+        CHECK(json["alloc"][0]["min"] <= size_48);
+        CHECK(json["alloc"][0]["max"] >= size_48);
+        CHECK(json["alloc"][0]["count"] == num);
+        CHECK(json["alloc"][1]["min"] <= size_4096);
+        CHECK(json["alloc"][1]["max"] >= size_4096);
+        CHECK(json["alloc"][1]["count"] == num / 2);
+        CHECK(json["free"] == json["alloc"]);
+    }
+
+    TEST_CASE("MemoryTimeline") {
+        constexpr size_t size = 1024 * 1024;
+
+        SUBCASE("curve") {
+            MemoryTimeline t(std::chrono::milliseconds(1), true);
+            t.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            char* array = new char[size];
+            array[0] = 0;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            delete[] array;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            t.stop();
+
+            REQUIRE(t.num_samples() > 0);
+            intmax_t max = 0;
+            for(size_t i = 0; i < t.num_samples(); i++) max = std::max(max, t.bytes(i));
+            CHECK(max >= intmax_t(size));
+            CHECK(t.bytes(0) < intmax_t(size));
+            CHECK(t.bytes(t.num_samples() - 1) < intmax_t(size));
+            CHECK(t.rss(t.num_samples() - 1) > 0);
+
+            auto const json = t.gather_metrics();
+            CHECK(json["bytes"].size() == t.num_samples());
+            CHECK(json["rss"].size() == t.num_samples());
+        }
+
+        SUBCASE("downsample") {
+            MemoryTimeline t(std::chrono::microseconds(100), false, 8);
+            t.start();
+            char* array = new char[size];
+            array[0] = 0;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            delete[] array;
+            t.stop();
+
+            // the buffer must have been downsampled several times
+            CHECK(t.num_samples() < 8);
+            CHECK(t.interval() > std::chrono::microseconds(100));
+
+            // the peak survives the downsampling
+            intmax_t max = 0;
+            for(size_t i = 0; i < t.num_samples(); i++) max = std::max(max, t.bytes(i));
+            CHECK(max >= intmax_t(size));
+            CHECK(!t.gather_metrics().contains("rss"));
+        }
+
+        SUBCASE("short") {
+            // a measurement shorter than the interval has samples at its start and end
+            MemoryTimeline t(std::chrono::seconds(10));
+            t.start();
+            char* array = new char[size];
+            array[0] = 0;
+            t.stop();
+
+            REQUIRE(t.num_samples() == 2);
+            CHECK(t.bytes(0) == 0);
+            CHECK(t.bytes(1) >= intmax_t(size));
+            delete[] array;
+        }
+
+        SUBCASE("untracked") {
+            // launching the sampler thread is counted neither by enclosing measurements nor by the timeline itself
+            MemoryTimeline t(std::chrono::seconds(10));
+            MallocCounter c;
+            c.start();
+            t.start();
+            t.stop();
+            c.stop();
+            #ifndef PM_MALLOC_USABLE_SIZE
+            CHECK(c.alloc_num() == 0); // nb: nothing can be untracked with PM_MALLOC_USABLE_SIZE
+            #endif
+            CHECK(t.bytes(0) == 0);
+            CHECK(t.bytes(1) == 0);
+        }
+    }
+
+    #ifdef PM_MALLOC_MMAP
+    TEST_CASE("ProcessMemory") {
+        constexpr size_t size = 16 * 1024 * 1024;
+
+        ProcessMemory m;
+        m.start();
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        REQUIRE(ptr != MAP_FAILED);
+        ptr = mremap(ptr, size, 2 * size, MREMAP_MAYMOVE);
+        REQUIRE(ptr != MAP_FAILED);
+        munmap(ptr, 2 * size);
+        m.stop();
+
+        CHECK(m.mmap().map_num == 2);
+        CHECK(m.mmap().map_bytes == 2 * size);
+        CHECK(m.mmap().unmap_num == 1);
+        CHECK(m.mmap().unmap_bytes == 2 * size);
+
+        auto const json = m.gather_metrics();
+        CHECK(json["mmap_bytes"] == 2 * size);
+        CHECK(json["munmap_bytes"] == 2 * size);
+    }
+    #endif
+
+    TEST_CASE("Calibration") {
+        calibrate<MemoryTimePhase>(100);
+        CHECK(Overhead::hook<MemoryTimePhase>() > 0.0);
+        CHECK(Overhead::hook<TimePhase>() == 0.0);
+
+        // calibration must not leave fake allocations behind
+        MallocCounter c;
+        c.start();
+        auto const before = MallocCallback::num_notifications();
+        allocate_blocks(10, 64);
+        CHECK(MallocCallback::num_notifications() - before == 20);
+        c.stop();
+        CHECK(c.count() == 0);
+
+        // fake events must not reach running measurements
+        c.start();
+        CHECK(MallocCallback::num_registered() == 1);
+        CHECK_THROWS_AS(calibrate<MemoryTimePhase>(100), std::logic_error);
+        c.stop();
+        CHECK(MallocCallback::num_registered() == 0);
+
+        // the dispatch cost is only charged for events dispatched while a calibrated phase is running
+        auto const d0 = Overhead::dispatched();
+        allocate_blocks(10, 64);
+        CHECK(Overhead::dispatched() == d0);
+        {
+            MemoryTimePhase p("p");
+            p.start();
+            allocate_blocks(10, 64);
+            p.stop();
+        }
+        CHECK(Overhead::dispatched() - d0 == doctest::Approx(20 * Overhead::hook<MemoryTimePhase>()));
+        allocate_blocks(10, 64);
+        CHECK(Overhead::dispatched() - d0 == doctest::Approx(20 * Overhead::hook<MemoryTimePhase>()));
+
+        Overhead::phase<MemoryTimePhase>() = 0.0;
+        Overhead::hook<MemoryTimePhase>() = 0.0;
+    }
+
+    TEST_CASE("WorkerLoad") {
+        WorkerLoad load(2);
+        load.start();
+        std::thread([&](){
+            WorkerLoad::Scope scope(load, 0);
+            allocate_blocks(2, 1024);
+        }).join();
+        std::thread([&](){
+            WorkerLoad::Scope scope(load, 1);
+        }).join();
+
+        // allocations outside of scopes are not counted
+        allocate_blocks(1, 1024);
+        load.stop();
+
+        CHECK(load.alloc_num(0) == 2);
+        CHECK(load.alloc_bytes(0) == 2 * size_1024);
+        CHECK(load.alloc_num(1) == 0);
+        CHECK(load.num_workers() == 2);
+    }
+
+    TEST_CASE("LeakTracker") {
+        SUBCASE("basic") {
+            char* before = new char[64];
+            before[0] = 0;
+
+            std::vector<char*> small, large;
+            small.reserve(5);
+            large.reserve(2);
+
+            LeakTracker t(1024, LeakTracker::DEFAULT_TOP, 1);
+            t.start();
+
+            // blocks allocated before the measurement are ignored
+            delete[] before;
+
+            for(size_t i = 0; i < 5; i++) small.push_back(new char[64]);
+            for(size_t i = 0; i < 2; i++) large.push_back(new char[1024]);
+            for(size_t i = 0; i < 2; i++) {
+                delete[] small.back();
+                small.pop_back();
+            }
+
+            // frees are seen on other threads
+            std::thread([&](){ delete[] small.back(); }).join();
+            small.pop_back();
+            t.stop();
+
+            CHECK(t.dropped() == 0);
+
+            auto const json = t.gather_metrics();
+            CHECK(t.num_blocks() == 4);
+            CHECK(t.num_bytes() == 2 * size_64 + 2 * size_1024);
+            CHECK(json["blocks"] == t.num_blocks());
+            CHECK(json["bytes"] == t.num_bytes());
+            REQUIRE(json["sizes"].size() == 2);
+            CHECK(json["sizes"][0]["size"] == size_1024);
+            CHECK(json["sizes"][0]["count"] == 2);
+            CHECK(json["sizes"][0]["bytes"] == 2 * size_1024);
+            CHECK(json["sizes"][1]["size"] == size_64);
+            CHECK(json["sizes"][1]["count"] == 2);
+
+            // every block was sampled
+            REQUIRE(!json["stacks"].empty());
+            CHECK(json["stacks"][0]["bytes"] >= 2 * size_1024);
+
+            for(auto* p : small) delete[] p;
+            for(auto* p : large) delete[] p;
+        }
+
+        SUBCASE("dropped") {
+            std::vector<char*> blocks;
+            blocks.reserve(16);
+
+            LeakTracker t(4);
+            t.start();
+            for(size_t i = 0; i < 16; i++) blocks.push_back(new char[64]);
+            t.stop();
+
+            CHECK(t.num_blocks() == 4);
+            CHECK(t.dropped() == 12);
+            for(auto* p : blocks) delete[] p;
+        }
+
+        SUBCASE("moved") {
+            LeakTracker t(16);
+            t.start();
+            char* leak = new char[64];
+            t.stop();
+
+            // a moved-from tracker is empty and remains usable
+            LeakTracker moved(std::move(t));
+            CHECK(moved.num_blocks() == 1);
+            CHECK(t.num_blocks() == 0);
+            CHECK(t.num_bytes() == 0);
+            CHECK(t.dropped() == 0);
+            CHECK(t.gather_metrics()["blocks"] == 0);
+            t.start();
+            char* other = new char[64];
+            t.stop();
+            CHECK(t.num_blocks() == 0);
+            delete[] other;
+            delete[] leak;
+        }
+    }
+
+    #ifndef PM_MALLOC_USABLE_SIZE
+    TEST_CASE("TagCounter") {
+        AllocationTag const table("table");
+        AllocationTag const buffer("buffer");
+        CHECK(AllocationTag("table") == table);
+        CHECK(table.name() == "table");
+        CHECK(AllocationTag::name(0) == AllocationTag::UNTAGGED_NAME);
+
+        TagCounter c;
+        c.start();
+        char* t;
+        {
+            TagScope scope(table);
+            t = new char[1024];
+            {
+                // interleaved with another tag
+                TagScope nested(buffer);
+                allocate_blocks(4, 64);
+            }
+            allocate_blocks(1, 64);
+        }
+        CHECK(c.count(table) == size_1024);
+        CHECK(c.peak(table) == size_1024 + size_64);
+        CHECK(c.count(buffer) == 0);
+        CHECK(c.peak(buffer) == size_64);
+        CHECK(c.alloc_num(buffer) == 4);
+
+        // frees are credited back to the block's tag, even outside the scope and on other threads
+        std::thread([&](){ delete[] t; }).join();
+        c.stop();
+
+        CHECK(c.count(table) == 0);
+        CHECK(c.alloc_num(table) == 2);
+        CHECK(c.alloc_bytes(table) == size_1024 + size_64);
+        CHECK(c.free_num(table) == 2);
+        CHECK(c.free_bytes(table) == size_1024 + size_64);
+
+        auto const json = c.gather_metrics();
+        CHECK(json["table"]["peak"] == size_1024 + size_64);
+        CHECK(json["buffer"]["alloc_num"] == 4);
+    }
+
+    TEST_CASE("UntrackedScope") {
+        SUBCASE("basic") {
+            MallocCounter c;
+            c.start();
+            char* array;
+            {
+                UntrackedScope untracked;
+                array = new char[1024];
+                {
+                    UntrackedScope nested;
+                }
+
+                // still untracked after leaving the nested scope
+                allocate_blocks(1, 64);
+            }
+            CHECK(c.alloc_num() == 0);
+
+            // the free of an untracked block is not reported either
+            delete[] array;
+            allocate_blocks(1, 64);
+            c.stop();
+
+            CHECK(c.count() == 0);
+            CHECK(c.alloc_num() == 1);
+            CHECK(c.free_num() == 1);
+        }
+
+        SUBCASE("realloc") {
+            MallocCounter c;
+            c.start();
+            void* ptr;
+            {
+                UntrackedScope untracked;
+                ptr = malloc(64);
+            }
+
+            // reallocating outside of the scope frees untracked and allocates tracked
+            ptr = realloc(ptr, 1024);
+            CHECK(c.count() == size_1024);
+            CHECK(c.free_num() == 0);
+            free(ptr);
+            c.stop();
+
+            CHECK(c.count() == 0);
+        }
+
+        SUBCASE("phase bookkeeping") {
+            Phase<MallocCounter> root("root");
+            {
+                ScopedPhase<Phase<MallocCounter>> scope(root);
+                {
+                    ScopedPhase<Phase<MallocCounter>> child("child");
+                    child.phase().data()["x"] = 1;
+                }
+                CHECK(root.meter<0>().alloc_num() > 0); // the child's data
+
+                Phase<MallocCounter> inner("inner");
+                auto child_data = nlohmann::json::object();
+
+                auto const num = root.meter<0>().alloc_num();
+                inner.start();
+                inner.stop();
+                root.append_child(std::move(inner));
+                root.append_child_data(std::move(child_data));
+                CHECK(root.meter<0>().alloc_num() == num);
+            }
+
+            // gathering data is untracked
+            // nb: destroying the JSON is not measured, because nlohmann::json allocates a temporary stack for that
+            MallocCounter c;
+            c.start();
+            auto data = root.gather_data();
+            c.stop();
+            CHECK(c.alloc_num() == 0);
+            CHECK(data["children"].size() == 3);
+        }
+    }
+
+    TEST_CASE("ScopedPhase") {
+        Phase<MallocCounter> root("root");
+        {
+            ScopedPhase<Phase<MallocCounter>> scope(root);
+            for(int i = 0; i < 4; i++) {
+                ScopedPhase<TimePhase> outer("outer");
+                {
+                    ScopedPhase<TimePhase> inner("inner");
+                }
+            }
+            CHECK(root.meter<0>().alloc_num() == 0); // leaving the scopes allocated nothing tracked
+        }
+
+        auto const data = root.gather_data();
+        REQUIRE(data["children"].size() == 4);
+        CHECK(data["children"][0]["name"] == "outer");
+        CHECK(data["children"][0]["children"][0]["name"] == "inner");
+    }
+    #endif
+
     TEST_CASE("Phase") {
         Phase<MallocCounter, Stopwatch> phase("test");
         phase.start();
@@ -139,7 +944,32 @@ TEST_SUITE("pm_malloc") {
         phase.stop();
 
         CHECK(phase.meter<1>().elapsed_time_millis() >= 10);
-        CHECK(phase.meter<0>().peak() == 1024);
+        CHECK(phase.meter<0>().peak() == size_1024);
+
+        SUBCASE("retained") {
+            using Child = Phase<ShardedMallocCounter, MallocHistogram, Stopwatch>;
+            static_assert(sizeof(Child::Completed) < sizeof(ShardedMallocCounter));
+            static_assert(!Child::Completed::compact); // the histogram is retained as its metrics
+            static_assert(Phase<ShardedMallocCounter, MallocCounter, Stopwatch>::Completed::compact);
+
+            Child child("child");
+            child.start();
+            {
+                char* array = new char[1024];
+                array[0] = 0;
+                delete[] array;
+            }
+            child.stop();
+            child.data()["x"] = 1;
+            auto const expected = child.gather_data();
+
+            Phase<> root("root");
+            root.append_child(std::move(child));
+            auto const json = root.gather_data();
+            REQUIRE(json["children"].size() == 1);
+            CHECK(json["children"][0] == expected);
+            CHECK(std::move(root).gather_data() == json);
+        }
     }
 }
 
@@ -0,0 +1,43 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <pm.hpp>
+
+namespace pm::test {
+
+using namespace pm;
+
+// nb: this test must be run with pm-malloc-preload loaded via LD_PRELOAD, see CMakeLists.txt
+TEST_SUITE("pm_malloc_preload") {
+    TEST_CASE("report") {
+        char const* path = getenv("PM_PRELOAD_OUTPUT");
+        char const* sig = getenv("PM_PRELOAD_SIGNAL");
+        REQUIRE(path != nullptr);
+        REQUIRE(sig != nullptr);
+        std::remove(path);
+
+        size_t const bufsize = 1'000'000;
+        char* buffer = new char[bufsize];
+        buffer[0] = 0;
+        std::raise(atoi(sig));
+        delete[] buffer;
+
+        std::ifstream f(path);
+        std::string line;
+        REQUIRE(std::getline(f, line));
+
+        auto const json = nlohmann::json::parse(line);
+        CHECK(json["alloc_num"] >= 1);
+        CHECK(json["alloc_bytes"] >= bufsize);
+        CHECK(json["peak"] >= bufsize);
+        CHECK(json["closing"] >= bufsize);
+    }
+}
+
+}
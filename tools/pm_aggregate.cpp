@@ -0,0 +1,89 @@
+/**
+ * pm_aggregate.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pm/aggregator.hpp>
+#include <pm/record_log.hpp>
+
+namespace {
+
+void usage() {
+    std::cerr << "usage: pm-aggregate [--json | --result] [FILE...]" << std::endl
+              << std::endl
+              << "Merges the results of many processes, such as the ranks of an MPI job, into one summary." << std::endl
+              << "Every input is a binary record log written by pm::RecordWriter, or a text file of" << std::endl
+              << "RESULT lines or JSON phase data. Every record, line or document is one rank." << std::endl
+              << "Reads standard input if no files are given." << std::endl
+              << "  --json    print the summary as a JSON document (default)" << std::endl
+              << "  --result  print the summary as a RESULT line" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    bool result = false;
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; i++) {
+        std::string const arg = argv[i];
+        if(arg == "--json") {
+            result = false;
+        } else if(arg == "--result") {
+            result = true;
+        } else if(arg == "--help" || arg == "-h") {
+            usage();
+            return EXIT_SUCCESS;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    try {
+        pm::Aggregator agg;
+        if(paths.empty()) {
+            for(auto const& r : pm::load_results(std::cin)) agg.add(r);
+        } else {
+            for(auto const& path : paths) {
+                for(auto const& r : pm::load_results(path)) agg.add(r);
+            }
+        }
+
+        if(result) {
+            agg.result().print(std::cout);
+        } else {
+            std::cout << agg.summary().dump(4) << std::endl;
+        }
+    } catch(std::exception const& e) {
+        std::cerr << "pm-aggregate: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/**
+ * pm_compare.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pm/comparison.hpp>
+#include <pm/record_log.hpp>
+
+namespace {
+
+void usage() {
+    std::cerr << "usage: pm-compare [OPTIONS] BASELINE CANDIDATE" << std::endl
+              << std::endl
+              << "Compares two result sets for performance regressions and exits with a non-zero status if any metric regressed" << std::endl
+              << "or if any results or metrics of one set have no counterpart with the same identity in the other." << std::endl
+              << "Every input is a binary record log written by pm::RecordWriter, or a text file of" << std::endl
+              << "RESULT lines or JSON phase data. Every record, line or document is one result, and results" << std::endl
+              << "with the same non-numeric values and phase data are repetitions of the same measurement." << std::endl
+              << "  --threshold X           the relative change above which a metric regressed (default: 0.05)" << std::endl
+              << "  --alpha X               the significance level for metrics with repetitions (default: 0.05)" << std::endl
+              << "  --key S                 only compare metrics whose key contains S; may be given multiple times" << std::endl
+              << "  --group-by KEY          treat numeric values of KEY as part of the identity of a result rather than" << std::endl
+              << "                          a metric; may be given multiple times" << std::endl
+              << "  --higher-is-better KEY  larger values of the metric KEY are better; may be given multiple times" << std::endl
+              << "  --json                  print the comparisons as a JSON array" << std::endl;
+}
+
+bool matches(std::string const& key, std::vector<std::string> const& filters) {
+    if(filters.empty()) return true;
+    for(auto const& f : filters) {
+        if(key.find(f) != std::string::npos) return true;
+    }
+    return false;
+}
+
+void print(pm::MetricComparison const& c) {
+    char p[16];
+    if(std::isnan(c.p_value)) {
+        std::snprintf(p, sizeof(p), "-");
+    } else {
+        std::snprintf(p, sizeof(p), "%.4f", c.p_value);
+    }
+    std::printf("%s %-48s %14g %14g %+9.2f%% p=%s\n", c.regression ? "!" : " ", c.key.c_str(), c.baseline.mean, c.candidate.mean, 100.0 * c.change, p);
+}
+
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    double threshold = pm::Comparison::DEFAULT_THRESHOLD;
+    double alpha = pm::Comparison::DEFAULT_ALPHA;
+    std::vector<std::string> filters;
+    std::vector<std::string> identity_keys;
+    std::vector<std::string> higher_is_better_keys;
+    std::vector<std::string> paths;
+
+    try {
+        for(int i = 1; i < argc; i++) {
+            std::string const arg = argv[i];
+            if(arg == "--json") {
+                json = true;
+            } else if((arg == "--threshold" || arg == "--alpha" || arg == "--key" || arg == "--group-by" || arg == "--higher-is-better") && i + 1 < argc) {
+                std::string const value = argv[++i];
+                if(arg == "--threshold") {
+                    threshold = std::stod(value);
+                } else if(arg == "--alpha") {
+                    alpha = std::stod(value);
+                } else if(arg == "--group-by") {
+                    identity_keys.push_back(value);
+                } else if(arg == "--higher-is-better") {
+                    higher_is_better_keys.push_back(value);
+                } else {
+                    filters.push_back(value);
+                }
+            } else if(arg == "--help" || arg == "-h") {
+                usage();
+                return EXIT_SUCCESS;
+            } else if(arg.starts_with("--")) {
+                usage();
+                return EXIT_FAILURE;
+            } else {
+                paths.push_back(arg);
+            }
+        }
+
+        if(paths.size() != 2) {
+            usage();
+            return EXIT_FAILURE;
+        }
+
+        pm::Comparison cmp(threshold, alpha);
+        for(auto const& key : identity_keys) cmp.group_by(key);
+        for(auto const& key : higher_is_better_keys) cmp.higher_is_better(key);
+        for(auto const& r : pm::load_results(paths[0])) cmp.add_baseline(r);
+        for(auto const& r : pm::load_results(paths[1])) cmp.add_candidate(r);
+
+        bool regressed = false;
+        auto out = nlohmann::json::array();
+        std::string const* group = nullptr;
+        for(auto const& c : cmp.compare()) {
+            if(!matches(c.key, filters)) continue;
+
+            regressed = regressed || c.regression;
+            if(json) {
+                out.push_back(c.to_json());
+            } else {
+                if(!c.group.empty() && (!group || *group != c.group)) std::printf("[%s]\n", c.group.c_str());
+                group = &c.group;
+                print(c);
+            }
+        }
+
+        if(json) std::cout << out.dump(4) << std::endl;
+
+        // results without a counterpart cannot be compared, which must not let the gate pass silently
+        auto const missing = cmp.unmatched_baseline();
+        auto const added = cmp.unmatched_candidate();
+        for(auto const& group : missing) std::cerr << "pm-compare: no candidate results for [" << group << "]" << std::endl;
+        for(auto const& group : added) std::cerr << "pm-compare: no baseline results for [" << group << "]" << std::endl;
+
+        // likewise for metrics that only one side of a matched identity reports
+        bool one_sided = false;
+        for(auto const& [group, key] : cmp.unmatched_baseline_metrics()) {
+            if(!matches(key, filters)) continue;
+            std::cerr << "pm-compare: no candidate values for " << key << " in [" << group << "]" << std::endl;
+            one_sided = true;
+        }
+        for(auto const& [group, key] : cmp.unmatched_candidate_metrics()) {
+            if(!matches(key, filters)) continue;
+            std::cerr << "pm-compare: no baseline values for " << key << " in [" << group << "]" << std::endl;
+            one_sided = true;
+        }
+
+        return (regressed || !missing.empty() || !added.empty() || one_sided) ? EXIT_FAILURE : EXIT_SUCCESS;
+    } catch(std::exception const& e) {
+        std::cerr << "pm-compare: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * pm_convert.cpp
+ * part of pdinklag/pm
+ * 
+ * MIT License
+ * 
+ * Copyright (c) 2023 Patrick Dinklage
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <pm/record_log.hpp>
+
+namespace {
+
+void usage() {
+    std::cerr << "usage: pm-convert [--json | --result] LOG" << std::endl
+              << std::endl
+              << "Converts a binary record log written by pm::RecordWriter." << std::endl
+              << "  --json    print one JSON document per record (default)" << std::endl
+              << "  --result  print one RESULT line per record" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    bool result = false;
+    std::string path;
+
+    for(int i = 1; i < argc; i++) {
+        std::string const arg = argv[i];
+        if(arg == "--json") {
+            result = false;
+        } else if(arg == "--result") {
+            result = true;
+        } else if(arg == "--help" || arg == "-h") {
+            usage();
+            return EXIT_SUCCESS;
+        } else if(path.empty()) {
+            path = arg;
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(path.empty()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        pm::RecordReader reader(path);
+        if(result) {
+            pm::convert_records_to_result(reader, std::cout);
+        } else {
+            pm::convert_records_to_json(reader, std::cout);
+        }
+    } catch(std::exception const& e) {
+        std::cerr << "pm-convert: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}